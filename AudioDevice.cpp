@@ -5,9 +5,11 @@
 #include <IOKit/audio/IOAudioControl.h>
 #include <IOKit/audio/IOAudioLevelControl.h>
 #include <IOKit/audio/IOAudioToggleControl.h>
+#include <IOKit/audio/IOAudioSelectorControl.h>
 #include <IOKit/audio/IOAudioDefines.h>
 
 #include <IOKit/IOLib.h>
+#include <IOKit/IOTimerEventSource.h>
 
 #include <IOKit/pci/IOPCIDevice.h>
 #include "misc.h"
@@ -67,6 +69,19 @@ bool Envy24HTAudioDevice::initHardware(IOService *provider)
 	{
 		goto Done;
 	}
+	
+	// Walks the hardware volume controls to their new values in codec steps, on the codecs that
+	// don't do that themselves
+	rampVolume = true;
+	volumeTimer = IOTimerEventSource::timerEventSource(this, volumeTimerFired);
+	if (!volumeTimer || getWorkLoop()->addEventSource(volumeTimer) != kIOReturnSuccess)
+	{
+		goto Done;
+	}
+	
+	// Soft-mutes the codecs after a stretch of digital silence, if the engine is set up for it
+	silenceMute = false;
+	silenceMuted = false;
 
     if (!createAudioEngine()) {
         goto Done;
@@ -104,6 +119,14 @@ void Envy24HTAudioDevice::free()
 {
     DBGPRINT("Envy24HTAudioDevice[%p]::free()\n", this);
     
+	if (volumeTimer)
+	{
+		volumeTimer->cancelTimeout();
+		getWorkLoop()->removeEventSource(volumeTimer);
+		volumeTimer->release();
+		volumeTimer = NULL;
+	}
+	
 	if (card)
 	{
       if (card->iobase) {
@@ -131,6 +154,10 @@ bool Envy24HTAudioDevice::createAudioEngine()
     bool result = false;
     Envy24HTAudioEngine *audioEngine = NULL;
     IOAudioControl *control;
+    IOAudioSelectorControl *ditherControl;
+    IOAudioSelectorControl *stageControl;
+    IOAudioSelectorControl *rampControl;
+    IOAudioSelectorControl *spdifControl;
 	struct Parm *p = card->ParmList;
     
     DBGPRINT("Envy24HTAudioDevice[%p]::createAudioEngine()\n", this);
@@ -167,6 +194,15 @@ bool Envy24HTAudioDevice::createAudioEngine()
         audioEngine->addDefaultAudioControl(control);
         control->release();
         
+        p->CurrentValue = p->InitialValue;
+        p->TargetValue = p->InitialValue;
+        p->RampStep = 1;
+        p->Muted = false;
+        
+        // The AKM DACs move their digital attenuators in soft steps of their own (the DATT speed
+        // or ATS setting), the Wolfson codecs on the Aureons jump straight there
+        p->SoftStep = !(card->SubType == AUREON_SPACE || card->SubType == AUREON_SKY);
+        
         if (p->HasMute)
         {
             // Create an output mute control
@@ -184,6 +220,122 @@ bool Envy24HTAudioDevice::createAudioEngine()
         p = p->Next;
     }
     
+    // Boards without a ParmList (Prodigy HD2, Cantatis) have no attenuators the driver knows how to
+    // set, so they get a software volume per channel instead, applied in the clip pass
+    if (!card->ParmList)
+    {
+        static const char *channelNames[CLIP_KERNEL_MAX_CHANNELS] = { kIOAudioControlChannelNameLeft, kIOAudioControlChannelNameRight,
+                                                                      "Output 3", "Output 4", "Output 5", "Output 6", "Output 7", "Output 8" };
+        
+        for (UInt32 channel = 0; channel < card->Specific.NumChannels && channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+        {
+            control = IOAudioLevelControl::createVolumeControl(CLIP_GAIN_MAX,       // Initial value, 0 dB
+                                                               0,                   // min value, muted
+                                                               CLIP_GAIN_MAX,       // max value
+                                                               (-64 << 16) + 32768, // -63.5 dB in IOFixed, 0.5 dB steps
+                                                               0,                   // max 0.0 in IOFixed
+                                                               kIOAudioControlChannelIDDefaultLeft + channel,
+                                                               channelNames[channel],
+                                                               channel,             // control ID - driver-defined
+                                                               kIOAudioControlUsageOutput);
+            if (!control) {
+                IOLog("Failed to create software volume control!\n");
+                goto Done;
+            }
+            
+            control->setValueChangeHandler((IOAudioControl::IntValueChangeHandler)Envy24HTAudioEngine::softwareVolumeChangeHandler, audioEngine);
+            audioEngine->addDefaultAudioControl(control);
+            control->release();
+        }
+    }
+    
+    // All the DACs are 24 bit, the clip kernels can dither down to that
+    ditherControl = IOAudioSelectorControl::create(kClipDitherNone,
+                                                   kIOAudioControlChannelIDAll,
+                                                   kIOAudioControlChannelNameAll,
+                                                   DITHER_CONTROL_ID,
+                                                   DITHER_CONTROL_SUBTYPE,
+                                                   kIOAudioControlUsageOutput);
+    if (!ditherControl) {
+        IOLog("Failed to create dither control!\n");
+        goto Done;
+    }
+    
+    ditherControl->addAvailableSelection(kClipDitherNone, "No dither");
+    ditherControl->addAvailableSelection(kClipDitherTPDF, "TPDF dither");
+    ditherControl->addAvailableSelection(kClipDitherShaped, "TPDF dither + noise shaping");
+    ditherControl->setValueChangeHandler((IOAudioControl::IntValueChangeHandler)Envy24HTAudioEngine::ditherChangeHandler, audioEngine);
+    audioEngine->addDefaultAudioControl(ditherControl);
+    ditherControl->release();
+    
+    // What happens to samples beyond full scale
+    stageControl = IOAudioSelectorControl::create(kClipStageHard,
+                                                  kIOAudioControlChannelIDAll,
+                                                  kIOAudioControlChannelNameAll,
+                                                  STAGE_CONTROL_ID,
+                                                  STAGE_CONTROL_SUBTYPE,
+                                                  kIOAudioControlUsageOutput);
+    if (!stageControl) {
+        IOLog("Failed to create output stage control!\n");
+        goto Done;
+    }
+    
+    stageControl->addAvailableSelection(kClipStageHard, "Hard clip");
+    stageControl->addAvailableSelection(kClipStageSoft, "Soft clip");
+    stageControl->addAvailableSelection(kClipStageLimiter, "Limiter");
+    stageControl->setValueChangeHandler((IOAudioControl::IntValueChangeHandler)Envy24HTAudioEngine::stageChangeHandler, audioEngine);
+    audioEngine->addDefaultAudioControl(stageControl);
+    stageControl->release();
+    
+    // How volume changes get from one level to the next
+    rampControl = IOAudioSelectorControl::create(kClipRampExponential,
+                                                 kIOAudioControlChannelIDAll,
+                                                 kIOAudioControlChannelNameAll,
+                                                 RAMP_CONTROL_ID,
+                                                 RAMP_CONTROL_SUBTYPE,
+                                                 kIOAudioControlUsageOutput);
+    if (!rampControl) {
+        IOLog("Failed to create volume ramp control!\n");
+        goto Done;
+    }
+    
+    rampControl->addAvailableSelection(kClipRampOff, "No volume ramps");
+    rampControl->addAvailableSelection(kClipRampLinear, "Linear volume ramps");
+    rampControl->addAvailableSelection(kClipRampExponential, "Exponential volume ramps");
+    rampControl->setValueChangeHandler((IOAudioControl::IntValueChangeHandler)Envy24HTAudioEngine::rampChangeHandler, audioEngine);
+    audioEngine->addDefaultAudioControl(rampControl);
+    rampControl->release();
+    
+    // What the S/PDIF output carries: one of the stereo pairs, or all channels downmixed
+    if (card->Specific.HasSPDIF)
+    {
+        static const char *pairNames[CLIP_KERNEL_MAX_CHANNELS / 2] = { "S/PDIF: Output 1/2", "S/PDIF: Output 3/4",
+                                                                       "S/PDIF: Output 5/6", "S/PDIF: Output 7/8" };
+        
+        spdifControl = IOAudioSelectorControl::create(0,
+                                                      kIOAudioControlChannelIDAll,
+                                                      kIOAudioControlChannelNameAll,
+                                                      SPDIF_CONTROL_ID,
+                                                      SPDIF_CONTROL_SUBTYPE,
+                                                      kIOAudioControlUsageOutput);
+        if (!spdifControl) {
+            IOLog("Failed to create S/PDIF source control!\n");
+            goto Done;
+        }
+        
+        for (UInt32 pair = 0; pair * 2 + 1 < card->Specific.NumChannels && pair < CLIP_KERNEL_MAX_CHANNELS / 2; pair++)
+        {
+            spdifControl->addAvailableSelection(pair, pairNames[pair]);
+        }
+        if (card->Specific.NumChannels > 2)
+        {
+            spdifControl->addAvailableSelection(SPDIF_SOURCE_DOWNMIX, "S/PDIF: Downmix");
+        }
+        spdifControl->setValueChangeHandler((IOAudioControl::IntValueChangeHandler)Envy24HTAudioEngine::spdifChangeHandler, audioEngine);
+        audioEngine->addDefaultAudioControl(spdifControl);
+        spdifControl->release();
+    }
+    
 #if 0
 	
     // Create an output mute control
@@ -266,46 +418,22 @@ IOReturn Envy24HTAudioDevice::volumeChanged(IOAudioControl *volumeControl, SInt3
         {
             if (volumeControl->getControlID() == p->ControlID) 
             {
-                unsigned char val = newValue;
-                //val = val | (val << 8);
+                SInt32 distance = (newValue > p->CurrentValue) ? newValue - p->CurrentValue : p->CurrentValue - newValue;
                 
-                //IOLog("write reg %d, val %d\n", p->reg, val);
-                if (p->I2C)
+                p->TargetValue = newValue;
+                
+                if (!rampVolume || distance <= 1 || p->SoftStep)
                 {
-                    WriteI2C(card->pci_dev, card, p->I2C_codec_addr, p->reg, val | 0x80);
+                    writeVolume(p, newValue);
                 }
                 else
                 {
-                    if (val <= p->MinValue && p->codec)
-                    {
-                        if (p->codec->type == AKM4528 ||
-                            p->codec->type == AKM4524 ||
-                            p->codec->type == AKM4355 ||
-                            p->codec->type == AKM4381)
-                        {
-                            val = 0;
-                        }
-                    }
-                    
-                    if (p->codec && p->codec->type == AKM4358)
-                    {
-                        val |= 0x80; // enable
-                    }
-                    //IOLog("AKM write reg %d, val %d\n", p->reg, val);
-
-                    if (card->SubType == AP192)
-                    {
-                        set_dac(card, p->reg, val);
-                    }
-                    else if (card->SubType == AUREON_SPACE || card->SubType == AUREON_SKY)
-                    {
-                        wm_put(card, card->iobase, p->reg, val | 0x100);
-                    }
-                    else
-                    {
-                        akm4xxx_write(card, p->codec, 0, p->reg, val);
-                    }
-
+                    // A jump straight to the new value clicks on a codec that doesn't soft step.
+                    // The codec steps are as fine as the volume gets in hardware, so it's walked
+                    // there a step (or a few) at a time, taking about VOLUME_RAMP_MS whatever the
+                    // distance.
+                    p->RampStep = (distance + VOLUME_RAMP_MS - 1) / VOLUME_RAMP_MS;
+                    volumeTimer->setTimeoutMS(1);
                 }
                 break;
             }
@@ -316,6 +444,82 @@ IOReturn Envy24HTAudioDevice::volumeChanged(IOAudioControl *volumeControl, SInt3
     
     return kIOReturnSuccess;
 }
+
+void Envy24HTAudioDevice::volumeTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+    Envy24HTAudioDevice *audioDevice = OSDynamicCast(Envy24HTAudioDevice, owner);
+    struct Parm *p;
+    bool pending = false;
+    
+    if (!audioDevice) {
+        return;
+    }
+    
+    for (p = audioDevice->card->ParmList; p != NULL; p = p->Next)
+    {
+        if (p->CurrentValue < p->TargetValue)
+        {
+            audioDevice->writeVolume(p, (p->TargetValue - p->CurrentValue > p->RampStep) ? p->CurrentValue + p->RampStep : p->TargetValue);
+        }
+        else if (p->CurrentValue > p->TargetValue)
+        {
+            audioDevice->writeVolume(p, (p->CurrentValue - p->TargetValue > p->RampStep) ? p->CurrentValue - p->RampStep : p->TargetValue);
+        }
+        
+        pending |= (p->CurrentValue != p->TargetValue);
+    }
+    
+    if (pending) {
+        sender->setTimeoutMS(1);
+    }
+}
+
+// Writes a volume level to the codec the parm belongs to
+void Envy24HTAudioDevice::writeVolume(struct Parm *p, SInt32 value)
+{
+    unsigned char val = value;
+    //val = val | (val << 8);
+    
+    p->CurrentValue = value;
+    
+    //IOLog("write reg %d, val %d\n", p->reg, val);
+    if (p->I2C)
+    {
+        WriteI2C(card->pci_dev, card, p->I2C_codec_addr, p->reg, val | 0x80);
+    }
+    else
+    {
+        if (val <= p->MinValue && p->codec)
+        {
+            if (p->codec->type == AKM4528 ||
+                p->codec->type == AKM4524 ||
+                p->codec->type == AKM4355 ||
+                p->codec->type == AKM4381)
+            {
+                val = 0;
+            }
+        }
+        
+        if (p->codec && p->codec->type == AKM4358)
+        {
+            val |= 0x80; // enable
+        }
+        //IOLog("AKM write reg %d, val %d\n", p->reg, val);
+
+        if (card->SubType == AP192)
+        {
+            set_dac(card, p->reg, val);
+        }
+        else if (card->SubType == AUREON_SPACE || card->SubType == AUREON_SKY)
+        {
+            wm_put(card, card->iobase, p->reg, val | 0x100);
+        }
+        else
+        {
+            akm4xxx_write(card, p->codec, 0, p->reg, val);
+        }
+    }
+}
     
 IOReturn Envy24HTAudioDevice::outputMuteChangeHandler(IOService *target, IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue)
 {
@@ -345,19 +549,8 @@ IOReturn Envy24HTAudioDevice::outputMuteChanged(IOAudioControl *muteControl, SIn
             {
                 if (p->HasMute)
                 {
-                    if (p->I2C)
-                    {
-                        WriteI2C(card->pci_dev, card, p->I2C_codec_addr, p->MuteReg, newValue > 0 ? p->MuteOnVal : p->MuteOffVal);
-                    }
-                    else if (p->codec)
-                    {
-                        akm4xxx_write(card, p->codec, 0, p->MuteReg, newValue > 0 ? p->MuteOnVal : p->MuteOffVal);
-                    }
-                    else if (card->SubType == AUREON_SPACE || card->SubType == AUREON_SKY)
-                    {
-                        wm_put(card, card->iobase, p->MuteReg, newValue > 0 ? p->MuteOnVal : p->MuteOffVal);
-                    }
-                    
+                    p->Muted = (newValue > 0);
+                    writeMute(p);
                 }
                 break;
             }
@@ -370,6 +563,55 @@ IOReturn Envy24HTAudioDevice::outputMuteChanged(IOAudioControl *muteControl, SIn
 	return kIOReturnSuccess;
 }
 
+// Writes the mute of the codec the parm belongs to, muted if the control says so or while the
+// output is silence muted
+void Envy24HTAudioDevice::writeMute(struct Parm *p)
+{
+    unsigned char val = (p->Muted || silenceMuted) ? p->MuteOnVal : p->MuteOffVal;
+    
+    if (p->I2C)
+    {
+        WriteI2C(card->pci_dev, card, p->I2C_codec_addr, p->MuteReg, val);
+    }
+    else if (p->codec)
+    {
+        akm4xxx_write(card, p->codec, 0, p->MuteReg, val);
+    }
+    else if (card->SubType == AUREON_SPACE || card->SubType == AUREON_SKY)
+    {
+        wm_put(card, card->iobase, p->MuteReg, val);
+    }
+}
+
+// Called from the clip pass, which can't wait for the codecs nor arm a timer, so it only leaves
+// the flag for updateSilenceMute()
+void Envy24HTAudioDevice::requestSilenceMute(bool mute)
+{
+    if (silenceMute != mute)
+    {
+        silenceMute = mute;
+    }
+}
+
+// Brings the codecs in line with the flag, on the work loop. The engine polls it while it runs.
+void Envy24HTAudioDevice::updateSilenceMute()
+{
+    struct Parm *p;
+    
+    if (silenceMuted == silenceMute) {
+        return;
+    }
+    
+    silenceMuted = silenceMute;
+    for (p = card->ParmList; p != NULL; p = p->Next)
+    {
+        if (p->HasMute && p->Usage == kIOAudioControlUsageOutput)
+        {
+            writeMute(p);
+        }
+    }
+}
+
 IOReturn Envy24HTAudioDevice::gainChangeHandler(IOService *target, IOAudioControl *gainControl, SInt32 oldValue, SInt32 newValue)
 {
     IOReturn result = kIOReturnBadArgument;
@@ -13,6 +13,7 @@
 
 class IOPCIDevice;
 class IOMemoryMap;
+class IOTimerEventSource;
 
 #define Envy24HTAudioDevice com_audio_evolution_driver_Envy24HT
 
@@ -24,6 +25,10 @@ class Envy24HTAudioDevice : public IOAudioDevice
     OSDeclareDefaultStructors(Envy24HTAudioDevice)
     
 	struct CardData *card;
+	IOTimerEventSource *volumeTimer;
+	bool rampVolume;
+	volatile bool silenceMute;	// set by the clip pass, the engine's poll brings the codecs in line
+	bool silenceMuted;
 
     virtual bool	initHardware(IOService *provider);
     virtual bool	createAudioEngine();
@@ -36,9 +41,14 @@ class Envy24HTAudioDevice : public IOAudioDevice
     
 	static IOReturn volumeChangeHandler(IOService *target, IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue);
     virtual IOReturn volumeChanged(IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue);
+    void writeVolume(struct Parm *p, SInt32 value);
+    static void volumeTimerFired(OSObject *owner, IOTimerEventSource *sender);
     
     static IOReturn outputMuteChangeHandler(IOService *target, IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue);
     virtual IOReturn outputMuteChanged(IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue);
+    void writeMute(struct Parm *p);
+    void requestSilenceMute(bool mute);
+    void updateSilenceMute();
 
     static IOReturn gainChangeHandler(IOService *target, IOAudioControl *gainControl, SInt32 oldValue, SInt32 newValue);
     virtual IOReturn gainChanged(IOAudioControl *gainControl, SInt32 oldValue, SInt32 newValue);
@@ -3,6 +3,8 @@
 #include <IOKit/IOLib.h>
 
 #include <IOKit/IOFilterInterruptEventSource.h>
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOCommandGate.h>
 
 #include <IOKit/pci/IOPCIDevice.h>
 #include "regs.h"
@@ -10,6 +12,14 @@
 
 #define INITIAL_SAMPLE_RATE	44100
 
+// The clip kernels write native SInt32s, clients of the non-mixable formats write the DMA buffer
+// the same way
+#if defined(__BIG_ENDIAN__)
+	#define NATIVE_BYTE_ORDER	kIOAudioStreamByteOrderBigEndian
+#else
+	#define NATIVE_BYTE_ORDER	kIOAudioStreamByteOrderLittleEndian
+#endif
+
 #define FREQUENCIES 15
 
 
@@ -96,6 +106,75 @@ bool Envy24HTAudioEngine::init(struct CardData* i_card)
 		goto Done;
 	}
 	card = i_card;
+	pollTimer = NULL;
+	
+	// Pick the clip kernel once at load time, based on what the CPU supports and the board's channel count.
+	// performFormatChange() and the dither and output stage controls pick them again.
+	clipKernelType = DetectClipKernelType();
+	ditherMode = kClipDitherNone;
+	ditherRequest = 0;
+	ditherApplied = 0;
+	stageMode = kClipStageHard;
+	stageRequest = 0;
+	stageApplied = 0;
+	InitClipKernelState(&clipState);
+	rampShape = kClipRampExponential;
+	InitClipMeters(&inputMeter);
+	inputEnd = 0;
+	decimatedEnd = 0;
+	inputChannels = 2;
+	
+	// The S/PDIF output starts out with the first pair, the downmix is there to be selected
+	spdifSource = 0;
+	for (UInt32 side = 0; side < 2; side++)
+	{
+		for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+		{
+			spdifDownmix.gain[side][slot] = (slot == side) ? CLIP_ROUTE_UNITY : 0;
+		}
+		spdifDownmix.gain[side][2] = DOWNMIX_ITU_GAIN;
+		spdifDownmix.gain[side][4 + side] = DOWNMIX_ITU_GAIN;
+		spdifDownmix.gain[side][6 + side] = DOWNMIX_ITU_GAIN;
+	}
+	
+	// No bass management until a crossover is set, then everything but the LFE goes to it
+	bassManagement.frequency = 0;
+	bassManagement.sampleRate = INITIAL_SAMPLE_RATE;
+	bassManagement.lfeSlot = BASS_LFE_SLOT;
+	bassManagement.managed = ((1U << CLIP_KERNEL_MAX_CHANNELS) - 1) & ~(1U << BASS_LFE_SLOT);
+	
+	if (!selectClipKernels(card->Specific.NumChannels)) {
+		IOLog("Envy24HTAudioEngine: unsupported number of channels (%u)\n", (unsigned int) card->Specific.NumChannels);
+		goto Done;
+	}
+	convertKernel = GetConvertKernel(clipKernelType);
+	inputDecimate = GetClipDecimate(clipKernelType, inputChannels);
+	silenceKernel = GetSilenceKernel(clipKernelType);
+	silentFrames = 0;
+	silenceMuteMS = 0;
+	convMemory = NULL;
+	convSize = 0;
+	convolving = false;
+	delayMemory = NULL;
+	delaySize = 0;
+	
+	// No oversampling until it's asked for, the buffer for it is allocated then. The hardware starts
+	// out at INITIAL_SAMPLE_RATE, until performFormatChange() says otherwise.
+	currentSampleRate = INITIAL_SAMPLE_RATE;
+	oversampling.ratio = 1;
+	oversampling.taps = CLIP_OVERSAMPLE_TAPS;
+	spdifRate = false;
+	hardwareRatio = 1;
+	outputMixable = true;
+	oversampleBuffer = NULL;
+	decimatedBuffer = NULL;
+	clipEnd = 0;
+	eraseEnd = 0;
+	SetClipDecimator(&inputDecimator, &oversampling, NUM_SAMPLE_FRAMES);
+	applyRamp();
+	erasedFrames = 0;
+	skippedFrames = 0;
+	DBGPRINT("Envy24HTAudioEngine using the %s clip kernel\n", ClipKernelName(clipKernelType));
 	
     result = true;
     
@@ -161,6 +240,14 @@ bool Envy24HTAudioEngine::initHardware(IOService *provider)
         goto Done;
     }
 	
+	// The delay lines take the longest delay at the highest rate, so the clip pass never waits for memory
+	delaySize = ClipDelaySize(outputChannels);
+	delayMemory = IOMallocAligned(delaySize, 64);
+	if (!delayMemory) {
+		goto Done;
+	}
+	clipState.delayLines = InitClipDelay(delayMemory, outputChannels);
+	
 	card->pci_dev->ioWrite32(MT_DMAI_PB_ADDRESS, physicalAddressOutput, card->mtbase);
 	card->pci_dev->ioWrite32(MT_RDMA0_ADDRESS, physicalAddressInput, card->mtbase);
 	card->pci_dev->ioWrite32(MT_PDMA4_ADDRESS, physicalAddressOutputSPDIF, card->mtbase); // SPDIF
@@ -177,7 +264,19 @@ bool Envy24HTAudioEngine::initHardware(IOService *provider)
     audioStream->release();
 
 	
-    audioStream = createNewAudioStream(kIOAudioStreamDirectionInput, inputBuffer, card->Specific.BufferSizeRec, 1, 2);
+	// The line input. There is no stream for the S/PDIF input: RDMA1 runs off MT_SAMPLERATE like the
+	// other DMA channels, so a source that isn't locked to the card has already slipped frames in the
+	// receiver by the time they get there, and no resampler behind it could undo that.
+    audioStream = createNewAudioStream(kIOAudioStreamDirectionInput, inputBuffer, card->Specific.BufferSizeRec, 1, inputChannels);
+    if (!audioStream) {
+        goto Done;
+    }
+    
+    addAudioStream(audioStream);
+    audioStream->release();
+	
+	// The loopback stream, over the output DMA buffer
+    audioStream = createNewAudioStream(kIOAudioStreamDirectionInput, outputBuffer, card->Specific.BufferSize, 1 + inputChannels, card->Specific.NumChannels);
     if (!audioStream) {
         goto Done;
     }
@@ -206,6 +305,12 @@ bool Envy24HTAudioEngine::initHardware(IOService *provider)
 	interruptEventSource->enable();
 
     workLoop->addEventSource(interruptEventSource);
+	
+	// Publishes the meters while the engine runs, the clip pass can't touch the registry
+	pollTimer = IOTimerEventSource::timerEventSource(this, pollTimerFired);
+	if (!pollTimer || workLoop->addEventSource(pollTimer) != kIOReturnSuccess) {
+		goto Done;
+	}
 		
     result = true;
     
@@ -226,6 +331,11 @@ void Envy24HTAudioEngine::free()
         interruptEventSource = NULL;
     }
     
+    if (pollTimer) {
+        pollTimer->release();
+        pollTimer = NULL;
+    }
+    
     if (outputBuffer) {
         IOFreeContiguous(outputBuffer, card->Specific.BufferSize);
         outputBuffer = NULL;
@@ -240,6 +350,27 @@ void Envy24HTAudioEngine::free()
 		IOFreeContiguous(inputBuffer, card->Specific.BufferSizeRec);
         inputBuffer = NULL;
     }
+	
+	if (convMemory) {
+		clipState.conv = NULL;
+		IOFreeAligned(convMemory, convSize);
+		convMemory = NULL;
+	}
+	
+	if (delayMemory) {
+		clipState.delayLines = NULL;
+		IOFreeAligned(delayMemory, delaySize);
+		delayMemory = NULL;
+	}
+	
+	if (oversampleBuffer) {
+		IOFreeContiguous(oversampleBuffer, card->Specific.BufferSize * CLIP_OVERSAMPLE_MAX);
+		oversampleBuffer = NULL;
+	}
+	if (decimatedBuffer) {
+		IOFree(decimatedBuffer, card->Specific.BufferSizeRec);
+		decimatedBuffer = NULL;
+	}
     
     super::free();
 }
@@ -256,7 +387,8 @@ IOAudioStream *Envy24HTAudioEngine::createNewAudioStream(IOAudioStreamDirection
     audioStream = new IOAudioStream;
 
 	if (audioStream) {
-        if (!audioStream->initWithAudioEngine(this, direction, 1)) {
+        // The input streams number their channels one after the other, from channel
+        if (!audioStream->initWithAudioEngine(this, direction, (direction == kIOAudioStreamDirectionInput) ? channel : 1)) {
 		    IOLog("initWithAudioEngine failed\n");
 			IOSleep(3000);
             audioStream->release();
@@ -286,6 +418,26 @@ IOAudioStream *Envy24HTAudioEngine::createNewAudioStream(IOAudioStreamDirection
 				rate.whole = Frequencies[i];
 				audioStream->addAvailableFormat(&format, &rate, &rate, NULL, 0);
 			}
+			
+			// The output also takes samples as they are, 32 bit or 24 bit in the top of 32, for
+			// players that want them bit-perfect. Those formats aren't mixable, the client writes
+			// the DMA buffer itself and the clip pass only mirrors the S/PDIF pair.
+			if (direction == kIOAudioStreamDirectionOutput)
+			{
+				IOAudioStreamFormat integerFormat = format;
+				
+				integerFormat.fByteOrder = NATIVE_BYTE_ORDER;
+				integerFormat.fIsMixable = false;
+				for (UInt32 bitDepth = 24; bitDepth <= 32; bitDepth += 8)
+				{
+					integerFormat.fBitDepth = bitDepth;
+					for (int i = 0; i < FREQUENCIES; i++)
+					{
+						rate.whole = Frequencies[i];
+						audioStream->addAvailableFormat(&integerFormat, &rate, &rate, NULL, 0);
+					}
+				}
+			}
 
 						
 			// Finally, the IOAudioStream's current format needs to be indicated
@@ -321,6 +473,19 @@ void Envy24HTAudioEngine::stop(IOService *provider)
         interruptEventSource = NULL;
     }
     
+    if (pollTimer) {
+        IOWorkLoop *wl;
+        
+        pollTimer->cancelTimeout();
+        wl = getWorkLoop();
+        if (wl) {
+            wl->removeEventSource(pollTimer);
+        }
+        
+        pollTimer->release();
+        pollTimer = NULL;
+    }
+    
     // Add code to shut down hardware (beyond what is needed to simply stop the audio engine)
     // There may be nothing needed here
 
@@ -338,10 +503,15 @@ IOReturn Envy24HTAudioEngine::performAudioEngineStart()
 			   MT_RDMA0 | MT_RDMA1); // clear possibly pending interrupts
 
 
-	// Play
+	// Play, from the oversampled buffer if the hardware runs faster than the clients
 	memset(outputBufferSPDIF, 0, card->Specific.BufferSizeRec);
 	clearAllSampleBuffers();
-    UInt32 BufferSize32 = (card->Specific.BufferSize / 4) - 1;
+	if (hardwareRatio > 1)
+	{
+		memset(oversampleBuffer, 0, card->Specific.BufferSize * hardwareRatio);
+	}
+	card->pci_dev->ioWrite32(MT_DMAI_PB_ADDRESS, (hardwareRatio > 1) ? physicalAddressOversample : physicalAddressOutput, card->mtbase);
+    UInt32 BufferSize32 = (card->Specific.BufferSize * hardwareRatio / 4) - 1;
 	UInt16 BufferSize16 = BufferSize32 & 0xFFFF;
 	UInt8 BufferSize8 = BufferSize32 >> 16;
 	
@@ -381,6 +551,17 @@ IOReturn Envy24HTAudioEngine::performAudioEngineStart()
     // to be incremented.  To accomplish that, false is passed to takeTimeStamp(). 
     takeTimeStamp(false);
 	
+	// Nothing has been clipped ahead of the first frame yet, nor erased behind it, and the loop count
+	// the input is counted by starts over
+	clipEnd = 0;
+	eraseEnd = 0;
+	inputEnd = 0;
+	decimatedEnd = 0;
+	if (pollTimer)
+	{
+		pollTimer->setTimeoutMS(PROPERTY_POLL_MS);
+	}
+	
     // Add audio - I/O start code here
 	WriteMask8(card->pci_dev, card->mtbase, MT_DMA_CONTROL, start);
 
@@ -401,6 +582,16 @@ IOReturn Envy24HTAudioEngine::performAudioEngineStop()
     WriteMask8(card->pci_dev, card->mtbase, MT_INTR_MASK, RMASK);
 	//interruptEventSource->disable();
 	
+	// Nothing gets converted any more, so the meters would hang at the last levels. The poll
+	// publishes them once more.
+	ResetClipMeters(&clipState.meter);
+	ResetClipMeters(&inputMeter);
+	inputEnd = 0;
+	if (pollTimer)
+	{
+		pollTimer->setTimeoutUS(1);
+	}
+	
     return kIOReturnSuccess;
 }
     
@@ -415,155 +606,1327 @@ UInt32 Envy24HTAudioEngine::getCurrentSampleFrame()
     // erased.
 
     // Change to return the real value
-	const UInt32 div = card->Specific.NumChannels * (32 / 8);
+	// The oversampled buffer has hardwareRatio frames for every one of the clients'
+	const UInt32 div = card->Specific.NumChannels * (32 / 8) * hardwareRatio;
 	UInt32 current_address = card->pci_dev->ioRead32(MT_DMAI_PB_ADDRESS, card->mtbase);
-	UInt32 diff = (current_address - ((UInt32) physicalAddressOutput)) / div;
+	UInt32 diff = (current_address - ((UInt32) ((hardwareRatio > 1) ? physicalAddressOversample : physicalAddressOutput))) / div;
 
 	return diff;
 }
     
-IOReturn Envy24HTAudioEngine::performFormatChange(IOAudioStream *audioStream, const IOAudioStreamFormat *newFormat, const IOAudioSampleRate *newSampleRate)
+// The frame firstSampleFrame of a read of the input, counted from the start of the engine by its loop
+// count. The frames have been recorded already, so a read that ends past the head is from the loop
+// before. The loop count is one short while the DMA engine has come around but the interrupt isn't
+// handled yet: the interrupt is still pending then. The record head runs with the play head.
+UInt64 Envy24HTAudioEngine::getRecordedFrame(UInt32 firstSampleFrame, UInt32 numSampleFrames)
 {
-    DBGPRINT("Envy24HTAudioEngine[%p]::peformFormatChange(%p, %p, %p)\n", this, audioStream, newFormat, newSampleRate);
-    
-	if (newSampleRate)
+	const IOAudioEngineStatus *engineStatus = getStatus();
+	UInt64 numBufferFrames = getNumSampleFramesPerBuffer();
+	UInt32 loopCount;
+	UInt32 head;
+	UInt8 pending;
+	UInt64 frame;
+	
+	// Again if the interrupt came or got handled in between
+	do
 	{
-		currentSampleRate = newSampleRate->whole;
-	}
-	else
+		loopCount = engineStatus->fCurrentLoopCount;
+		pending = card->pci_dev->ioRead8(MT_INTR_STATUS, card->mtbase) & MT_PDMA0;
+		head = getCurrentSampleFrame();
+	} while (pending != (card->pci_dev->ioRead8(MT_INTR_STATUS, card->mtbase) & MT_PDMA0) ||
+			 loopCount != engineStatus->fCurrentLoopCount);
+	
+	frame = (loopCount + (pending ? 1 : 0)) * numBufferFrames + firstSampleFrame;
+	if (firstSampleFrame + numSampleFrames > head && frame >= numBufferFrames)
 	{
-		currentSampleRate = 44100;
+		frame -= numBufferFrames;
 	}
 	
-	UInt32 FreqBits = lookUpFrequencyBits(currentSampleRate, Frequencies, FrequencyBits, FREQUENCIES, 0x08);
-	card->pci_dev->ioWrite8(MT_SAMPLERATE, FreqBits, card->mtbase);
-	//IOLog("Freq = %x\n", (unsigned int) FreqBits);
+	return frame;
+}
 
-	UInt32 SPDIFBits = lookUpFrequencyBits(currentSampleRate, SPDIF_Frequencies, SPDIF_FrequencyBits, SPDIF_FREQUENCIES, 1000);
-	ClearMask8(card->pci_dev, card->iobase, CCS_SPDIF_CONFIG, CCS_SPDIF_INTEGRATED);
-	if (SPDIFBits != 1000)
+// Picks the clip and erase kernels and the output stage for the given channel count and the current
+// dither and stage modes. The CPU only reads the DMA buffers back once they're played (for the
+// loopback stream), long out of the cache by then, so the clip kernel writes them with streaming
+// stores.
+bool Envy24HTAudioEngine::selectClipKernels(UInt32 numChannels)
+{
+	ClipKernelFunc newClipKernel = GetClipKernel(clipKernelType, numChannels, true, ditherMode);
+	EraseKernelFunc newEraseKernel = GetEraseKernel(numChannels);
+	MirrorKernelFunc newMirrorKernel = GetMirrorKernel(numChannels);
+	
+	if (!newClipKernel || !newEraseKernel || !newMirrorKernel)
 	{
-		card->pci_dev->ioWrite16(MT_SPDIF_TRANSMIT, 0x04 | 1 << 5 | (SPDIFBits << 12), card->mtbase);
-		WriteMask8(card->pci_dev, card->iobase, CCS_SPDIF_CONFIG, CCS_SPDIF_INTEGRATED);
-		//IOLog("Enabled SPDIF %u\n", (unsigned int) SPDIFBits);
+		return false;
 	}
-	card->SPDIF_RateSupported = (SPDIFBits != 1000);
 	
-	//IOLog("Rate sup = %d\n", card->SPDIF_RateSupported);
+	// NULL for the hard clip, clipOutputSamples() then runs the clip kernel straight on the mix
+	outputStage = GetClipStage(clipKernelType, numChannels, stageMode);
+	outputRoute = GetClipRoute(clipKernelType, numChannels);
+	outputBass = GetClipBass(clipKernelType, numChannels);
+	outputEq = GetClipEq(clipKernelType, numChannels);
+	outputConv = GetClipConv(clipKernelType, numChannels);
+	outputDelay = GetClipDelay(clipKernelType, numChannels);
+	outputUpsample = GetClipUpsample(clipKernelType, numChannels);
+	phaseKernel = GetPhaseKernel(numChannels);
+	spdifKernel = GetSpdifKernel(clipKernelType, numChannels);
+	clipKernel = newClipKernel;
+	eraseKernel = newEraseKernel;
+	mirrorKernel = newMirrorKernel;
+	outputChannels = numChannels;
 	
-    return kIOReturnSuccess;
+	// Whatever is in the DMA buffer now isn't known to be zero any more
+	silentFrames = 0;
+	
+	return true;
 }
 
-
-void Envy24HTAudioEngine::interruptHandler(OSObject * owner, IOInterruptEventSource* source, int /*count*/)
+IOReturn Envy24HTAudioEngine::ditherChangeHandler(IOService *target, IOAudioControl *ditherControl, SInt32 oldValue, SInt32 newValue)
 {
-	//Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+    IOReturn result = kIOReturnBadArgument;
+    Envy24HTAudioEngine *audioEngine;
+    
+    audioEngine = (Envy24HTAudioEngine *)target;
+    if (audioEngine) {
+        result = audioEngine->ditherChanged(ditherControl, oldValue, newValue);
+    }
+    
+    return result;
+}
 
-    // We've cast the audio engine from the owner which we passed in when we created the interrupt
-    // event source
-    //if (audioEngine) {
-		//IOLog("RecC = %lu\n", audioEngine->recCounter);
-	//}
-    // Since our interrupt filter always returns false, this function will never be called
-    // If the filter returned true, this function would be called on the IOWorkLoop
+IOReturn Envy24HTAudioEngine::ditherChanged(IOAudioControl *ditherControl, SInt32 oldValue, SInt32 newValue)
+{
+    DBGPRINT("Envy24HTAudioEngine[%p]::ditherChanged(%p, %ld, %ld)\n", this, ditherControl, (long) oldValue, (long) newValue);
+    
+	if (newValue < kClipDitherNone || newValue > kClipDitherShaped)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	// The clip pass switches the kernels over, the error state is its own
+	ditherMode = (ClipDitherMode) newValue;
+	ditherRequest++;
+	
+	return kIOReturnSuccess;
 }
 
-bool Envy24HTAudioEngine::interruptFilter(OSObject *owner, IOFilterInterruptEventSource *source)
+// Picks the kernels again on the clip pass for what the controls asked for since the last buffer.
+// It owns the kernel pointers and the state they run on, so the controls only leave requests.
+void Envy24HTAudioEngine::applyKernelRequests()
 {
-    Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+	UInt32 dither = ditherRequest;
+	UInt32 stage = stageRequest;
+	
+	if (dither == ditherApplied && stage == stageApplied)
+	{
+		return;
+	}
+	
+	// Start the noise shaper from scratch, the old errors belong to another mode
+	if (dither != ditherApplied)
+	{
+		ditherApplied = dither;
+		for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+		{
+			clipState.error[i] = 0;
+		}
+	}
+	
+	// The limiter starts with an empty delay line
+	if (stage != stageApplied)
+	{
+		stageApplied = stage;
+		ResetClipStage(&clipState);
+	}
+	selectClipKernels(outputChannels);
+}
 
-    // We've cast the audio engine from the owner which we passed in when we created the interrupt
-    // event source
+IOReturn Envy24HTAudioEngine::softwareVolumeChangeHandler(IOService *target, IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue)
+{
+    IOReturn result = kIOReturnBadArgument;
+    Envy24HTAudioEngine *audioEngine;
+    
+    audioEngine = (Envy24HTAudioEngine *)target;
     if (audioEngine) {
-        // Then, filterInterrupt() is called on the specified audio engine
-		audioEngine->filterInterrupt(source->getIntIndex());
+        result = audioEngine->softwareVolumeChanged(volumeControl, oldValue, newValue);
     }
     
-    return false;
+    return result;
 }
 
-void Envy24HTAudioEngine::filterInterrupt(int index)
+// Boards without hardware attenuators get one level control per channel, with the channel number
+// as control ID. The clip kernel ramps to the new gain.
+IOReturn Envy24HTAudioEngine::softwareVolumeChanged(IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue)
 {
-    // In the case of our simple device, we only get interrupts when the audio engine loops to the
-    // beginning of the buffer.  When that happens, we need to take a timestamp and increment
-    // the loop count.  The function takeTimeStamp() does both of those for us.  Additionally,
-    // if a different timestamp is to be used (other than the current time), it can be passed
-    // in to takeTimeStamp()
-
-	UInt8 intreq;
-	
-	if ( ( intreq = card->pci_dev->ioRead8(CCS_INTR_STATUS, card->iobase) ) != 0 )
+    //DBGPRINT("Envy24HTAudioEngine[%p]::softwareVolumeChanged(%p, %ld, %ld)\n", this, volumeControl, (long) oldValue, (long) newValue);
+    
+	if (volumeControl->getControlID() >= CLIP_KERNEL_MAX_CHANNELS || newValue < 0 || newValue > CLIP_GAIN_MAX)
 	{
-	    card->pci_dev->ioWrite8(CCS_INTR_STATUS, intreq, card->iobase); // clear it
-		
-	    if (intreq & CCS_INTR_PLAYREC)
-        {
-		   unsigned char mtstatus = card->pci_dev->ioRead8(MT_INTR_STATUS, card->mtbase);
-		   	   
-		   if(mtstatus & MT_DMA_FIFO)
-           {
-		       unsigned char status = card->pci_dev->ioRead8(MT_DMA_UNDERRUN, card->mtbase);
-            
-			   WriteMask8(card->pci_dev, card->mtbase, MT_INTR_STATUS, MT_DMA_FIFO); // clear it
-            
-               card->pci_dev->ioWrite8(MT_DMA_UNDERRUN, status, card->mtbase);
-               WriteMask8(card->pci_dev, card->mtbase, MT_INTR_MASK, MT_DMA_FIFO);
-           }
-		
-		   card->pci_dev->ioWrite8(MT_INTR_STATUS, mtstatus, card->mtbase); // clear interrupt
-		   
-		   if(mtstatus & MT_PDMA0)
-           {
-	           takeTimeStamp();
-		   }
-        }
+		return kIOReturnBadArgument;
+	}
+	
+	SetClipGain(&clipState, volumeControl->getControlID(), newValue);
+	
+	return kIOReturnSuccess;
+}
+
+IOReturn Envy24HTAudioEngine::rampChangeHandler(IOService *target, IOAudioControl *rampControl, SInt32 oldValue, SInt32 newValue)
+{
+    IOReturn result = kIOReturnBadArgument;
+    Envy24HTAudioEngine *audioEngine;
+    
+    audioEngine = (Envy24HTAudioEngine *)target;
+    if (audioEngine) {
+        result = audioEngine->rampChanged(rampControl, oldValue, newValue);
     }
-			   
-	return;
+    
+    return result;
 }
 
+// The clip pass ramps the software volume with the selected shape. The hardware controls can only
+// walk through the codec's steps, which are dB steps, so for them it's just on or off.
+IOReturn Envy24HTAudioEngine::rampChanged(IOAudioControl *rampControl, SInt32 oldValue, SInt32 newValue)
+{
+    DBGPRINT("Envy24HTAudioEngine[%p]::rampChanged(%p, %ld, %ld)\n", this, rampControl, (long) oldValue, (long) newValue);
+    
+	if (newValue < kClipRampOff || newValue > kClipRampExponential)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	rampShape = (ClipRampShape) newValue;
+	applyRamp();
+	((Envy24HTAudioDevice *) audioDevice)->rampVolume = (newValue != kClipRampOff);
+	
+	return kIOReturnSuccess;
+}
 
-UInt32 Envy24HTAudioEngine::lookUpFrequencyBits(UInt32 Frequency,
-												const UInt32* FreqList,
-												const UInt32* FreqBitList,
-												UInt32 ListSize,
-												UInt32 Default)
+// The clip pass ramps at the hardware rate, so the ramps are VOLUME_RAMP_MS long at any rate and ratio
+void Envy24HTAudioEngine::applyRamp()
 {
-	UInt32 FreqBit = Default;
+	SetClipRamp(&clipState, currentSampleRate * hardwareRatio * VOLUME_RAMP_MS / 1000, rampShape);
+}
 
-	for (UInt32 i = 0; i < ListSize; i++)
+IOReturn Envy24HTAudioEngine::stageChangeHandler(IOService *target, IOAudioControl *stageControl, SInt32 oldValue, SInt32 newValue)
+{
+    IOReturn result = kIOReturnBadArgument;
+    Envy24HTAudioEngine *audioEngine;
+    
+    audioEngine = (Envy24HTAudioEngine *)target;
+    if (audioEngine) {
+        result = audioEngine->stageChanged(stageControl, oldValue, newValue);
+    }
+    
+    return result;
+}
+
+IOReturn Envy24HTAudioEngine::stageChanged(IOAudioControl *stageControl, SInt32 oldValue, SInt32 newValue)
+{
+    DBGPRINT("Envy24HTAudioEngine[%p]::stageChanged(%p, %ld, %ld)\n", this, stageControl, (long) oldValue, (long) newValue);
+    
+	if (newValue < kClipStageHard || newValue > kClipStageLimiter)
 	{
-		if (FreqList[i] == Frequency)
-		{
-			return FreqBitList[i];
-		}
+		return kIOReturnBadArgument;
+	}
+	
+	// The integer kernels only hard clip
+	if (newValue != kClipStageHard && clipKernelType == kClipKernelInteger)
+	{
+		return kIOReturnUnsupported;
 	}
+	
+	// The limiter's lookahead delays the output, the clip pass switches the stage over
+	stageMode = (ClipStageMode) newValue;
+	stageRequest++;
+	updateOutputLatency();
+	
+	return kIOReturnSuccess;
+}
 
-	return FreqBit;
+// The limiter's lookahead, the convolution's partition and the oversampling filter delay the output
+void Envy24HTAudioEngine::updateOutputLatency()
+{
+	setOutputSampleLatency((stageMode == kClipStageLimiter ? CLIP_LIMITER_LOOKAHEAD : 0) + (convolving ? CLIP_CONV_PARTITION : 0) +
+						   (hardwareRatio > 1 ? oversampling.taps / 2 : 0));
 }
 
+IOReturn Envy24HTAudioEngine::setProperties(OSObject *properties)
+{
+	OSDictionary *dict = OSDynamicCast(OSDictionary, properties);
+	
+	if (!dict)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (!dict->getObject(OUTPUT_ROUTING_KEY) && !dict->getObject(SPDIF_DOWNMIX_KEY) && !dict->getObject(BASS_MANAGEMENT_KEY) &&
+		!dict->getObject(OUTPUT_EQ_KEY) && !dict->getObject(OUTPUT_CONVOLUTION_KEY) && !dict->getObject(OUTPUT_DELAY_KEY) &&
+		!dict->getObject(OVERSAMPLING_KEY) && !dict->getObject(SILENCE_MUTE_KEY))
+	{
+		return super::setProperties(properties);
+	}
+	
+	// On the work loop, like the control handlers, so only one of them hands tables to the clip
+	// pass at a time
+	return getCommandGate()->runAction(setPropertiesAction, dict);
+}
 
-IOReturn Envy24HTAudioEngine::eraseOutputSamples(
-									const void *mixBuf,
-									void *sampleBuf,
-									UInt32 firstSampleFrame,
-									UInt32 numSampleFrames,
-									const IOAudioStreamFormat *streamFormat,
-									IOAudioStream *audioStream)
+IOReturn Envy24HTAudioEngine::setPropertiesAction(OSObject *owner, void *arg1, void *arg2, void *arg3, void *arg4)
 {
-	IOAudioEngine::eraseOutputSamples(mixBuf, sampleBuf, firstSampleFrame, numSampleFrames, streamFormat, audioStream);
+	Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+	OSDictionary *dict = (OSDictionary *) arg1;
+	IOReturn result = kIOReturnSuccess;
+	OSArray *routing, *downmix, *eq, *filters, *delays;
+	OSDictionary *bass, *oversample;
+	OSNumber *silenceMute;
 	
-	UInt32 skip = (streamFormat->fNumChannels - 2) + 1;
-	UInt32 spdifIndex = firstSampleFrame * 2;
-    UInt32 maxSampleIndex = (firstSampleFrame + numSampleFrames) * streamFormat->fNumChannels;
-    
-	for (UInt32 sampleIndex = (firstSampleFrame * streamFormat->fNumChannels); sampleIndex < maxSampleIndex; sampleIndex+=skip)
+	if (!audioEngine || !dict)
 	{
-        outputBufferSPDIF[spdifIndex++] = 0; sampleIndex++;
-		outputBufferSPDIF[spdifIndex++] = 0;
-    }
-    
-	return kIOReturnSuccess;
+		return kIOReturnBadArgument;
+	}
+	
+	routing = OSDynamicCast(OSArray, dict->getObject(OUTPUT_ROUTING_KEY));
+	downmix = OSDynamicCast(OSArray, dict->getObject(SPDIF_DOWNMIX_KEY));
+	bass = OSDynamicCast(OSDictionary, dict->getObject(BASS_MANAGEMENT_KEY));
+	eq = OSDynamicCast(OSArray, dict->getObject(OUTPUT_EQ_KEY));
+	filters = OSDynamicCast(OSArray, dict->getObject(OUTPUT_CONVOLUTION_KEY));
+	delays = OSDynamicCast(OSArray, dict->getObject(OUTPUT_DELAY_KEY));
+	oversample = OSDynamicCast(OSDictionary, dict->getObject(OVERSAMPLING_KEY));
+	silenceMute = OSDynamicCast(OSNumber, dict->getObject(SILENCE_MUTE_KEY));
+	if ((dict->getObject(OUTPUT_ROUTING_KEY) && !routing) || (dict->getObject(SPDIF_DOWNMIX_KEY) && !downmix) ||
+		(dict->getObject(BASS_MANAGEMENT_KEY) && !bass) || (dict->getObject(OUTPUT_EQ_KEY) && !eq) ||
+		(dict->getObject(OUTPUT_CONVOLUTION_KEY) && !filters) || (dict->getObject(OUTPUT_DELAY_KEY) && !delays) ||
+		(dict->getObject(OVERSAMPLING_KEY) && !oversample) || (dict->getObject(SILENCE_MUTE_KEY) && !silenceMute))
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (routing)
+	{
+		result = audioEngine->routingChanged(routing);
+	}
+	if (downmix && result == kIOReturnSuccess)
+	{
+		result = audioEngine->downmixChanged(downmix);
+	}
+	if (bass && result == kIOReturnSuccess)
+	{
+		result = audioEngine->bassChanged(bass);
+	}
+	if (eq && result == kIOReturnSuccess)
+	{
+		result = audioEngine->eqChanged(eq);
+	}
+	if (filters && result == kIOReturnSuccess)
+	{
+		result = audioEngine->convolutionChanged(filters);
+	}
+	if (delays && result == kIOReturnSuccess)
+	{
+		result = audioEngine->delayChanged(delays);
+	}
+	if (oversample && result == kIOReturnSuccess)
+	{
+		result = audioEngine->oversamplingChanged(oversample);
+	}
+	if (silenceMute && result == kIOReturnSuccess)
+	{
+		result = audioEngine->silenceMuteChanged(silenceMute);
+	}
+	
+	return result;
+}
+
+// Reads a row of 16.16 fixed point gains, one per channel, the ones missing at the end are 0
+static bool ParseRouteGains(OSArray *gains, SInt32 *row, UInt32 numChannels)
+{
+	if (gains->getCount() > numChannels)
+	{
+		return false;
+	}
+	
+	for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+	{
+		OSNumber *gain = OSDynamicCast(OSNumber, gains->getObject(channel));
+		
+		if (channel < gains->getCount() && !gain)
+		{
+			return false;
+		}
+		row[channel] = gain ? (SInt32) gain->unsigned32BitValue() : 0;
+	}
+	
+	return true;
+}
+
+// Builds the routing from the OUTPUT_ROUTING_KEY array, the clip pass switches to it with the next
+// buffer. Without the FPU the integer kernels can only do permutations.
+IOReturn Envy24HTAudioEngine::routingChanged(OSArray *routing)
+{
+	struct ClipRoute route;
+	UInt32 numSlots = routing->getCount();
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::routingChanged(%p)\n", this, routing);
+	
+	if (numSlots > outputChannels)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+	{
+		for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+		{
+			route.gain[slot][channel] = (slot == channel) ? CLIP_ROUTE_UNITY : 0;
+		}
+	}
+	
+	for (UInt32 slot = 0; slot < numSlots; slot++)
+	{
+		OSNumber *source = OSDynamicCast(OSNumber, routing->getObject(slot));
+		OSArray *gains = OSDynamicCast(OSArray, routing->getObject(slot));
+		
+		if (source)
+		{
+			if (source->unsigned32BitValue() >= outputChannels)
+			{
+				return kIOReturnBadArgument;
+			}
+			for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+			{
+				route.gain[slot][channel] = (channel == source->unsigned32BitValue()) ? CLIP_ROUTE_UNITY : 0;
+			}
+		}
+		else if (!gains || !ParseRouteGains(gains, route.gain[slot], outputChannels))
+		{
+			return kIOReturnBadArgument;
+		}
+	}
+	
+	if (clipKernelType == kClipKernelInteger && ClassifyClipRoute(&route, outputChannels) == kClipRouteMatrix)
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	SetClipRoute(&clipState, &route, outputChannels);
+	setProperty(OUTPUT_ROUTING_KEY, routing);
+	DBGPRINT("Envy24HTAudioEngine output routing: %s\n", ClipRouteName(ClassifyClipRoute(&route, outputChannels)));
+	
+	return kIOReturnSuccess;
+}
+
+// Takes new downmix coefficients from the SPDIF_DOWNMIX_KEY array
+IOReturn Envy24HTAudioEngine::downmixChanged(OSArray *downmix)
+{
+	struct ClipRoute newDownmix = spdifDownmix;
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::downmixChanged(%p)\n", this, downmix);
+	
+	if (downmix->getCount() != 2)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	for (UInt32 side = 0; side < 2; side++)
+	{
+		OSArray *gains = OSDynamicCast(OSArray, downmix->getObject(side));
+		
+		if (!gains || !ParseRouteGains(gains, newDownmix.gain[side], outputChannels))
+		{
+			return kIOReturnBadArgument;
+		}
+	}
+	
+	spdifDownmix = newDownmix;
+	setProperty(SPDIF_DOWNMIX_KEY, downmix);
+	if (spdifSource == SPDIF_SOURCE_DOWNMIX)
+	{
+		applySpdifSource();
+	}
+	
+	return kIOReturnSuccess;
+}
+
+// Takes new bass management from the BASS_MANAGEMENT_KEY dictionary. The clip pass works out the
+// filters and switches to them with the next buffer. The integer kernels have no bass management.
+IOReturn Envy24HTAudioEngine::bassChanged(OSDictionary *bass)
+{
+	struct ClipBass newBass = bassManagement;
+	OSNumber *crossover = OSDynamicCast(OSNumber, bass->getObject(BASS_CROSSOVER_KEY));
+	OSNumber *lfeSlot = OSDynamicCast(OSNumber, bass->getObject(BASS_LFE_SLOT_KEY));
+	OSArray *slots = OSDynamicCast(OSArray, bass->getObject(BASS_SLOTS_KEY));
+	OSDictionary *settings;
+	OSArray *managed;
+	OSNumber *number;
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::bassChanged(%p)\n", this, bass);
+	
+	if ((bass->getObject(BASS_CROSSOVER_KEY) && !crossover) || (bass->getObject(BASS_LFE_SLOT_KEY) && !lfeSlot) ||
+		(bass->getObject(BASS_SLOTS_KEY) && !slots))
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (crossover)
+	{
+		newBass.frequency = crossover->unsigned32BitValue();
+	}
+	if (lfeSlot)
+	{
+		newBass.lfeSlot = lfeSlot->unsigned32BitValue();
+	}
+	if (slots)
+	{
+		newBass.managed = 0;
+		for (UInt32 i = 0; i < slots->getCount(); i++)
+		{
+			OSNumber *slot = OSDynamicCast(OSNumber, slots->getObject(i));
+			
+			if (!slot || slot->unsigned32BitValue() >= outputChannels)
+			{
+				return kIOReturnBadArgument;
+			}
+			newBass.managed |= 1U << slot->unsigned32BitValue();
+		}
+	}
+	
+	// The LFE slot is never highpassed, SetClipBass() leaves it out
+	if (newBass.frequency && (newBass.frequency < BASS_CROSSOVER_MIN || newBass.frequency > BASS_CROSSOVER_MAX ||
+							  newBass.lfeSlot >= outputChannels))
+	{
+		return kIOReturnBadArgument;
+	}
+	if (newBass.frequency && !outputBass)
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	bassManagement = newBass;
+	applyBassManagement();
+	
+	settings = OSDictionary::withCapacity(3);
+	managed = OSArray::withCapacity(outputChannels);
+	if (settings && managed)
+	{
+		for (UInt32 slot = 0; slot < outputChannels; slot++)
+		{
+			number = ((newBass.managed & (1U << slot)) && slot != newBass.lfeSlot) ? OSNumber::withNumber(slot, 32) : NULL;
+			if (number)
+			{
+				managed->setObject(number);
+				number->release();
+			}
+		}
+		settings->setObject(BASS_SLOTS_KEY, managed);
+		number = OSNumber::withNumber(newBass.frequency, 32);
+		if (number)
+		{
+			settings->setObject(BASS_CROSSOVER_KEY, number);
+			number->release();
+		}
+		number = OSNumber::withNumber(newBass.lfeSlot, 32);
+		if (number)
+		{
+			settings->setObject(BASS_LFE_SLOT_KEY, number);
+			number->release();
+		}
+		setProperty(BASS_MANAGEMENT_KEY, settings);
+	}
+	if (settings)
+	{
+		settings->release();
+	}
+	if (managed)
+	{
+		managed->release();
+	}
+	
+	return kIOReturnSuccess;
+}
+
+// The filters depend on the sample rate, performFormatChange() hands them over again
+void Envy24HTAudioEngine::applyBassManagement()
+{
+	SetClipBass(&clipState, &bassManagement, outputChannels);
+}
+
+// Takes a new EQ from the OUTPUT_EQ_KEY array, the clip pass switches to it with the next buffer.
+// The integer kernels have no EQ.
+IOReturn Envy24HTAudioEngine::eqChanged(OSArray *eq)
+{
+	struct ClipEq *newEq;
+	UInt32 numSlots = eq->getCount();
+	IOReturn result = kIOReturnSuccess;
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::eqChanged(%p)\n", this, eq);
+	
+	if (numSlots > outputChannels)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	// Too big for the kernel stack
+	newEq = (struct ClipEq *) IOMalloc(sizeof(struct ClipEq));
+	if (!newEq)
+	{
+		return kIOReturnNoMemory;
+	}
+	
+	for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+	{
+		OSArray *sections = (slot < numSlots) ? OSDynamicCast(OSArray, eq->getObject(slot)) : NULL;
+		
+		if ((slot < numSlots && !sections) || (sections && sections->getCount() > CLIP_EQ_SECTIONS))
+		{
+			result = kIOReturnBadArgument;
+			goto Done;
+		}
+		if (sections && sections->getCount() && clipKernelType == kClipKernelInteger)
+		{
+			result = kIOReturnUnsupported;
+			goto Done;
+		}
+		
+		for (UInt32 section = 0; section < CLIP_EQ_SECTIONS; section++)
+		{
+			OSArray *coefs = (sections && section < sections->getCount()) ? OSDynamicCast(OSArray, sections->getObject(section)) : NULL;
+			
+			if ((sections && section < sections->getCount() && !coefs) || (coefs && coefs->getCount() != 5))
+			{
+				result = kIOReturnBadArgument;
+				goto Done;
+			}
+			
+			for (UInt32 k = 0; k < 5; k++)
+			{
+				OSNumber *coef = coefs ? OSDynamicCast(OSNumber, coefs->getObject(k)) : NULL;
+				
+				if (coefs && !coef)
+				{
+					result = kIOReturnBadArgument;
+					goto Done;
+				}
+				newEq->coef[slot][section][k] = coef ? (SInt32) coef->unsigned32BitValue() : ((k == 0) ? CLIP_EQ_UNITY : 0);
+			}
+		}
+	}
+	
+	SetClipEq(&clipState, newEq, outputChannels);
+	setProperty(OUTPUT_EQ_KEY, eq);
+	
+Done:
+	IOFree(newEq, sizeof(struct ClipEq));
+	
+	return result;
+}
+
+// Hands the filters from the OUTPUT_CONVOLUTION_KEY array to the convolution, which is set up with
+// the first of them. The clip pass transforms them and then switches over. The integer kernels
+// have no convolution.
+IOReturn Envy24HTAudioEngine::convolutionChanged(OSArray *filters)
+{
+	const float *taps[CLIP_KERNEL_MAX_CHANNELS];
+	UInt32 numTaps[CLIP_KERNEL_MAX_CHANNELS];
+	UInt32 numSlots = filters->getCount();
+	bool filtered = false;
+	OSArray *tapCounts;
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::convolutionChanged(%p)\n", this, filters);
+	
+	if (numSlots > outputChannels)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+	{
+		OSData *data = (slot < numSlots) ? OSDynamicCast(OSData, filters->getObject(slot)) : NULL;
+		
+		if (slot < numSlots && !data)
+		{
+			return kIOReturnBadArgument;
+		}
+		
+		taps[slot] = NULL;
+		numTaps[slot] = 0;
+		if (data && data->getLength())
+		{
+			if (data->getLength() % sizeof(float) || data->getLength() / sizeof(float) > CLIP_CONV_MAX_TAPS)
+			{
+				return kIOReturnBadArgument;
+			}
+			taps[slot] = (const float *) data->getBytesNoCopy();
+			numTaps[slot] = data->getLength() / sizeof(float);
+			filtered = true;
+		}
+	}
+	
+	if (filtered && !outputConv)
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	// The clip pass only ever sees the pointer go from NULL to the convolution, it's freed with the engine
+	if (filtered && !clipState.conv)
+	{
+		convSize = ClipConvSize(outputChannels);
+		convMemory = IOMallocAligned(convSize, 64);
+		if (!convMemory)
+		{
+			return kIOReturnNoMemory;
+		}
+		clipState.conv = InitClipConv(convMemory, outputChannels);
+		SetClipConvRate(clipState.conv, currentSampleRate);
+	}
+	if (clipState.conv)
+	{
+		SetClipConv(clipState.conv, taps, numTaps);
+	}
+	convolving = filtered;
+	updateOutputLatency();
+	
+	tapCounts = OSArray::withCapacity(outputChannels);
+	if (tapCounts)
+	{
+		for (UInt32 slot = 0; slot < outputChannels; slot++)
+		{
+			OSNumber *count = OSNumber::withNumber(numTaps[slot], 32);
+			
+			if (count)
+			{
+				tapCounts->setObject(count);
+				count->release();
+			}
+		}
+		setProperty(CONVOLUTION_TAPS_KEY, tapCounts);
+		tapCounts->release();
+	}
+	
+	return kIOReturnSuccess;
+}
+
+// Takes new delays from the OUTPUT_DELAY_KEY array, the clip pass switches to them with the next
+// buffer. They only move the sample bits, so the integer kernels have them too.
+IOReturn Envy24HTAudioEngine::delayChanged(OSArray *delays)
+{
+	struct ClipDelay newDelay;
+	UInt32 numSlots = delays->getCount();
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::delayChanged(%p)\n", this, delays);
+	
+	if (numSlots > outputChannels)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+	{
+		OSNumber *frames = (slot < numSlots) ? OSDynamicCast(OSNumber, delays->getObject(slot)) : NULL;
+		
+		if ((slot < numSlots && !frames) || (frames && frames->unsigned32BitValue() > CLIP_DELAY_MAX))
+		{
+			return kIOReturnBadArgument;
+		}
+		newDelay.frames[slot] = frames ? frames->unsigned32BitValue() : 0;
+	}
+	
+	if (!clipState.delayLines)
+	{
+		return kIOReturnNoMemory;
+	}
+	
+	SetClipDelay(&clipState, &newDelay, outputChannels);
+	setProperty(OUTPUT_DELAY_KEY, delays);
+	
+	return kIOReturnSuccess;
+}
+
+// Takes a new ratio, filter length or S/PDIF rate setting from the OVERSAMPLING_KEY dictionary,
+// keys that are left out keep their values. The DMA buffer and the rate can't change under the
+// running DMA engine, so it's paused for them. The integer kernels don't oversample.
+IOReturn Envy24HTAudioEngine::oversamplingChanged(OSDictionary *oversample)
+{
+	struct ClipOversample newOversampling = oversampling;
+	OSNumber *ratio = OSDynamicCast(OSNumber, oversample->getObject(OVERSAMPLING_RATIO_KEY));
+	OSNumber *taps = OSDynamicCast(OSNumber, oversample->getObject(OVERSAMPLING_TAPS_KEY));
+	OSBoolean *spdif = OSDynamicCast(OSBoolean, oversample->getObject(OVERSAMPLING_SPDIF_KEY));
+	bool newSpdifRate = spdif ? spdif->isTrue() : spdifRate;
+	bool running;
+	
+	DBGPRINT("Envy24HTAudioEngine[%p]::oversamplingChanged(%p)\n", this, oversample);
+	
+	if ((oversample->getObject(OVERSAMPLING_RATIO_KEY) && !ratio) || (oversample->getObject(OVERSAMPLING_TAPS_KEY) && !taps) ||
+		(oversample->getObject(OVERSAMPLING_SPDIF_KEY) && !spdif))
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (ratio)
+	{
+		newOversampling.ratio = ratio->unsigned32BitValue();
+	}
+	if (taps)
+	{
+		newOversampling.taps = taps->unsigned32BitValue();
+	}
+	if ((newOversampling.ratio != 1 && newOversampling.ratio != 2 && newOversampling.ratio != 4) ||
+		newOversampling.taps < 8 || newOversampling.taps > CLIP_OVERSAMPLE_TAPS || newOversampling.taps % 8)
+	{
+		return kIOReturnBadArgument;
+	}
+	if ((newOversampling.ratio > 1 || newSpdifRate) && (!outputUpsample || !inputDecimate))
+	{
+		return kIOReturnUnsupported;
+	}
+	if (newSpdifRate && !card->Specific.HasSPDIF)
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	// Room for the highest ratio, it stays with the engine once it's there
+	if ((newOversampling.ratio > 1 || newSpdifRate) && !oversampleBuffer)
+	{
+		oversampleBuffer = (SInt32 *)IOMallocContiguous(card->Specific.BufferSize * CLIP_OVERSAMPLE_MAX, 512, &physicalAddressOversample);
+		if (!oversampleBuffer)
+		{
+			return kIOReturnNoMemory;
+		}
+	}
+	if ((newOversampling.ratio > 1 || newSpdifRate) && !decimatedBuffer)
+	{
+		decimatedBuffer = (float *)IOMalloc(card->Specific.BufferSizeRec);
+		if (!decimatedBuffer)
+		{
+			return kIOReturnNoMemory;
+		}
+	}
+	
+	oversampling = newOversampling;
+	spdifRate = newSpdifRate;
+	running = (getState() == kIOAudioEngineRunning);
+	if (running)
+	{
+		pauseAudioEngine();
+	}
+	applyOversampling();
+	if (running)
+	{
+		resumeAudioEngine();
+	}
+	
+	return kIOReturnSuccess;
+}
+
+// Lowers the ratio until the hardware can run at it, then hands the filter to the clip pass and
+// the input conversion and sets the rate. For the S/PDIF rate, a ratio that leaves the S/PDIF
+// output without a rate it can carry is replaced with the lowest one that gets it there, if any.
+// Only while the DMA engine is stopped.
+void Envy24HTAudioEngine::applyOversampling()
+{
+	struct ClipOversample effective = oversampling;
+	
+	if (spdifRate &&
+		lookUpFrequencyBits(currentSampleRate * effective.ratio, SPDIF_Frequencies, SPDIF_FrequencyBits, SPDIF_FREQUENCIES, 1000) == 1000)
+	{
+		for (UInt32 ratio = 2; ratio <= CLIP_OVERSAMPLE_MAX; ratio *= 2)
+		{
+			if (lookUpFrequencyBits(currentSampleRate * ratio, SPDIF_Frequencies, SPDIF_FrequencyBits, SPDIF_FREQUENCIES, 1000) != 1000 &&
+				lookUpFrequencyBits(currentSampleRate * ratio, Frequencies, FrequencyBits, FREQUENCIES, 1000) != 1000)
+			{
+				effective.ratio = ratio;
+				break;
+			}
+		}
+	}
+	while (effective.ratio > 1 && (!outputMixable || !oversampleBuffer || !decimatedBuffer || !outputUpsample || !inputDecimate ||
+		   lookUpFrequencyBits(currentSampleRate * effective.ratio, Frequencies, FrequencyBits, FREQUENCIES, 1000) == 1000))
+	{
+		effective.ratio /= 2;
+	}
+	
+	hardwareRatio = effective.ratio;
+	SetClipOversample(&clipState, &effective);
+	applyRamp();
+	SetClipDecimator(&inputDecimator, &effective, getNumSampleFramesPerBuffer());
+	inputEnd = 0;
+	decimatedEnd = 0;
+	setHardwareRate(currentSampleRate * hardwareRatio);
+	updateOutputLatency();
+	setInputSampleLatency((hardwareRatio > 1) ? oversampling.taps / 2 : 0);
+	setOversamplingProperty();
+	DBGPRINT("Envy24HTAudioEngine oversampling %ux to %u Hz\n", (unsigned int) hardwareRatio, (unsigned int) (currentSampleRate * hardwareRatio));
+}
+
+void Envy24HTAudioEngine::setOversamplingProperty()
+{
+	static const char *keys[3] = { OVERSAMPLING_RATIO_KEY, OVERSAMPLING_TAPS_KEY, OVERSAMPLING_RATE_KEY };
+	UInt32 values[3] = { oversampling.ratio, oversampling.taps, currentSampleRate * hardwareRatio };
+	OSDictionary *settings = OSDictionary::withCapacity(4);
+	
+	if (!settings)
+	{
+		return;
+	}
+	
+	for (UInt32 i = 0; i < 3; i++)
+	{
+		OSNumber *number = OSNumber::withNumber(values[i], 32);
+		
+		if (number)
+		{
+			settings->setObject(keys[i], number);
+			number->release();
+		}
+	}
+	
+	settings->setObject(OVERSAMPLING_SPDIF_KEY, spdifRate ? kOSBooleanTrue : kOSBooleanFalse);
+	
+	setProperty(OVERSAMPLING_KEY, settings);
+	settings->release();
+}
+
+// Sets how long the output has to be silent before the codecs get muted, 0 turns it off
+IOReturn Envy24HTAudioEngine::silenceMuteChanged(OSNumber *milliseconds)
+{
+	DBGPRINT("Envy24HTAudioEngine[%p]::silenceMuteChanged(%u)\n", this, (unsigned int) milliseconds->unsigned32BitValue());
+	
+	// Up to an hour, which keeps the frame count within 32 bits at any rate
+	if (milliseconds->unsigned64BitValue() > 3600000)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	silenceMuteMS = milliseconds->unsigned32BitValue();
+	if (!silenceMuteMS)
+	{
+		((Envy24HTAudioDevice *) audioDevice)->requestSilenceMute(false);
+		if (pollTimer)
+		{
+			pollTimer->setTimeoutUS(1);
+		}
+	}
+	setProperty(SILENCE_MUTE_KEY, milliseconds);
+	
+	return kIOReturnSuccess;
+}
+
+// The clip pass and the input conversion just publish the numbers, they become properties here
+// on the work loop. The clip pass's silence mute request gets to the codecs the same way. Only
+// while the engine runs, after that once more to show the reset meters.
+void Envy24HTAudioEngine::pollTimerFired(OSObject *owner, IOTimerEventSource *sender)
+{
+	Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+	
+	if (!audioEngine) {
+		return;
+	}
+	
+	audioEngine->setLevelProperty(OUTPUT_LEVELS_KEY, &audioEngine->clipState.meter, audioEngine->outputChannels, true);
+	audioEngine->setLevelProperty(INPUT_LEVELS_KEY, &audioEngine->inputMeter, audioEngine->inputChannels, false);
+	audioEngine->setSilenceProperty();
+	((Envy24HTAudioDevice *) audioEngine->audioDevice)->updateSilenceMute();
+	
+	if (audioEngine->getState() == kIOAudioEngineRunning) {
+		sender->setTimeoutMS(PROPERTY_POLL_MS);
+	}
+}
+
+// An array with one of the meter values per channel
+static OSArray *CreateMeterArray(const SInt32 *values, const UInt64 *counts, UInt32 numChannels)
+{
+	OSArray *array = OSArray::withCapacity(numChannels);
+	
+	for (UInt32 channel = 0; array && channel < numChannels && channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+	{
+		OSNumber *number = values ? OSNumber::withNumber((UInt32) values[channel], 32) : OSNumber::withNumber(counts[channel], 64);
+		
+		if (number)
+		{
+			array->setObject(number);
+			number->release();
+		}
+	}
+	
+	return array;
+}
+
+static void SetMeterArray(OSDictionary *levels, const char *key, const SInt32 *values, const UInt64 *counts, UInt32 numChannels)
+{
+	OSArray *array = CreateMeterArray(values, counts, numChannels);
+	
+	if (array)
+	{
+		levels->setObject(key, array);
+		array->release();
+	}
+}
+
+// Keeps the last levels if the clip pass (or the input conversion) is busy with the meters
+void Envy24HTAudioEngine::setLevelProperty(const char *key, const struct ClipMeterState *meter, UInt32 numChannels, bool overshoot)
+{
+	struct ClipMeters meters;
+	OSDictionary *levels;
+	
+	if (!ReadClipMeters(meter, &meters))
+	{
+		return;
+	}
+	
+	levels = OSDictionary::withCapacity(5);
+	if (!levels)
+	{
+		return;
+	}
+	
+	SetMeterArray(levels, "Peak", meters.peak, NULL, numChannels);
+	SetMeterArray(levels, "RMS", meters.rms, NULL, numChannels);
+	SetMeterArray(levels, "Overs", NULL, meters.overs, numChannels);
+	SetMeterArray(levels, "LastOver", NULL, meters.lastOver, numChannels);
+	if (overshoot)
+	{
+		SetMeterArray(levels, "MaxOvershoot", meters.maxOvershoot, NULL, numChannels);
+	}
+	
+	setProperty(key, levels);
+	levels->release();
+}
+
+// The clip pass may be halfway through updating a counter on a 32 bit kernel, so it's read until
+// two reads agree
+static UInt64 ReadCounter(const volatile UInt64 *counter)
+{
+	UInt64 value;
+	
+	do
+	{
+		value = *counter;
+	} while (value != *counter);
+	
+	return value;
+}
+
+static void SetCounter(OSDictionary *dict, const char *key, UInt64 value)
+{
+	OSNumber *number = OSNumber::withNumber(value, 64);
+	
+	if (number)
+	{
+		dict->setObject(key, number);
+		number->release();
+	}
+}
+
+void Envy24HTAudioEngine::setSilenceProperty()
+{
+	OSDictionary *silence = OSDictionary::withCapacity(4);
+	
+	if (!silence)
+	{
+		return;
+	}
+	
+	SetCounter(silence, "ErasedFrames", ReadCounter(&erasedFrames));
+	SetCounter(silence, "SkippedFrames", ReadCounter(&skippedFrames));
+	SetCounter(silence, "SilentFrames", silentFrames);
+	silence->setObject("Muted", ((Envy24HTAudioDevice *) audioDevice)->silenceMuted ? kOSBooleanTrue : kOSBooleanFalse);
+	
+	setProperty(SILENCE_KEY, silence);
+	silence->release();
+}
+
+IOReturn Envy24HTAudioEngine::spdifChangeHandler(IOService *target, IOAudioControl *spdifControl, SInt32 oldValue, SInt32 newValue)
+{
+    IOReturn result = kIOReturnBadArgument;
+    Envy24HTAudioEngine *audioEngine;
+    
+    audioEngine = (Envy24HTAudioEngine *)target;
+    if (audioEngine) {
+        result = audioEngine->spdifChanged(spdifControl, oldValue, newValue);
+    }
+    
+    return result;
+}
+
+// The first pair is copied by the clip kernel, anything else is computed in the clip pass by the
+// S/PDIF kernel. The integer kernels can't do the downmix.
+IOReturn Envy24HTAudioEngine::spdifChanged(IOAudioControl *spdifControl, SInt32 oldValue, SInt32 newValue)
+{
+    DBGPRINT("Envy24HTAudioEngine[%p]::spdifChanged(%p, %ld, %ld)\n", this, spdifControl, (long) oldValue, (long) newValue);
+    
+	if (newValue < 0 || newValue > SPDIF_SOURCE_DOWNMIX)
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (newValue == SPDIF_SOURCE_DOWNMIX ? (outputChannels <= 2 || clipKernelType == kClipKernelInteger) : ((UInt32) newValue * 2 + 1 >= outputChannels))
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	spdifSource = newValue;
+	applySpdifSource();
+	
+	return kIOReturnSuccess;
+}
+
+void Envy24HTAudioEngine::applySpdifSource()
+{
+	struct ClipRoute route;
+	
+	if (spdifSource == SPDIF_SOURCE_DOWNMIX)
+	{
+		route = spdifDownmix;
+	}
+	else
+	{
+		for (UInt32 side = 0; side < 2; side++)
+		{
+			for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+			{
+				route.gain[side][slot] = (slot == spdifSource * 2 + side) ? CLIP_ROUTE_UNITY : 0;
+			}
+		}
+	}
+	
+	SetClipSpdif(&clipState, &route, outputChannels);
+}
+
+IOReturn Envy24HTAudioEngine::performFormatChange(IOAudioStream *audioStream, const IOAudioStreamFormat *newFormat, const IOAudioSampleRate *newSampleRate)
+{
+    DBGPRINT("Envy24HTAudioEngine[%p]::peformFormatChange(%p, %p, %p)\n", this, audioStream, newFormat, newSampleRate);
+    
+	// Cache the kernels for the new channel count so the clip and erase paths don't have to look at the format
+	if (audioStream && newFormat && audioStream->getDirection() == kIOAudioStreamDirectionOutput)
+	{
+		if (!selectClipKernels(newFormat->fNumChannels))
+		{
+			return kIOReturnUnsupported;
+		}
+		outputMixable = newFormat->fIsMixable;
+	}
+	
+	if (newSampleRate)
+	{
+		currentSampleRate = newSampleRate->whole;
+	}
+	else
+	{
+		currentSampleRate = 44100;
+	}
+	bassManagement.sampleRate = currentSampleRate;
+	applyBassManagement();
+	if (clipState.conv)
+	{
+		SetClipConvRate(clipState.conv, currentSampleRate);
+	}
+	
+	// Sets the hardware rate too, a multiple of the new one while oversampling
+	applyOversampling();
+	
+    return kIOReturnSuccess;
+}
+
+// The codecs and the S/PDIF output run at the same rate, if the S/PDIF output has it at all
+void Envy24HTAudioEngine::setHardwareRate(UInt32 rate)
+{
+	UInt32 FreqBits = lookUpFrequencyBits(rate, Frequencies, FrequencyBits, FREQUENCIES, 0x08);
+	card->pci_dev->ioWrite8(MT_SAMPLERATE, FreqBits, card->mtbase);
+	//IOLog("Freq = %x\n", (unsigned int) FreqBits);
+
+	UInt32 SPDIFBits = lookUpFrequencyBits(rate, SPDIF_Frequencies, SPDIF_FrequencyBits, SPDIF_FREQUENCIES, 1000);
+	ClearMask8(card->pci_dev, card->iobase, CCS_SPDIF_CONFIG, CCS_SPDIF_INTEGRATED);
+	if (SPDIFBits != 1000)
+	{
+		card->pci_dev->ioWrite16(MT_SPDIF_TRANSMIT, 0x04 | 1 << 5 | (SPDIFBits << 12), card->mtbase);
+		WriteMask8(card->pci_dev, card->iobase, CCS_SPDIF_CONFIG, CCS_SPDIF_INTEGRATED);
+		//IOLog("Enabled SPDIF %u\n", (unsigned int) SPDIFBits);
+	}
+	card->SPDIF_RateSupported = (SPDIFBits != 1000);
+	
+	//IOLog("Rate sup = %d\n", card->SPDIF_RateSupported);
+}
+
+
+void Envy24HTAudioEngine::interruptHandler(OSObject * owner, IOInterruptEventSource* source, int /*count*/)
+{
+	//Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+
+    // We've cast the audio engine from the owner which we passed in when we created the interrupt
+    // event source
+    //if (audioEngine) {
+		//IOLog("RecC = %lu\n", audioEngine->recCounter);
+	//}
+    // Since our interrupt filter always returns false, this function will never be called
+    // If the filter returned true, this function would be called on the IOWorkLoop
+}
+
+bool Envy24HTAudioEngine::interruptFilter(OSObject *owner, IOFilterInterruptEventSource *source)
+{
+    Envy24HTAudioEngine *audioEngine = OSDynamicCast(Envy24HTAudioEngine, owner);
+
+    // We've cast the audio engine from the owner which we passed in when we created the interrupt
+    // event source
+    if (audioEngine) {
+        // Then, filterInterrupt() is called on the specified audio engine
+		audioEngine->filterInterrupt(source->getIntIndex());
+    }
+    
+    return false;
+}
+
+void Envy24HTAudioEngine::filterInterrupt(int index)
+{
+    // In the case of our simple device, we only get interrupts when the audio engine loops to the
+    // beginning of the buffer.  When that happens, we need to take a timestamp and increment
+    // the loop count.  The function takeTimeStamp() does both of those for us.  Additionally,
+    // if a different timestamp is to be used (other than the current time), it can be passed
+    // in to takeTimeStamp()
+
+	UInt8 intreq;
+	
+	if ( ( intreq = card->pci_dev->ioRead8(CCS_INTR_STATUS, card->iobase) ) != 0 )
+	{
+	    card->pci_dev->ioWrite8(CCS_INTR_STATUS, intreq, card->iobase); // clear it
+		
+	    if (intreq & CCS_INTR_PLAYREC)
+        {
+		   unsigned char mtstatus = card->pci_dev->ioRead8(MT_INTR_STATUS, card->mtbase);
+		   	   
+		   if(mtstatus & MT_DMA_FIFO)
+           {
+		       unsigned char status = card->pci_dev->ioRead8(MT_DMA_UNDERRUN, card->mtbase);
+            
+			   WriteMask8(card->pci_dev, card->mtbase, MT_INTR_STATUS, MT_DMA_FIFO); // clear it
+            
+               card->pci_dev->ioWrite8(MT_DMA_UNDERRUN, status, card->mtbase);
+               WriteMask8(card->pci_dev, card->mtbase, MT_INTR_MASK, MT_DMA_FIFO);
+           }
+		
+		   card->pci_dev->ioWrite8(MT_INTR_STATUS, mtstatus, card->mtbase); // clear interrupt
+		   
+		   if(mtstatus & MT_PDMA0)
+           {
+	           takeTimeStamp();
+		   }
+        }
+    }
+			   
+	return;
+}
+
+
+UInt32 Envy24HTAudioEngine::lookUpFrequencyBits(UInt32 Frequency,
+												const UInt32* FreqList,
+												const UInt32* FreqBitList,
+												UInt32 ListSize,
+												UInt32 Default)
+{
+	UInt32 FreqBit = Default;
+
+	for (UInt32 i = 0; i < ListSize; i++)
+	{
+		if (FreqList[i] == Frequency)
+		{
+			return FreqBitList[i];
+		}
+	}
+
+	return FreqBit;
+}
+
+
+IOReturn Envy24HTAudioEngine::eraseOutputSamples(
+									const void *mixBuf,
+									void *sampleBuf,
+									UInt32 firstSampleFrame,
+									UInt32 numSampleFrames,
+									const IOAudioStreamFormat *streamFormat,
+									IOAudioStream *audioStream)
+{
+	UInt32 numBufferFrames = getNumSampleFramesPerBuffer();
+	UInt32 playHead = (firstSampleFrame + numSampleFrames) % numBufferFrames;
+	UInt32 end = clipEnd;
+	UInt32 ahead = (end + numBufferFrames - firstSampleFrame) % numBufferFrames;
+	UInt32 lead = 0;
+	
+	// The clip pass is ahead of the play head by what the clients wrote ahead of it. Once the play
+	// head has caught up with it (the clients have stopped, or fell behind), clipEnd is moved along
+	// with it, so it never trails the play head and the distance stays unambiguous. The clip pass
+	// may have moved it in the meantime, that value stands then.
+	if (ahead <= numSampleFrames)
+	{
+		OSCompareAndSwap(end, playHead, (UInt32 *)&clipEnd);
+	}
+	else
+	{
+		lead = ahead - numSampleFrames;
+	}
+	
+	// The mix buffer is cleared right away, the clients mix into it again a buffer later. The
+	// loopback stream reads the DMA buffer behind the play head though, so the DMA and the SPDIF
+	// buffer are cleared (in a single pass) half a buffer later, still half a buffer before the
+	// DMA engine comes around to them again. Frames the clip pass has already filled again for the
+	// next loop are left alone: when it leads by more than half a buffer, the erase falls back to
+	// where its writes start and catches up once they're played.
+	if (mixBuf)
+	{
+		memset(&((float *)mixBuf)[firstSampleFrame * outputChannels], 0, numSampleFrames * outputChannels * sizeof(float));
+	}
+	if (sampleBuf)
+	{
+		SInt32 *spdifBuf = (hardwareRatio > 1) ? NULL : outputBufferSPDIF;
+		UInt32 lag = numBufferFrames / 2;
+		UInt32 behind = (playHead + numBufferFrames - eraseEnd) % numBufferFrames;
+		
+		if (behind > numBufferFrames - lead)
+		{
+			behind = numBufferFrames - lead;
+		}
+		if (behind > lag)
+		{
+			UInt32 start = (playHead + numBufferFrames - behind) % numBufferFrames;
+			UInt32 total = behind - lag;
+			UInt32 count = (total < numBufferFrames - start) ? total : numBufferFrames - start;
+			
+			eraseKernel(NULL, (SInt32 *)sampleBuf, spdifBuf, start, count);
+			if (count < total)
+			{
+				eraseKernel(NULL, (SInt32 *)sampleBuf, spdifBuf, 0, total - count);
+			}
+			eraseEnd = (start + total) % numBufferFrames;
+		}
+	}
+	
+	// While oversampling the DMA engine plays another buffer, which nobody reads back, so it's
+	// cleared right away. The S/PDIF buffer only holds 1/ratio of a loop and the clip pass may have
+	// filled parts of it again already: those are left alone. The clip pass has no lead once the
+	// clients have stopped, the whole range is cleared then.
+	if (sampleBuf && hardwareRatio > 1)
+	{
+		lead *= hardwareRatio;
+		eraseHardwareFrames(firstSampleFrame, numSampleFrames, (lead < numBufferFrames) ? (numBufferFrames - lead) / hardwareRatio : 0,
+							hardwareRatio);
+	}
+    
+	return kIOReturnSuccess;
+}
+
+// Clears the oversampled DMA buffer for numSampleFrames frames of the stream, and the S/PDIF buffer
+// for the last spdifFrames of them. It goes by hardware frames there, split where it wraps, which
+// needn't be at a frame of the stream.
+void Envy24HTAudioEngine::eraseHardwareFrames(UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 spdifFrames, UInt32 ratio)
+{
+	UInt32 numBufferFrames = getNumSampleFramesPerBuffer();
+	UInt32 end = (firstSampleFrame + numSampleFrames) * ratio;
+	UInt32 count;
+	
+	eraseKernel(NULL, &oversampleBuffer[firstSampleFrame * ratio * outputChannels], NULL, 0, numSampleFrames * ratio);
+	
+	for (UInt32 frame = end - ((spdifFrames < numSampleFrames) ? spdifFrames : numSampleFrames) * ratio; frame < end; frame += count)
+	{
+		count = (end - frame < numBufferFrames - frame % numBufferFrames) ? end - frame : numBufferFrames - frame % numBufferFrames;
+		memset(&outputBufferSPDIF[frame % numBufferFrames * 2], 0, count * 2 * sizeof(SInt32));
+	}
 }
  
 
@@ -4,11 +4,122 @@
 #include <IOKit/audio/IOAudioEngine.h>
 
 #include "AudioDevice.h"
+#include "ClipKernels.h"
 
 #define Envy24HTAudioEngine com_Envy24HTAudioEngine
 
+// Driver defined controls, the volume controls from the ParmList (or the software volume controls
+// on boards without one) use the IDs from 0 up
+#define DITHER_CONTROL_ID		0x100
+#define DITHER_CONTROL_SUBTYPE	'dith'
+#define STAGE_CONTROL_ID		0x101
+#define STAGE_CONTROL_SUBTYPE	'ostg'
+#define RAMP_CONTROL_ID			0x102
+#define RAMP_CONTROL_SUBTYPE	'ramp'
+#define SPDIF_CONTROL_ID		0x103
+#define SPDIF_CONTROL_SUBTYPE	'spdf'
+
+// S/PDIF sources: 0 .. 3 are the stereo pairs of DMA slots, then the downmix of all of them
+#define SPDIF_SOURCE_DOWNMIX	4
+
+// Engine property for the output routing, set with IORegistryEntrySetCFProperties(). An array with
+// an entry per DMA slot, missing slots keep their own channel: a number picks the mix channel the
+// slot takes, an array holds the gain from every mix channel as 16.16 fixed point. An empty array
+// goes back to straight through.
+#define OUTPUT_ROUTING_KEY		"OutputRouting"
+
+// Engine property for bass management on 5.1 and 7.1 systems with small satellites, run on the
+// float mix right after the routing: a dictionary with the "Crossover" frequency in Hz (0, the
+// default, turns it off), the DMA slot of the subwoofer in "LFESlot" (3, as in L R C LFE Ls Rs Lb
+// Rb), and the slots that are highpassed in "Slots", an array of slot numbers (all the others by
+// default). Their lows go to the LFE slot, on top of what it has. Keys that are left out keep their
+// values, the property has all three.
+#define BASS_MANAGEMENT_KEY		"BassManagement"
+#define BASS_CROSSOVER_KEY		"Crossover"
+#define BASS_LFE_SLOT_KEY		"LFESlot"
+#define BASS_SLOTS_KEY			"Slots"
+#define BASS_CROSSOVER_MIN		20
+#define BASS_CROSSOVER_MAX		500
+#define BASS_LFE_SLOT			3
+
+// Engine property for the output EQ, run on the float mix after the routing: an array with an
+// entry per DMA slot, each an array of up to CLIP_EQ_SECTIONS biquads, each an array of b0 b1 b2
+// a1 a2 (normalized to a0 = 1) as 4.28 fixed point. Missing slots and sections pass the samples
+// through, an empty array turns the EQ off. The clip pass switches to a new EQ between two buffers.
+#define OUTPUT_EQ_KEY			"OutputEQ"
+
+// Engine property for the output convolution (room correction), run behind the EQ: an array with
+// an entry per DMA slot, each data with up to CLIP_CONV_MAX_TAPS FIR taps as native floats. Slots
+// with no taps are only delayed, an empty array turns it off. The taps are transformed in the clip
+// pass, the output switches over to them within a second or two. While it's on, the output is
+// CLIP_CONV_PARTITION frames late. Above CLIP_CONV_FULL_RATE the filters are cut shorter. The
+// read-only CONVOLUTION_TAPS_KEY array has the number of taps last set for every slot.
+#define OUTPUT_CONVOLUTION_KEY	"OutputConvolution"
+#define CONVOLUTION_TAPS_KEY	"ConvolutionTaps"
+
+// Engine property for the output delays (speaker time alignment), run behind the convolution: an
+// array with the delay of every DMA slot in frames, up to CLIP_DELAY_MAX (21 ms at 192kHz).
+// Missing slots aren't delayed, an empty array turns the delays off. The delay lines are allocated
+// with the engine. The delays aren't part of the output latency, which goes by the slots without.
+#define OUTPUT_DELAY_KEY		"OutputDelay"
+
+// Engine property for oversampling: a dictionary with the "Ratio" (1, the default, 2 or 4) the
+// DACs run at over the clients' rate, and the "Taps" per phase of the polyphase FIR that upsamples
+// the mix (8 .. CLIP_OVERSAMPLE_TAPS in steps of 8, CLIP_OVERSAMPLE_TAPS by default). The line
+// input is decimated back with the same filter. The ratio is lowered until the hardware has the
+// rate (192kHz at most), and stays at 1 for the non-mixable formats and the integer kernels. The
+// property also has the "HardwareRate" it runs at. The filter adds half its taps to the output and
+// the input latency.
+// The S/PDIF output runs at the hardware rate, it can't carry the rates below 32kHz, nor 64kHz. With
+// "SPDIFRate" set (false by default), the ratio is raised to the lowest one that gets the hardware
+// to a rate it can carry then, 2 or 4: 8kHz goes out at 32kHz, 16kHz at 32kHz. 9.6kHz and 64kHz
+// have no such ratio and stay where the ratio puts them.
+#define OVERSAMPLING_KEY		"Oversampling"
+#define OVERSAMPLING_RATIO_KEY	"Ratio"
+#define OVERSAMPLING_TAPS_KEY	"Taps"
+#define OVERSAMPLING_RATE_KEY	"HardwareRate"
+#define OVERSAMPLING_SPDIF_KEY	"SPDIFRate"
+
+// Engine property for the S/PDIF downmix coefficients: an array with the left and the right side,
+// each an array of 16.16 fixed point gains from the DMA slots. The default is the ITU downmix for
+// L R C LFE Ls Rs (Lb Rb), the centre and the surrounds at -3 dB, without the LFE.
+#define SPDIF_DOWNMIX_KEY		"SPDIFDownmix"
+#define DOWNMIX_ITU_GAIN		46341	// -3 dB in 16.16
+
+// Read-only engine properties with the meters, refreshed every PROPERTY_POLL_MS while running: a
+// dictionary with a "Peak" and an "RMS" array, one 16.16 fixed point dBFS value per channel. The
+// clip pass and the input conversion update them once per buffer.
+// The "Overs" array counts the samples the clip pass clipped, or the input samples at or above
+// -0.1 dBFS, "LastOver" has the uptime (absolute time) of the buffer with the last of them, and the
+// output has the highest peak above full scale in "MaxOvershoot" (16.16 dB). They only ever grow,
+// so a monitoring tool can tell what happened between two reads.
+#define OUTPUT_LEVELS_KEY		"OutputLevels"
+#define INPUT_LEVELS_KEY		"InputLevels"
+
+// A mix buffer that holds nothing but zeros isn't clipped, the DMA buffer is just cleared, and not
+// even that once all of it is known to be zero. Set SILENCE_MUTE_KEY to a number of milliseconds
+// to have the codecs soft-muted after that much silence (0, the default, leaves them alone), the
+// first buffer with sound in it unmutes them again. The read-only SILENCE_KEY dictionary counts
+// the frames that were only cleared ("ErasedFrames") and the ones nothing was done for
+// ("SkippedFrames"), next to the length of the current silence ("SilentFrames") and "Muted".
+#define SILENCE_MUTE_KEY		"SilenceMuteMS"
+#define SILENCE_KEY				"Silence"
+
+// How often the work loop publishes the meters and the silence counters, and brings the codecs'
+// silence mute in line with the clip pass
+#define PROPERTY_POLL_MS		100
+
+// Next to the line input, the engine has a loopback input stream with what the output plays:
+// the DMA buffer after the clip pass, read in place behind the play head. It has a channel for
+// every DMA slot, numbered after the line input channels.
+
+// Volume changes ramp over 20ms: the software volume in the clip pass, sample by sample at
+// whatever rate the hardware runs, the hardware controls in codec steps from a 1ms timer
+#define VOLUME_RAMP_MS			20
+
 class IOFilterInterruptEventSource;
 class IOInterruptEventSource;
+class IOTimerEventSource;
 
 class Envy24HTAudioEngine : public IOAudioEngine
 {
@@ -34,13 +145,31 @@ public:
     
     virtual IOReturn performFormatChange(IOAudioStream *audioStream, const IOAudioStreamFormat *newFormat, const IOAudioSampleRate *newSampleRate);
 
+    virtual IOReturn setProperties(OSObject *properties);
+    
     virtual IOReturn clipOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream);
     virtual IOReturn convertInputSamples(const void *sampleBuf, void *destBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream);
     
     static void interruptHandler(OSObject *owner, IOInterruptEventSource *source, int count);
     static bool interruptFilter(OSObject *owner, IOFilterInterruptEventSource *source);
+    static void pollTimerFired(OSObject *owner, IOTimerEventSource *sender);
     virtual void filterInterrupt(int index);
 	
+	static IOReturn ditherChangeHandler(IOService *target, IOAudioControl *ditherControl, SInt32 oldValue, SInt32 newValue);
+	virtual IOReturn ditherChanged(IOAudioControl *ditherControl, SInt32 oldValue, SInt32 newValue);
+	
+	static IOReturn softwareVolumeChangeHandler(IOService *target, IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue);
+	virtual IOReturn softwareVolumeChanged(IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue);
+	
+	static IOReturn rampChangeHandler(IOService *target, IOAudioControl *rampControl, SInt32 oldValue, SInt32 newValue);
+	virtual IOReturn rampChanged(IOAudioControl *rampControl, SInt32 oldValue, SInt32 newValue);
+	
+	static IOReturn spdifChangeHandler(IOService *target, IOAudioControl *spdifControl, SInt32 oldValue, SInt32 newValue);
+	virtual IOReturn spdifChanged(IOAudioControl *spdifControl, SInt32 oldValue, SInt32 newValue);
+	
+	static IOReturn stageChangeHandler(IOService *target, IOAudioControl *stageControl, SInt32 oldValue, SInt32 newValue);
+	virtual IOReturn stageChanged(IOAudioControl *stageControl, SInt32 oldValue, SInt32 newValue);
+	
 	virtual IOReturn eraseOutputSamples(const void *mixBuf,
 										void *sampleBuf,
 									    UInt32 firstSampleFrame,
@@ -49,18 +178,96 @@ public:
 										IOAudioStream *audioStream);
 	
 private:
+	bool selectClipKernels(UInt32 numChannels);
+	void applyKernelRequests();
+	static IOReturn setPropertiesAction(OSObject *owner, void *arg1, void *arg2, void *arg3, void *arg4);
+	IOReturn routingChanged(OSArray *routing);
+	IOReturn downmixChanged(OSArray *downmix);
+	IOReturn bassChanged(OSDictionary *bass);
+	void applyBassManagement();
+	IOReturn eqChanged(OSArray *eq);
+	IOReturn convolutionChanged(OSArray *filters);
+	IOReturn delayChanged(OSArray *delays);
+	IOReturn oversamplingChanged(OSDictionary *oversample);
+	void applyOversampling();
+	void setOversamplingProperty();
+	void setHardwareRate(UInt32 rate);
+	void updateOutputLatency();
+	void applySpdifSource();
+	void applyRamp();
+	void setLevelProperty(const char *key, const struct ClipMeterState *meter, UInt32 numChannels, bool overshoot);
+	IOReturn silenceMuteChanged(OSNumber *milliseconds);
+	void setSilenceProperty();
+	bool clipSilence(const float *mixBuf, SInt32 *sampleBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 ratio);
+	void clipOversampled(const float *chunk, SInt32 *sampleBuf, bool spdifFed, UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 ratio);
+	void eraseHardwareFrames(UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 spdifFrames, UInt32 ratio);
+	UInt64 getRecordedFrame(UInt32 firstSampleFrame, UInt32 numSampleFrames);
+	
 	struct CardData				   *card;
 	UInt32							currentSampleRate;
     
 	SInt32							*inputBuffer;
     SInt32							*outputBuffer;
 	SInt32							*outputBufferSPDIF;
+	SInt32							*oversampleBuffer;	// what the DMA engine plays while oversampling
+	float							*decimatedBuffer;	// the line input at the stream rate while oversampling, a loop of it
     
 	IOPhysicalAddress               physicalAddressInput;
 	IOPhysicalAddress               physicalAddressOutput;
 	IOPhysicalAddress               physicalAddressOutputSPDIF;
+	IOPhysicalAddress               physicalAddressOversample;
+    
+	ClipKernelType					clipKernelType;
+	ClipKernelFunc					clipKernel;
+	ClipStageFunc					outputStage;
+	ClipRouteFunc					outputRoute;
+	ClipBassFunc					outputBass;
+	ClipEqFunc						outputEq;
+	ClipConvFunc					outputConv;
+	ClipDelayFunc					outputDelay;
+	ClipUpsampleFunc				outputUpsample;
+	ClipDecimateFunc				inputDecimate;
+	PhaseKernelFunc					phaseKernel;
+	SpdifKernelFunc					spdifKernel;
+	EraseKernelFunc					eraseKernel;
+	MirrorKernelFunc				mirrorKernel;
+	ConvertKernelFunc				convertKernel;
+	SilenceKernelFunc				silenceKernel;
+	volatile ClipDitherMode			ditherMode;			// as set, the clip pass picks the kernels for it
+	volatile UInt32					ditherRequest;		// bumped with every new dither mode
+	UInt32							ditherApplied;
+	volatile ClipStageMode			stageMode;			// as set, like ditherMode
+	volatile UInt32					stageRequest;
+	UInt32							stageApplied;
+	ClipRampShape					rampShape;
+	UInt32							outputChannels;
+	UInt32							inputChannels;
+	UInt32							spdifSource;
+	struct ClipRoute				spdifDownmix;
+	struct ClipBass					bassManagement;		// as set, with the current sample rate
+	struct ClipKernelState			clipState;
+	void							*convMemory;		// clipState.conv, allocated with the first filter
+	UInt32							convSize;
+	bool							convolving;
+	void							*delayMemory;		// clipState.delayLines
+	UInt32							delaySize;
+	struct ClipOversample			oversampling;		// as set
+	bool							spdifRate;			// raise the ratio for the S/PDIF output
+	UInt32							hardwareRatio;		// what the hardware runs at, changes while stopped
+	bool							outputMixable;
+	struct ClipDecimator			inputDecimator;
+	volatile UInt32					clipEnd;			// the frame after the last one clipped, never behind the play head
+	UInt32							eraseEnd;			// the frame after the last one erased behind the play head
+	struct ClipMeterState			inputMeter;
+	UInt64							inputEnd;			// the frame after the last one metered, counted from the start
+	UInt64							decimatedEnd;		// the frame after the last one in decimatedBuffer, counted the same way
+	UInt32							silentFrames;		// zeros written since the last sound, saturates
+	UInt32							silenceMuteMS;
+	volatile UInt64					erasedFrames;
+	volatile UInt64					skippedFrames;
     
     IOFilterInterruptEventSource	*interruptEventSource;
+    IOTimerEventSource				*pollTimer;
 };
 
 #endif /* _Envy24HTAudioEngine_H */
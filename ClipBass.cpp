@@ -0,0 +1,220 @@
+#include "ClipKernelsPrivate.h"
+
+// Bass management. The managed slots are added up in slot order, the same way in the scalar and
+// the SIMD kernels, and the sum goes through the lowpass in the lane of the LFE slot. What comes
+// out of it is added to what the LFE slot had. The sections aren't biquads like the EQ's: with the
+// crossover at a few hundredths of a percent of the sample rate, the rounding of their float state
+// throws the gain off (by 10% at the bottom, 40Hz at 192kHz). A state variable filter with
+// trapezoidal integrators has the same response and holds up.
+#define BASS_STATE_FLOATS (sizeof(((ClipKernelState *) 0)->bassState) / sizeof(float))
+
+template <typename T>
+static inline __attribute__((always_inline)) T CrossoverSample(const T &x, const T *coef, T *ic1, T *ic2)
+{
+    T v3 = x - *ic2;
+    T v1 = coef[0] * *ic1 + coef[1] * v3;
+    T v2 = *ic2 + coef[1] * *ic1 + coef[2] * v3;
+
+    *ic1 = (v1 + v1) - *ic1;
+    *ic2 = (v2 + v2) - *ic2;
+    return coef[3] * x + coef[4] * v1 + coef[5] * v2;
+}
+
+template <UInt32 N>
+static inline __attribute__((always_inline)) float BassSum(const float *frame, UInt32 managed)
+{
+    float sum = 0.0f;
+
+    for (UInt32 channel = 0; channel < N; channel++) {
+        if (managed & (1U << channel)) {
+            sum = sum + frame[channel];
+        }
+    }
+    return sum;
+}
+
+template <UInt32 N>
+static void BassFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipBassTable *bass = &state->bassTable;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        float sum = BassSum<N>(mixBuf, bass->managed);
+
+        for (UInt32 channel = 0; channel < N; channel++) {
+            float x = (channel == bass->lfeSlot) ? sum : mixBuf[channel];
+            float coef[6];
+
+            for (UInt32 k = 0; k < 6; k++) {
+                coef[k] = bass->coef[k][channel];
+            }
+            for (UInt32 section = 0; section < 2; section++) {
+                x = CrossoverSample(x, coef, &state->bassState[section][0][channel], &state->bassState[section][1][channel]);
+            }
+            destBuf[channel] = (channel == bass->lfeSlot) ? mixBuf[channel] + x : x;
+        }
+
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    FlushFilterState(&state->bassState[0][0][0], BASS_STATE_FLOATS);
+}
+
+#ifdef ENVY24HT_SIMD
+
+// Like the EQ, with the sum of the managed slots put in the lane of the LFE slot. The
+// coefficients stay in registers as well.
+template <UInt32 N, typename VF>
+static inline __attribute__((always_inline)) void BassFrames_SIMD(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipBassTable *bass = &state->bassTable;
+    UInt32 lfeSlot = bass->lfeSlot, managed = bass->managed;
+    VF coef[6], z1[2], z2[2];
+
+    for (UInt32 k = 0; k < 6; k++) {
+        coef[k] = LoadUnaligned<VF>(bass->coef[k]);
+    }
+    for (UInt32 section = 0; section < 2; section++) {
+        z1[section] = LoadUnaligned<VF>(state->bassState[section][0]);
+        z2[section] = LoadUnaligned<VF>(state->bassState[section][1]);
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        float sum = BassSum<N>(mixBuf, managed);
+        VF x = {};
+
+        __builtin_memcpy(&x, mixBuf, N * sizeof(float));
+        __builtin_memcpy((char *) &x + lfeSlot * sizeof(float), &sum, sizeof(float));
+        for (UInt32 section = 0; section < 2; section++) {
+            x = CrossoverSample(x, coef, &z1[section], &z2[section]);
+        }
+        __builtin_memcpy(destBuf, &x, N * sizeof(float));
+        destBuf[lfeSlot] = mixBuf[lfeSlot] + destBuf[lfeSlot];
+
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    for (UInt32 section = 0; section < 2; section++) {
+        StoreUnaligned<VF>(state->bassState[section][0], z1[section]);
+        StoreUnaligned<VF>(state->bassState[section][1], z2[section]);
+    }
+    FlushFilterState(&state->bassState[0][0][0], BASS_STATE_FLOATS);
+}
+
+template <UInt32 N>
+static void BassFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    BassFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void BassFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    BassFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+#endif /* ENVY24HT_SIMD */
+
+template <UInt32 N>
+static ClipBassFunc GetClipBassForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return NULL;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return BassFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return BassFrames_SSE2<N>;
+#endif
+        default:
+            return BassFrames_Scalar<N>;
+    }
+}
+
+ClipBassFunc GetClipBass(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipBassForChannels<2>(type);
+        case 6:
+            return GetClipBassForChannels<6>(type);
+        case 8:
+            return GetClipBassForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+// The LFE slot and the slots past numChannels are left out of the managed ones, and without any
+// there's nothing to do
+void SetClipBass(ClipKernelState *state, const ClipBass *bass, UInt32 numChannels)
+{
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+
+    state->bassRequest++;
+    CompilerBarrier();
+    state->pendingBass = *bass;
+    state->pendingBass.managed = 0;
+    if (bass->lfeSlot < numChannels) {
+        state->pendingBass.managed = bass->managed & ((1U << numChannels) - 1) & ~(1U << bass->lfeSlot);
+    }
+    if (!state->pendingBass.managed) {
+        state->pendingBass.frequency = 0;
+    }
+    CompilerBarrier();
+    state->bassRequest++;
+}
+
+// Butterworth sections (Q is 1/sqrt(2)), the same response as through the bilinear transform.
+// Each side gets the same one twice, which makes them 4th order Linkwitz-Riley. Slots that pass
+// through keep their integrators at zero. Runs in the clip pass, float math is fine here. From a
+// quarter of the sample rate on the crossover makes no sense, and it stays off.
+#define BASS_SQRT2 1.41421356237309504880
+
+void BuildBassTable(ClipBassTable *table, const ClipBass *bass)
+{
+    double sine, cosine, g, a1;
+    float highpass[6], lowpass[6];
+    static const float through[6] = { 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+
+    table->on = (bass->frequency != 0 && bass->frequency < bass->sampleRate / 4);
+    table->lfeSlot = bass->lfeSlot;
+    table->managed = bass->managed;
+    if (!table->on) {
+        return;
+    }
+
+    SinCos(CLIP_PI * bass->frequency / bass->sampleRate, &sine, &cosine);
+    g = sine / cosine;
+    a1 = 1.0 / (1.0 + g * (g + BASS_SQRT2));
+    highpass[0] = lowpass[0] = (float) a1;
+    highpass[1] = lowpass[1] = (float) (g * a1);
+    highpass[2] = lowpass[2] = (float) (g * g * a1);
+    highpass[3] = 1.0f;
+    highpass[4] = (float) -BASS_SQRT2;
+    highpass[5] = -1.0f;
+    lowpass[3] = 0.0f;
+    lowpass[4] = 0.0f;
+    lowpass[5] = 1.0f;
+
+    for (UInt32 k = 0; k < 6; k++)
+    {
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            table->coef[k][slot] = (table->managed & (1U << slot)) ? highpass[k] :
+                                   ((slot == table->lfeSlot) ? lowpass[k] : through[k]);
+        }
+    }
+}
+
+bool ClipBassSettled(const ClipKernelState *state)
+{
+    return !state->bassTable.on || FilterStateSettled(&state->bassState[0][0][0], BASS_STATE_FLOATS);
+}
@@ -0,0 +1,501 @@
+#include "ClipKernelsPrivate.h"
+
+// Convolution. Each block of CLIP_CONV_PARTITION frames is transformed together with the one
+// before it (CONV_SIZE samples, real) and stored in the history, then every partition of the
+// filter is multiplied with the spectrum of the block as many blocks back, the products summed
+// up and transformed back, and the second half of that is the output (overlap-save).
+// The real transforms go through a complex FFT of half the size. None of them scale, the filter
+// spectra are scaled by CONV_SCALE for all of them instead, which is a power of 2 and so exact.
+// The SIMD kernels run the butterflies and the bins in the lanes of a vector, with the same
+// operations in the same order, so their output is bit-identical.
+#define CONV_SIZE (CLIP_CONV_PARTITION * 2)
+#define CONV_SCALE (1.0f / (4 * CONV_SIZE))
+#define CONV_ACTIVE 1						// in the sequence: the bank the clip pass uses
+#define CONV_WRITING 2						// SetClipConv() writes the taps
+#define CONV_STEP 4
+#define CONV_PREPARE_TRANSFORMS 16			// filter spectra computed per clip pass
+
+// Done in the clip pass the first time a filter comes in, the engine can't do it
+static void BuildConvTables(ClipConvState *conv)
+{
+    UInt32 bits = 0;
+
+    while ((1U << bits) < CLIP_CONV_PARTITION) {
+        bits++;
+    }
+
+    for (UInt32 k = 0; k < CLIP_CONV_PARTITION; k++)
+    {
+        UInt32 reversed = 0;
+        double sine, cosine;
+
+        for (UInt32 bit = 0; bit < bits; bit++) {
+            reversed |= ((k >> bit) & 1) << (bits - 1 - bit);
+        }
+        conv->reversed[k] = (UInt16) reversed;
+
+        SinCos(CLIP_PI * k / CLIP_CONV_PARTITION, &sine, &cosine);
+        conv->twiddle[0][k] = (float) cosine;
+        conv->twiddle[1][k] = (float) -sine;
+    }
+
+    // The stage with butterflies h apart needs e^(-i pi j / h) for j < h, at h - 1 + j
+    for (UInt32 h = 1; h < CLIP_CONV_PARTITION; h <<= 1)
+    {
+        for (UInt32 j = 0; j < h; j++)
+        {
+            conv->stageTwiddle[0][h - 1 + j] = conv->twiddle[0][j * (CLIP_CONV_PARTITION / h)];
+            conv->stageTwiddle[1][h - 1 + j] = conv->twiddle[1][j * (CLIP_CONV_PARTITION / h)];
+            conv->stageTwiddle[2][h - 1 + j] = -conv->twiddle[1][j * (CLIP_CONV_PARTITION / h)];
+        }
+    }
+
+    conv->tables = 1;
+}
+
+template <typename T>
+static inline __attribute__((always_inline)) void Butterfly(T *ar, T *ai, T *br, T *bi, const T &wr, const T &wi)
+{
+    T tr = wr * *br - wi * *bi;
+    T ti = wr * *bi + wi * *br;
+
+    *br = *ar - tr;
+    *bi = *ai - ti;
+    *ar = *ar + tr;
+    *ai = *ai + ti;
+}
+
+// Radix 2, decimation in time, of data in bit reversed order. wi picks the direction. The
+// stages with the butterflies less than W apart run one at a time.
+template <typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void FftStages(float *re, float *im, const float *wr, const float *wi)
+{
+    for (UInt32 h = 1; h < W && h < CLIP_CONV_PARTITION; h <<= 1)
+    {
+        for (UInt32 base = 0; base < CLIP_CONV_PARTITION; base += 2 * h)
+        {
+            for (UInt32 j = 0; j < h; j++)
+            {
+                Butterfly(&re[base + j], &im[base + j], &re[base + h + j], &im[base + h + j], wr[h - 1 + j], wi[h - 1 + j]);
+            }
+        }
+    }
+
+    for (UInt32 h = W; h < CLIP_CONV_PARTITION; h <<= 1)
+    {
+        for (UInt32 base = 0; base < CLIP_CONV_PARTITION; base += 2 * h)
+        {
+            for (UInt32 j = 0; j < h; j += W)
+            {
+                VF ar = LoadUnaligned<VF>(&re[base + j]), ai = LoadUnaligned<VF>(&im[base + j]);
+                VF br = LoadUnaligned<VF>(&re[base + h + j]), bi = LoadUnaligned<VF>(&im[base + h + j]);
+
+                Butterfly(&ar, &ai, &br, &bi, LoadUnaligned<VF>(&wr[h - 1 + j]), LoadUnaligned<VF>(&wi[h - 1 + j]));
+                StoreUnaligned<VF>(&re[base + j], ar);
+                StoreUnaligned<VF>(&im[base + j], ai);
+                StoreUnaligned<VF>(&re[base + h + j], br);
+                StoreUnaligned<VF>(&im[base + h + j], bi);
+            }
+        }
+    }
+}
+
+// CONV_SIZE samples from x into the spectrum, twice its actual size. The even samples are the
+// real parts of the complex FFT, the odd ones the imaginary parts, and bins k and
+// CLIP_CONV_PARTITION - k of that are split up into the even and the odd samples' part.
+template <typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void ForwardTransform(const ClipConvState *conv, const float *x, float *spectrum)
+{
+    const UInt32 M = CLIP_CONV_PARTITION;
+    float *re = spectrum, *im = spectrum + M;
+    float r0, i0;
+
+    for (UInt32 n = 0; n < M; n++) {
+        re[conv->reversed[n]] = x[2 * n];
+        im[conv->reversed[n]] = x[2 * n + 1];
+    }
+    FftStages<VF, W>(re, im, conv->stageTwiddle[0], conv->stageTwiddle[1]);
+
+    r0 = re[0];
+    i0 = im[0];
+    re[0] = (r0 + i0) * 2.0f;
+    im[0] = (r0 - i0) * 2.0f;
+    re[M / 2] = re[M / 2] * 2.0f;
+    im[M / 2] = im[M / 2] * -2.0f;
+    for (UInt32 k = 1; k < M / 2; k++)
+    {
+        UInt32 m = M - k;
+        float er = re[k] + re[m], ei = im[k] - im[m];
+        float ur = im[k] + im[m], ui = re[m] - re[k];
+        float tr = conv->twiddle[0][k] * ur - conv->twiddle[1][k] * ui;
+        float ti = conv->twiddle[0][k] * ui + conv->twiddle[1][k] * ur;
+
+        re[k] = er + tr;
+        im[k] = ei + ti;
+        re[m] = er - tr;
+        im[m] = ti - ei;
+    }
+}
+
+// The other way, from the spectrum to the samples, in x
+template <typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void InverseTransform(const ClipConvState *conv, const float *spectrum, float *x)
+{
+    const UInt32 M = CLIP_CONV_PARTITION;
+    const float *re = spectrum, *im = spectrum + M;
+    float *zr = x, *zi = x + M;
+
+    zr[0] = re[0] + im[0];
+    zi[0] = re[0] - im[0];
+    zr[conv->reversed[M / 2]] = re[M / 2] * 2.0f;
+    zi[conv->reversed[M / 2]] = im[M / 2] * -2.0f;
+    for (UInt32 k = 1; k < M / 2; k++)
+    {
+        UInt32 m = M - k;
+        float er = re[k] + re[m], ei = im[k] - im[m];
+        float dr = re[k] - re[m], di = im[k] + im[m];
+        float ur = dr * conv->twiddle[0][k] + di * conv->twiddle[1][k];
+        float ui = di * conv->twiddle[0][k] - dr * conv->twiddle[1][k];
+
+        zr[conv->reversed[k]] = er - ui;
+        zi[conv->reversed[k]] = ei + ur;
+        zr[conv->reversed[m]] = er + ui;
+        zi[conv->reversed[m]] = ur - ei;
+    }
+    FftStages<VF, W>(zr, zi, conv->stageTwiddle[0], conv->stageTwiddle[2]);
+}
+
+// Adds the product of a filter spectrum and an input spectrum to the accumulator, bin 0 wrong
+template <typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void MultiplyAccumulate(float *accumulator, const float *filter, const float *input)
+{
+    const UInt32 M = CLIP_CONV_PARTITION;
+
+    for (UInt32 k = 0; k < M; k += W)
+    {
+        VF hr = LoadUnaligned<VF>(&filter[k]), hi = LoadUnaligned<VF>(&filter[M + k]);
+        VF xr = LoadUnaligned<VF>(&input[k]), xi = LoadUnaligned<VF>(&input[M + k]);
+
+        StoreUnaligned<VF>(&accumulator[k], LoadUnaligned<VF>(&accumulator[k]) + (hr * xr - hi * xi));
+        StoreUnaligned<VF>(&accumulator[M + k], LoadUnaligned<VF>(&accumulator[M + k]) + (hr * xi + hi * xr));
+    }
+}
+
+// The partitions of a bank that run at the current rate
+static inline UInt32 ConvPartitions(const ClipConvState *conv, UInt32 bank)
+{
+    return (conv->numPartitions[bank] < conv->maxPartitions) ? conv->numPartitions[bank] : conv->maxPartitions;
+}
+
+// Convolves the block that just filled up, and moves it to the first half of the input
+template <UInt32 N, typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void ConvolveBlock(ClipConvState *conv)
+{
+    const UInt32 M = CLIP_CONV_PARTITION;
+    UInt32 bank = conv->sequence & CONV_ACTIVE;
+    UInt32 numPartitions = ConvPartitions(conv, bank);
+    const float *spectra = conv->spectra[bank];
+    UInt32 head = (conv->head + 1) & (CLIP_CONV_MAX_PARTITIONS - 1);
+
+    for (UInt32 channel = 0; channel < N; channel++)
+    {
+        float *x = conv->input[channel];
+
+        if (conv->filtered[bank] & (1 << channel))
+        {
+            float *spectrum = &conv->history[(head * N + channel) * CONV_SIZE];
+            float dc = 0.0f, nyquist = 0.0f;
+
+            ForwardTransform<VF, W>(conv, x, spectrum);
+            __builtin_memset(conv->accumulator, 0, sizeof(conv->accumulator));
+            for (UInt32 partition = 0; partition < numPartitions; partition++)
+            {
+                const float *filter = &spectra[(partition * N + channel) * CONV_SIZE];
+                const float *past = &conv->history[(((head - partition) & (CLIP_CONV_MAX_PARTITIONS - 1)) * N + channel) * CONV_SIZE];
+
+                dc = dc + filter[0] * past[0];
+                nyquist = nyquist + filter[M] * past[M];
+                MultiplyAccumulate<VF, W>(conv->accumulator, filter, past);
+            }
+            conv->accumulator[0] = dc;
+            conv->accumulator[M] = nyquist;
+            InverseTransform<VF, W>(conv, conv->accumulator, conv->work);
+
+            // Samples M .. CONV_SIZE - 1, the even ones are the real parts
+            for (UInt32 i = 0; i < M; i += 2) {
+                conv->output[i * N + channel] = conv->work[M / 2 + i / 2];
+                conv->output[(i + 1) * N + channel] = conv->work[M + M / 2 + i / 2];
+            }
+        }
+        else
+        {
+            for (UInt32 i = 0; i < M; i++) {
+                conv->output[i * N + channel] = x[M + i];
+            }
+        }
+
+        __builtin_memcpy(x, &x[M], M * sizeof(float));
+    }
+
+    conv->head = head;
+    if (conv->loud) {
+        conv->quietBlocks = 0;
+    } else if (conv->quietBlocks < CLIP_CONV_MAX_PARTITIONS + 1) {
+        conv->quietBlocks++;
+    }
+    conv->loud = 0;
+}
+
+// A frame at a time into the block, the output comes from the block before
+template <UInt32 N, typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void ConvFrames(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    ClipConvState *conv = state->conv;
+    UInt32 position = conv->position;
+    UInt32 loud = 0;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++)
+    {
+        for (UInt32 channel = 0; channel < N; channel++)
+        {
+            UInt32 bits;
+
+            __builtin_memcpy(&bits, &mixBuf[channel], sizeof(bits));
+            loud |= bits << 1;
+            conv->input[channel][CLIP_CONV_PARTITION + position] = mixBuf[channel];
+            destBuf[channel] = conv->output[position * N + channel];
+        }
+
+        mixBuf += N;
+        destBuf += N;
+        if (++position == CLIP_CONV_PARTITION)
+        {
+            conv->loud |= loud;
+            loud = 0;
+            ConvolveBlock<N, VF, W>(conv);
+            position = 0;
+        }
+    }
+
+    conv->loud |= loud;
+    conv->position = position;
+}
+
+template <UInt32 N>
+static void ConvFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    ConvFrames<N, float, 1>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+#ifdef ENVY24HT_SIMD
+
+template <UInt32 N>
+static void ConvFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    ConvFrames<N, v4sf, 4>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void ConvFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    ConvFrames<N, v8sf, 8>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+#endif /* ENVY24HT_SIMD */
+
+template <UInt32 N>
+static ClipConvFunc GetClipConvForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return NULL;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return ConvFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return ConvFrames_SSE2<N>;
+#endif
+        default:
+            return ConvFrames_Scalar<N>;
+    }
+}
+
+ClipConvFunc GetClipConv(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipConvForChannels<2>(type);
+        case 6:
+            return GetClipConvForChannels<6>(type);
+        case 8:
+            return GetClipConvForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+#define CONV_HEADER_SIZE ((sizeof(ClipConvState) + 63) & ~63UL)
+#define CONV_BANK_FLOATS(numChannels) (CLIP_CONV_MAX_PARTITIONS * (numChannels) * CONV_SIZE)
+
+UInt32 ClipConvSize(UInt32 numChannels)
+{
+    return (UInt32) (CONV_HEADER_SIZE + (CLIP_CONV_MAX_TAPS * numChannels + 3 * CONV_BANK_FLOATS(numChannels)) * sizeof(float));
+}
+
+// The banks get written by SetClipConv(), the history wherever a filter starts
+ClipConvState *InitClipConv(void *memory, UInt32 numChannels)
+{
+    ClipConvState *conv = (ClipConvState *) memory;
+    float *banks = (float *) ((char *) memory + CONV_HEADER_SIZE);
+
+    __builtin_memset(conv, 0, sizeof(*conv));
+    conv->numChannels = numChannels;
+    conv->maxPartitions = CLIP_CONV_MAX_PARTITIONS;
+    conv->spectra[0] = banks;
+    conv->spectra[1] = banks + CONV_BANK_FLOATS(numChannels);
+    conv->history = banks + 2 * CONV_BANK_FLOATS(numChannels);
+    conv->taps = banks + 3 * CONV_BANK_FLOATS(numChannels);
+
+    return conv;
+}
+
+// Only the taps are written here, while CONV_WRITING keeps the clip pass from reading them, and the
+// sequence moves on, so the clip pass transforms them into the bank it doesn't use
+void SetClipConv(ClipConvState *conv, const float *const taps[CLIP_KERNEL_MAX_CHANNELS], const UInt32 numTaps[CLIP_KERNEL_MAX_CHANNELS])
+{
+    UInt32 sequence;
+
+    do {
+        sequence = conv->sequence;
+    } while (!OSCompareAndSwap(sequence, sequence | CONV_WRITING, (UInt32 *) &conv->sequence));
+
+    for (UInt32 slot = 0; slot < conv->numChannels; slot++)
+    {
+        UInt32 count = taps[slot] ? numTaps[slot] : 0;
+
+        if (count > CLIP_CONV_MAX_TAPS) {
+            count = CLIP_CONV_MAX_TAPS;
+        }
+        __builtin_memcpy(&conv->taps[slot * CLIP_CONV_MAX_TAPS], taps[slot], count * sizeof(float));
+        conv->numTaps[slot] = count;
+    }
+
+    do {
+        sequence = conv->sequence;
+    } while (!OSCompareAndSwap(sequence, (sequence & ~CONV_WRITING) + CONV_STEP, (UInt32 *) &conv->sequence));
+}
+
+// The history keeps all CLIP_CONV_MAX_PARTITIONS blocks, so the partitions that were cut pick up
+// where they were when they come back
+void SetClipConvRate(ClipConvState *conv, UInt32 sampleRate)
+{
+    UInt32 maxPartitions = CLIP_CONV_MAX_PARTITIONS;
+
+    if (sampleRate > CLIP_CONV_FULL_RATE) {
+        maxPartitions = CLIP_CONV_MAX_PARTITIONS * CLIP_CONV_FULL_RATE / sampleRate;
+    }
+    conv->maxPartitions = maxPartitions ? maxPartitions : 1;
+}
+
+// Transforms up to CONV_PREPARE_TRANSFORMS partitions of the taps SetClipConv() last set into the
+// bank the clip pass doesn't use, and switches over to it once they're all done. Only the clip pass
+// writes the banks. If SetClipConv() got in meanwhile, the taps may have changed under the
+// transforms, so they start over and the switch waits for them. The slots that weren't filtered
+// before start with silence in their history, and if the convolution was off it starts over with
+// silence altogether.
+void PrepareClipConv(ClipConvState *conv)
+{
+    UInt32 sequence = conv->sequence;
+    UInt32 bank = (sequence & CONV_ACTIVE) ^ 1;
+    UInt32 numChannels = conv->numChannels;
+    UInt32 total, started;
+
+    if ((sequence & CONV_WRITING) || (sequence & ~CONV_ACTIVE) == conv->applied) {
+        return;
+    }
+    if ((sequence & ~CONV_ACTIVE) != conv->preparing)
+    {
+        UInt32 numPartitions = 0, filtered = 0;
+
+        for (UInt32 slot = 0; slot < numChannels; slot++)
+        {
+            UInt32 count = conv->numTaps[slot];
+
+            if (count) {
+                filtered |= 1 << slot;
+                if ((count + CLIP_CONV_PARTITION - 1) / CLIP_CONV_PARTITION > numPartitions) {
+                    numPartitions = (count + CLIP_CONV_PARTITION - 1) / CLIP_CONV_PARTITION;
+                }
+            }
+        }
+        conv->numPartitions[bank] = numPartitions;
+        conv->filtered[bank] = filtered;
+        conv->preparing = sequence & ~CONV_ACTIVE;
+        conv->prepared = 0;
+    }
+    if (!conv->tables) {
+        BuildConvTables(conv);
+    }
+
+    // Every partition zero padded to the size of the transform
+    total = conv->numPartitions[bank] * numChannels;
+    for (UInt32 done = 0; done < CONV_PREPARE_TRANSFORMS && conv->prepared < total; conv->prepared++)
+    {
+        float *spectrum = &conv->spectra[bank][conv->prepared * CONV_SIZE];
+        UInt32 slot = conv->prepared % numChannels;
+        UInt32 first = conv->prepared / numChannels * CLIP_CONV_PARTITION;
+        UInt32 count = 0;
+
+        if (!(conv->filtered[bank] & (1 << slot))) {
+            continue;
+        }
+        if (conv->numTaps[slot] > first) {
+            count = (conv->numTaps[slot] - first < CLIP_CONV_PARTITION) ? conv->numTaps[slot] - first : CLIP_CONV_PARTITION;
+        }
+        __builtin_memcpy(spectrum, &conv->taps[slot * CLIP_CONV_MAX_TAPS + first], count * sizeof(float));
+        __builtin_memset(&spectrum[count], 0, (CONV_SIZE - count) * sizeof(float));
+        ForwardTransform<float, 1>(conv, spectrum, conv->work);
+        for (UInt32 i = 0; i < CONV_SIZE; i++) {
+            spectrum[i] = conv->work[i] * CONV_SCALE;
+        }
+        done++;
+    }
+    if (conv->prepared < total || !OSCompareAndSwap(sequence, sequence ^ CONV_ACTIVE, (UInt32 *) &conv->sequence)) {
+        return;
+    }
+
+    started = conv->filtered[bank] & ~conv->filtered[bank ^ 1];
+    if (!conv->numPartitions[bank ^ 1])
+    {
+        started = conv->filtered[bank];
+        __builtin_memset(conv->input, 0, sizeof(conv->input));
+        __builtin_memset(conv->output, 0, sizeof(conv->output));
+        conv->position = 0;
+    }
+    for (UInt32 slot = 0; slot < numChannels; slot++)
+    {
+        if (!(started & (1 << slot))) {
+            continue;
+        }
+        for (UInt32 partition = 0; partition < CLIP_CONV_MAX_PARTITIONS; partition++) {
+            __builtin_memset(&conv->history[(partition * numChannels + slot) * CONV_SIZE], 0, CONV_SIZE * sizeof(float));
+        }
+    }
+    conv->applied = sequence & ~CONV_ACTIVE;
+    conv->quietBlocks = 0;
+}
+
+bool ClipConvActive(const ClipKernelState *state)
+{
+    return state->conv && state->conv->numPartitions[state->conv->sequence & CONV_ACTIVE] != 0;
+}
+
+// The output of a block comes from it and the numPartitions blocks before
+bool ClipConvSettled(const ClipKernelState *state)
+{
+    const ClipConvState *conv = state->conv;
+
+    return !ClipConvActive(state) || (!conv->loud && conv->quietBlocks > ConvPartitions(conv, conv->sequence & CONV_ACTIVE));
+}
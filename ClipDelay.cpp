@@ -0,0 +1,108 @@
+#include "ClipKernelsPrivate.h"
+
+// Delays. Every frame goes into the ring as it is, and every slot takes its sample from as many
+// frames back, 0 being the one that just went in. Only the bits are moved, like the permutations.
+template <UInt32 N>
+static void DelayFrames(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    ClipDelayLines *lines = state->delayLines;
+    UInt32 *ring = lines->ring;
+    UInt32 position = lines->position;
+    UInt32 quietFrames = lines->quietFrames;
+    UInt32 back[N];
+
+    for (UInt32 slot = 0; slot < N; slot++) {
+        back[slot] = CLIP_DELAY_FRAMES - state->delay.frames[slot];
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        UInt32 loud = 0;
+
+        for (UInt32 slot = 0; slot < N; slot++) {
+            UInt32 bits = ((const UInt32 *) mixBuf)[slot];
+
+            ring[position * N + slot] = bits;
+            loud |= bits & 0x7fffffff;
+        }
+        for (UInt32 slot = 0; slot < N; slot++) {
+            ((UInt32 *) destBuf)[slot] = ring[((position + back[slot]) & (CLIP_DELAY_FRAMES - 1)) * N + slot];
+        }
+
+        quietFrames = loud ? 0 : quietFrames + (quietFrames < CLIP_DELAY_FRAMES);
+        position = (position + 1) & (CLIP_DELAY_FRAMES - 1);
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    lines->position = position;
+    lines->quietFrames = quietFrames;
+}
+
+ClipDelayFunc GetClipDelay(ClipKernelType, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return DelayFrames<2>;
+        case 6:
+            return DelayFrames<6>;
+        case 8:
+            return DelayFrames<8>;
+        default:
+            return NULL;
+    }
+}
+
+#define DELAY_HEADER_SIZE ((sizeof(ClipDelayLines) + 63) & ~63UL)
+
+UInt32 ClipDelaySize(UInt32 numChannels)
+{
+    return (UInt32) (DELAY_HEADER_SIZE + CLIP_DELAY_FRAMES * numChannels * sizeof(UInt32));
+}
+
+void ClearClipDelay(ClipDelayLines *lines)
+{
+    __builtin_memset(lines->ring, 0, CLIP_DELAY_FRAMES * lines->numChannels * sizeof(UInt32));
+    lines->position = 0;
+    lines->quietFrames = CLIP_DELAY_FRAMES;
+}
+
+ClipDelayLines *InitClipDelay(void *memory, UInt32 numChannels)
+{
+    ClipDelayLines *lines = (ClipDelayLines *) memory;
+
+    lines->numChannels = numChannels;
+    lines->ring = (UInt32 *) ((char *) memory + DELAY_HEADER_SIZE);
+    ClearClipDelay(lines);
+
+    return lines;
+}
+
+void SetClipDelay(ClipKernelState *state, const ClipDelay *delay, UInt32 numChannels)
+{
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+
+    state->delayRequest++;
+    CompilerBarrier();
+    for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+    {
+        UInt32 frames = (slot < numChannels) ? delay->frames[slot] : 0;
+
+        state->pendingDelay.frames[slot] = (frames < CLIP_DELAY_MAX) ? frames : CLIP_DELAY_MAX;
+    }
+    CompilerBarrier();
+    state->delayRequest++;
+}
+
+bool ClipDelayActive(const ClipKernelState *state)
+{
+    return state->delayLines && state->maxDelay != 0;
+}
+
+// Once the longest delay has only had silence, so have all the others
+bool ClipDelaySettled(const ClipKernelState *state)
+{
+    return !ClipDelayActive(state) || state->delayLines->quietFrames >= state->maxDelay;
+}
@@ -0,0 +1,174 @@
+#include "ClipKernelsPrivate.h"
+
+// Output EQ. Every section is a biquad in transposed direct form II, which keeps its state small
+// and behaves with the coefficients changing under it. The channels of a frame go through the
+// cascade side by side, each with its own coefficients. No FMA, like the routing, so the scalar
+// and the SIMD kernels round the same.
+
+template <typename T>
+static inline __attribute__((always_inline)) T FilterSample(const T &x, const T &b0, const T &b1, const T &b2, const T &a1, const T &a2, T *z1, T *z2)
+{
+    T y = b0 * x + *z1;
+
+    *z1 = b1 * x - a1 * y + *z2;
+    *z2 = b2 * x - a2 * y;
+    return y;
+}
+
+static void FlushEqState(ClipKernelState *state)
+{
+    FlushFilterState(&state->eqState[0][0][0], state->eq.numSections * 2 * CLIP_KERNEL_MAX_CHANNELS);
+}
+
+template <UInt32 N>
+static void EqFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipEqTable *eq = &state->eq;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            float x = mixBuf[channel];
+
+            for (UInt32 section = 0; section < eq->numSections; section++) {
+                const float (*coef)[CLIP_KERNEL_MAX_CHANNELS] = eq->coef[section];
+
+                x = FilterSample(x, coef[0][channel], coef[1][channel], coef[2][channel], coef[3][channel], coef[4][channel],
+                                 &state->eqState[section][0][channel], &state->eqState[section][1][channel]);
+            }
+            destBuf[channel] = x;
+        }
+
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    FlushEqState(state);
+}
+
+#ifdef ENVY24HT_SIMD
+
+// A frame at a time with the channels in the lanes, the state stays in registers for the chunk
+template <UInt32 N, typename VF>
+static inline __attribute__((always_inline)) void EqFrames_SIMD(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipEqTable *eq = &state->eq;
+    UInt32 numSections = eq->numSections;
+    VF z1[CLIP_EQ_SECTIONS], z2[CLIP_EQ_SECTIONS];
+
+    for (UInt32 section = 0; section < numSections; section++) {
+        z1[section] = LoadUnaligned<VF>(state->eqState[section][0]);
+        z2[section] = LoadUnaligned<VF>(state->eqState[section][1]);
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        VF x = {};
+
+        __builtin_memcpy(&x, mixBuf, N * sizeof(float));
+        for (UInt32 section = 0; section < numSections; section++) {
+            const float (*coef)[CLIP_KERNEL_MAX_CHANNELS] = eq->coef[section];
+
+            x = FilterSample(x, LoadUnaligned<VF>(coef[0]), LoadUnaligned<VF>(coef[1]), LoadUnaligned<VF>(coef[2]),
+                             LoadUnaligned<VF>(coef[3]), LoadUnaligned<VF>(coef[4]), &z1[section], &z2[section]);
+        }
+        __builtin_memcpy(destBuf, &x, N * sizeof(float));
+
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    for (UInt32 section = 0; section < numSections; section++) {
+        StoreUnaligned<VF>(state->eqState[section][0], z1[section]);
+        StoreUnaligned<VF>(state->eqState[section][1], z2[section]);
+    }
+    FlushEqState(state);
+}
+
+template <UInt32 N>
+static void EqFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    EqFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void EqFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    EqFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+#endif /* ENVY24HT_SIMD */
+
+template <UInt32 N>
+static ClipEqFunc GetClipEqForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return NULL;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return EqFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return EqFrames_SSE2<N>;
+#endif
+        default:
+            return EqFrames_Scalar<N>;
+    }
+}
+
+ClipEqFunc GetClipEq(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipEqForChannels<2>(type);
+        case 6:
+            return GetClipEqForChannels<6>(type);
+        case 8:
+            return GetClipEqForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+// Slots from numChannels on pass their (silent) lanes through. The cascade runs up to the last
+// section that does anything on any of the slots.
+static void BuildEqTable(ClipEqTable *table, const ClipEq *eq, UInt32 numChannels)
+{
+    table->numSections = 0;
+    for (UInt32 section = 0; section < CLIP_EQ_SECTIONS; section++)
+    {
+        for (UInt32 k = 0; k < 5; k++)
+        {
+            SInt32 through = (k == 0) ? CLIP_EQ_UNITY : 0;
+
+            for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+            {
+                SInt32 coef = (slot < numChannels) ? eq->coef[slot][section][k] : through;
+                UInt32 bits = FixedBits(coef, 28);
+
+                if (coef != through) {
+                    table->numSections = section + 1;
+                }
+                __builtin_memcpy(&table->coef[section][k][slot], &bits, sizeof(bits));
+            }
+        }
+    }
+}
+
+void SetClipEq(ClipKernelState *state, const ClipEq *eq, UInt32 numChannels)
+{
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+
+    state->eqRequest++;
+    CompilerBarrier();
+    BuildEqTable(&state->pendingEq, eq, numChannels);
+    CompilerBarrier();
+    state->eqRequest++;
+}
+
+bool ClipEqSettled(const ClipKernelState *state)
+{
+    return FilterStateSettled(&state->eqState[0][0][0], state->eq.numSections * 2 * CLIP_KERNEL_MAX_CHANNELS);
+}
@@ -0,0 +1,2039 @@
+#include "ClipKernelsPrivate.h"
+
+#define INT_MIN 2147483648.0
+#define INT_MAX 2147483647.0
+#define INT_MINDIV (1.0 / INT_MIN)
+#define INT_MAXDIV (1.0 / INT_MAX)
+
+// Reference conversion - this is the original per-sample code from clipOutputSamples() and
+// defines the exact output the SIMD variants have to reproduce.
+// Note that the scaling is done in double precision (INT_MAX and INT_MIN are double constants).
+static inline SInt32 ClipSample(float inSample)
+{
+    // Clip that sample to a range of -1.0 to 1.0
+    // A softer clipping operation could be done here
+    if (inSample > 1.0)
+    {
+        inSample = 1.0;
+    }
+    else if (inSample < -1.0)
+    {
+        inSample = -1.0;
+    }
+
+    // Scale the -1.0 to 1.0 range to the appropriate scale for signed 32-bit samples and then
+    // convert to SInt32
+    if (inSample >= 0)
+    {
+        return (SInt32) (inSample * INT_MAX);
+    }
+    else
+    {
+        return (SInt32) (inSample * INT_MIN);
+    }
+}
+
+// The dither works on the clipped SInt32 samples, which the 24 bit DACs see as 24.8 fixed point.
+// It's done at half that scale (24.7), so that adding the dither and the shaper's error can't
+// overflow at full scale.
+#define DITHER_LSB 128
+#define DITHER_MAX (0x40000000 - DITHER_LSB)
+#define DITHER_MIN (-0x40000000)
+
+static inline UInt32 NextRandom(UInt32 x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// Triangular PDF dither of +-1 LSB: the difference of two independent 7 bit uniform values
+static inline SInt32 TriangularDither(UInt32 random)
+{
+    return (SInt32) (random >> 25) - (SInt32) (random & (DITHER_LSB - 1));
+}
+
+// Rounds sample to 24 bits with the given dither. The shaper subtracts the previous error of the
+// channel first. The error is taken before the final clamp, so that it stays within 1.5 LSB even
+// when the signal sits at full scale and the shaper can't run away.
+template <UInt32 Dither>
+static inline SInt32 DitherSample(SInt32 sample, SInt32 dither, SInt32 *error)
+{
+    SInt32 wanted = sample >> 1;
+    SInt32 rounded;
+
+    if (Dither == kClipDitherShaped) {
+        wanted -= *error;
+    }
+
+    rounded = (wanted + dither + DITHER_LSB / 2) & ~(DITHER_LSB - 1);
+
+    if (Dither == kClipDitherShaped) {
+        *error = rounded - wanted;
+    }
+
+    if (rounded > DITHER_MAX) {
+        rounded = DITHER_MAX;
+    } else if (rounded < DITHER_MIN) {
+        rounded = DITHER_MIN;
+    }
+    return rounded * 2;
+}
+
+// The meters see the samples after the software volume: the peak before the clip, so overs show,
+// the squares after it. A NaN doesn't move the peak and counts as full scale, like it's clipped.
+// Returns 1 for a sample the clip changes (a NaN as well), which the clip kernels count.
+static inline UInt32 MeterSample(float sample, float *peak, float *squares)
+{
+    float magnitude = (sample < 0) ? -sample : sample;
+    float square = magnitude * magnitude;
+
+    // Written so they compile to maxss and minss rather than branches on the signal
+    *peak = (*peak < magnitude) ? magnitude : *peak;
+    *squares += (square < 1.0f) ? square : 1.0f;
+
+    return !(magnitude <= 1.0f);
+}
+
+// The per board channel count (2, 6 or 8) is a template parameter, so the frame loops below are
+// fully unrolled and all strides are constants. performFormatChange() caches the instance.
+// The Ramp variants move the gains along the current ramp after every frame.
+template <UInt32 N, UInt32 Dither, bool Ramp>
+static void ClipFrames_Scalar(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                              ClipKernelState *state)
+{
+    float gain[N], rampMul[N], rampAdd[N], peak[N], squares[N];
+    UInt32 overs[N];
+
+    mixBuf += firstSampleFrame * N;
+    sampleBuf += firstSampleFrame * N;
+    spdifBuf += firstSampleFrame * 2;
+
+    for (UInt32 channel = 0; channel < N; channel++) {
+        gain[channel] = state->gain[channel];
+        rampMul[channel] = state->rampMul[channel];
+        rampAdd[channel] = state->rampAdd[channel];
+        peak[channel] = state->meter.peak[channel];
+        squares[channel] = 0.0f;
+        overs[channel] = 0;
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            // The software volume, exact at unity gain
+            float sample = mixBuf[channel] * gain[channel];
+
+            overs[channel] += MeterSample(sample, &peak[channel], &squares[channel]);
+            sampleBuf[channel] = ClipSample(sample);
+
+            if (Ramp) {
+                gain[channel] = gain[channel] * rampMul[channel] + rampAdd[channel];
+            }
+
+            if (Dither != kClipDitherNone) {
+                state->random[channel] = NextRandom(state->random[channel]);
+                sampleBuf[channel] = DitherSample<Dither>(sampleBuf[channel], TriangularDither(state->random[channel]), &state->error[channel]);
+            }
+        }
+
+        // The S/PDIF output carries the first stereo pair
+        spdifBuf[0] = sampleBuf[0];
+        spdifBuf[1] = sampleBuf[1];
+
+        mixBuf += N;
+        sampleBuf += N;
+        spdifBuf += 2;
+    }
+
+    for (UInt32 channel = 0; channel < N; channel++) {
+        state->meter.peak[channel] = peak[channel];
+        state->meter.squares[channel] += squares[channel];
+        state->meter.overs[channel] += overs[channel];
+    }
+
+    if (Ramp) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            state->gain[channel] = gain[channel];
+        }
+    }
+}
+
+// Gain ramps. SetClipGain() only sets the target, the ramp is set up here in the clip pass where
+// float math is allowed: the per frame factor and increment for every channel, so that the kernels
+// just do a multiply and an add per frame and channel, without any branches.
+// Log2() and Exp2() are only good enough for that, they don't need libm.
+static double Log2(double x)
+{
+    UInt64 bits;
+    SInt32 exponent;
+    double t, t2;
+
+    __builtin_memcpy(&bits, &x, sizeof(bits));
+    exponent = (SInt32) ((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & 0xfffffffffffffULL) | 0x3ff0000000000000ULL;
+    __builtin_memcpy(&x, &bits, sizeof(bits));
+    if (x > 1.4142135623730951) {
+        x *= 0.5;
+        exponent++;
+    }
+
+    // log2(x) = 2 / ln(2) * atanh(t) with t = (x - 1) / (x + 1), at most 0.18 here
+    t = (x - 1.0) / (x + 1.0);
+    t2 = t * t;
+    return exponent + 2.8853900817779268 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 * (1.0 / 11 + t2 / 13))))));
+}
+
+static double Exp2(double x)
+{
+    SInt32 whole = (SInt32) x;
+    UInt64 bits;
+    double y, power, term = 1.0, sum = 1.0;
+
+    if (x < whole) {
+        whole--;
+    }
+
+    // e^y with y = frac(x) * ln(2), at most 0.7 here
+    y = (x - whole) * 0.69314718055994531;
+    for (UInt32 i = 1; i < 14; i++) {
+        term *= y / i;
+        sum += term;
+    }
+
+    bits = (UInt64) (whole + 1023) << 52;
+    __builtin_memcpy(&power, &bits, sizeof(bits));
+    return sum * power;
+}
+
+static void StartGainRamp(ClipKernelState *state)
+{
+    UInt32 length = state->ramp.frames;
+
+    state->rampStarted = state->rampRequest;
+
+    for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+    {
+        float from = state->gain[i];
+        float to = state->targetGain[i];
+
+        if (state->ramp.shape == kClipRampOff || length == 0)
+        {
+            state->gain[i] = to;
+            state->rampMul[i] = 1.0f;
+            state->rampAdd[i] = 0.0f;
+        }
+        else if (state->ramp.shape == kClipRampExponential && from > 0.0f && to > 0.0f)
+        {
+            state->rampMul[i] = (float) Exp2(Log2((double) to / from) / length);
+            state->rampAdd[i] = 0.0f;
+        }
+        else
+        {
+            state->rampMul[i] = 1.0f;
+            state->rampAdd[i] = (to - from) / length;
+        }
+    }
+
+    state->rampFrames = (state->ramp.shape == kClipRampOff) ? 0 : length;
+}
+
+// Runs the ramping variant of a kernel over the frames that are left of the current ramp and the
+// steady one over the rest. At the end of the ramp the gains are set to the targets exactly.
+static void RunGainRamp(ClipKernelFunc steady, ClipKernelFunc ramping, const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf,
+                        UInt32 firstSampleFrame, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    UInt32 ramp;
+
+    if (state->rampRequest != state->rampStarted) {
+        StartGainRamp(state);
+    }
+
+    ramp = (state->rampFrames < numSampleFrames) ? state->rampFrames : numSampleFrames;
+    if (ramp) {
+        ramping(mixBuf, sampleBuf, spdifBuf, firstSampleFrame, ramp, state);
+
+        state->rampFrames -= ramp;
+        if (state->rampFrames == 0) {
+            for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++) {
+                state->gain[i] = state->targetGain[i];
+            }
+        }
+    }
+
+    if (ramp < numSampleFrames) {
+        steady(mixBuf, sampleBuf, spdifBuf, firstSampleFrame + ramp, numSampleFrames - ramp, state);
+    }
+}
+
+template <UInt32 N, UInt32 Dither>
+static void ClipFramesRamped_Scalar(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                    ClipKernelState *state)
+{
+    RunGainRamp(ClipFrames_Scalar<N, Dither, false>, ClipFrames_Scalar<N, Dither, true>,
+                mixBuf, sampleBuf, spdifBuf, firstSampleFrame, numSampleFrames, state);
+}
+
+// Reference input conversion - the original loop from convertInputSamples()
+// The input meters take the converted samples, the overs are counted on the SInt32 ones
+static inline bool InputOver(SInt32 inputSample)
+{
+    return inputSample >= CLIP_INPUT_OVER_LEVEL || inputSample <= -CLIP_INPUT_OVER_LEVEL;
+}
+
+void ConvertSInt32ToFloat_Scalar(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels, ClipMeterState *meter)
+{
+    SInt32 inputSample;
+    float peak[CLIP_KERNEL_MAX_CHANNELS], squares[CLIP_KERNEL_MAX_CHANNELS];
+    UInt32 overs[CLIP_KERNEL_MAX_CHANNELS];
+    UInt32 channel = 0;
+
+    if (numChannels - 1 >= CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = 1;
+    }
+    for (channel = 0; channel < numChannels; channel++) {
+        peak[channel] = meter ? meter->peak[channel] : 0.0f;
+        squares[channel] = 0.0f;
+        overs[channel] = 0;
+    }
+
+    channel = 0;
+    for (UInt32 i = 0; i < numSamples; i++) {
+        inputSample = sampleBuf[i];
+
+        // Scale that sample to a range of -1.0 to 1.0 and convert to float
+        if (inputSample >= 0) {
+            destBuf[i] = inputSample * INT_MAXDIV;
+        } else {
+            destBuf[i] = inputSample * INT_MINDIV;
+        }
+
+        MeterSample(destBuf[i], &peak[channel], &squares[channel]);
+        overs[channel] += InputOver(inputSample);
+        if (++channel == numChannels) {
+            channel = 0;
+        }
+    }
+
+    for (channel = 0; channel < numChannels && meter; channel++) {
+        meter->peak[channel] = peak[channel];
+        meter->squares[channel] += squares[channel];
+        meter->overs[channel] += overs[channel];
+    }
+}
+
+// Integer only kernels. These never load a float into an FPU register: the mix buffer is read as
+// raw IEEE-754 bits and the record buffer is written that way. They reproduce the double precision
+// arithmetic of the reference code exactly, including its rounding, using 64 bit integers.
+
+// Rounds v to the given number of significant bits, to nearest even like the FPU does
+static inline UInt64 RoundToBits(UInt64 v, UInt32 bits)
+{
+    UInt32 length = 64 - __builtin_clzll(v);
+    UInt64 unit, rest;
+
+    if (length <= bits) {
+        return v;
+    }
+
+    unit = 1ULL << (length - bits);
+    rest = v & (unit - 1);
+    v -= rest;
+    if (rest > unit / 2 || (rest == unit / 2 && (v & unit))) {
+        v += unit;
+    }
+    return v;
+}
+
+// Builds the float bits for v * 2^exponent, v must be non-zero and have at most 24 significant bits
+static inline UInt32 MakeFloatBits(UInt64 v, SInt32 exponent)
+{
+    SInt32 top = 63 - __builtin_clzll(v);
+    UInt32 mantissa = (UInt32) (top >= 23 ? v >> (top - 23) : v << (23 - top));
+
+    return ((UInt32) (top + exponent + 127) << 23) | (mantissa & 0x7fffff);
+}
+
+static inline SInt32 ClipSampleBits(UInt32 bits)
+{
+    UInt32 magnitude = bits & 0x7fffffff;
+    UInt64 mantissa;
+    UInt32 shift;
+
+    // NaN ends up as 0x80000000, like the cvttsd2si in the reference code
+    if (magnitude > 0x7f800000) {
+        return (SInt32) 0x80000000;
+    }
+    // Clip to -1.0 .. 1.0, which scale to exactly INT_MIN and INT_MAX
+    if (magnitude >= 0x3f800000) {
+        return (bits & 0x80000000) ? (SInt32) 0x80000000 : 0x7fffffff;
+    }
+    if (magnitude == 0) {
+        return 0;
+    }
+
+    // The sample is mantissa * 2^-shift, shift is at least 24 from here on
+    mantissa = magnitude & 0x7fffff;
+    if (magnitude >> 23) {
+        mantissa |= 0x800000;
+        shift = 150 - (magnitude >> 23);
+    } else {
+        shift = 149;
+    }
+
+    if (bits & 0x80000000) {
+        // Scaling by INT_MIN = 2^31 is exact, only the truncation is left
+        if (shift >= 31 + 24) {
+            return 0;
+        }
+        return (SInt32) (0U - (UInt32) (shift >= 31 ? mantissa >> (shift - 31) : mantissa << (31 - shift)));
+    } else {
+        // The 55 bit product with INT_MAX gets rounded to a double before truncating
+        if (shift >= 64) {
+            return 0;
+        }
+        return (SInt32) (RoundToBits(mantissa * 0x7fffffffULL, 53) >> shift);
+    }
+}
+
+static inline UInt32 ConvertSampleBits(SInt32 inputSample)
+{
+    if (inputSample == 0) {
+        return 0;
+    }
+
+    if (inputSample < 0) {
+        // INT_MINDIV is 2^-31, so the only rounding is the one to float
+        return 0x80000000 | MakeFloatBits(RoundToBits(0U - (UInt32) inputSample, 24), -31);
+    } else {
+        // INT_MAXDIV rounds to (2^31 + 1) * 2^-62 as a double. The product is rounded to a double
+        // first and then to a float.
+        UInt64 product = RoundToBits((UInt64) inputSample * 0x80000001ULL, 53);
+
+        return MakeFloatBits(RoundToBits(product, 24), -62);
+    }
+}
+
+// Multiplies the sample by the (positive, at most unity) gain the way the FPU does. Results that
+// would be denormal are flushed to zero, they clip to 0 either way.
+static inline UInt32 ScaleSampleBits(UInt32 bits, UInt32 gainBits)
+{
+    UInt32 sign = bits & 0x80000000;
+    UInt32 exponent = (bits >> 23) & 0xff;
+    UInt32 gainExponent = gainBits >> 23;
+    UInt64 product;
+    SInt32 top;
+
+    if (gainBits == 0x3f800000) {
+        return bits;
+    }
+    // Inf and NaN stay what they are, except for inf * 0
+    if (exponent == 0xff) {
+        return gainExponent ? bits : 0x7fc00000;
+    }
+    if (exponent == 0 || gainExponent == 0) {
+        return sign;
+    }
+
+    // The 48 bit product of the mantissas, times 2^(exponent + gainExponent - 254 - 46)
+    product = RoundToBits((UInt64) ((bits & 0x7fffff) | 0x800000) * ((gainBits & 0x7fffff) | 0x800000), 24);
+    top = 63 - __builtin_clzll(product);
+    if (top + (SInt32) (exponent + gainExponent) - 254 - 46 + 127 <= 0) {
+        return sign;
+    }
+    return sign | MakeFloatBits(product, (SInt32) (exponent + gainExponent) - 254 - 46);
+}
+
+template <UInt32 N, UInt32 Dither>
+static void ClipFrames_Integer(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                               ClipKernelState *state)
+{
+    const UInt32 *mixBits = (const UInt32 *) mixBuf + firstSampleFrame * N;
+    UInt32 gainBits[N], peakBits[N], overs[N];
+    UInt64 squares[N];
+
+    sampleBuf += firstSampleFrame * N;
+    spdifBuf += firstSampleFrame * 2;
+
+    // No ramps without the FPU, a new gain takes effect at once
+    if (state->rampRequest != state->rampStarted) {
+        state->rampStarted = state->rampRequest;
+        __builtin_memcpy(state->gain, state->targetGain, sizeof(state->gain));
+    }
+    __builtin_memcpy(gainBits, state->gain, sizeof(gainBits));
+    __builtin_memcpy(peakBits, state->meter.peak, sizeof(peakBits));
+    for (UInt32 channel = 0; channel < N; channel++) {
+        squares[channel] = 0;
+        overs[channel] = 0;
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            UInt32 bits = ScaleSampleBits(mixBits[channel], gainBits[channel]);
+            UInt32 magnitude = bits & 0x7fffffff;
+            SInt32 high;
+
+            // Positive floats compare like their bits, NaNs are left out like in MeterSample()
+            if (magnitude > peakBits[channel] && magnitude <= 0x7f800000) {
+                peakBits[channel] = magnitude;
+            }
+            overs[channel] += (magnitude > 0x3f800000);
+            sampleBuf[channel] = ClipSampleBits(bits);
+            high = sampleBuf[channel] >> 16;
+            squares[channel] += (UInt32) (high * high);
+
+            if (Dither != kClipDitherNone) {
+                state->random[channel] = NextRandom(state->random[channel]);
+                sampleBuf[channel] = DitherSample<Dither>(sampleBuf[channel], TriangularDither(state->random[channel]), &state->error[channel]);
+            }
+        }
+
+        spdifBuf[0] = sampleBuf[0];
+        spdifBuf[1] = sampleBuf[1];
+
+        mixBits += N;
+        sampleBuf += N;
+        spdifBuf += 2;
+    }
+
+    __builtin_memcpy(state->meter.peak, peakBits, sizeof(peakBits));
+    for (UInt32 channel = 0; channel < N; channel++) {
+        state->meter.squaresFixed[channel] += squares[channel];
+        state->meter.overs[channel] += overs[channel];
+    }
+}
+
+// Only a pair of slots, which is the same as clipping them
+template <UInt32 N>
+static void SpdifFrames_Integer(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const UInt32 *mixBits = (const UInt32 *) mixBuf;
+    UInt32 left = state->spdif.source[0], right = state->spdif.source[1];
+    UInt32 gainBits[N];
+
+    __builtin_memcpy(gainBits, state->gain, sizeof(gainBits));
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        spdifBuf[0] = ClipSampleBits(ScaleSampleBits(mixBits[left], gainBits[left]));
+        spdifBuf[1] = ClipSampleBits(ScaleSampleBits(mixBits[right], gainBits[right]));
+
+        mixBits += N;
+        spdifBuf += 2;
+    }
+}
+
+static void ConvertSInt32ToFloat_Integer(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels, ClipMeterState *meter)
+{
+    UInt32 *destBits = (UInt32 *) destBuf;
+    UInt32 peakBits[CLIP_KERNEL_MAX_CHANNELS], overs[CLIP_KERNEL_MAX_CHANNELS];
+    UInt64 squares[CLIP_KERNEL_MAX_CHANNELS];
+    UInt32 channel = 0;
+
+    if (numChannels - 1 >= CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = 1;
+    }
+    for (channel = 0; channel < numChannels; channel++) {
+        peakBits[channel] = 0;
+        if (meter) {
+            __builtin_memcpy(&peakBits[channel], &meter->peak[channel], sizeof(peakBits[0]));
+        }
+        squares[channel] = 0;
+        overs[channel] = 0;
+    }
+
+    channel = 0;
+    for (UInt32 i = 0; i < numSamples; i++) {
+        SInt32 high = sampleBuf[i] >> 16;
+
+        destBits[i] = ConvertSampleBits(sampleBuf[i]);
+
+        // The converted samples are never NaN
+        if ((destBits[i] & 0x7fffffff) > peakBits[channel]) {
+            peakBits[channel] = destBits[i] & 0x7fffffff;
+        }
+        squares[channel] += (UInt32) (high * high);
+        overs[channel] += InputOver(sampleBuf[i]);
+        if (++channel == numChannels) {
+            channel = 0;
+        }
+    }
+
+    for (channel = 0; channel < numChannels && meter; channel++) {
+        __builtin_memcpy(&meter->peak[channel], &peakBits[channel], sizeof(peakBits[0]));
+        meter->squaresFixed[channel] += squares[channel];
+        meter->overs[channel] += overs[channel];
+    }
+}
+
+// Clears the mix buffer, the DMA buffer and the S/PDIF pairs in one pass. Channel counts are
+// always even, so everything can be cleared a stereo pair at a time.
+template <UInt32 N>
+static void EraseFrames(float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames)
+{
+    UInt64 *mixPairs = mixBuf ? (UInt64 *) &mixBuf[firstSampleFrame * N] : NULL;
+    UInt64 *samplePairs = (UInt64 *) &sampleBuf[firstSampleFrame * N];
+    UInt64 *spdifPairs = spdifBuf ? (UInt64 *) &spdifBuf[firstSampleFrame * 2] : NULL;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 pair = 0; pair < N / 2; pair++) {
+            samplePairs[pair] = 0;
+            if (mixPairs) {
+                mixPairs[pair] = 0;
+            }
+        }
+        if (spdifPairs) {
+            spdifPairs[frame] = 0;
+        }
+
+        samplePairs += N / 2;
+        if (mixPairs) {
+            mixPairs += N / 2;
+        }
+    }
+}
+
+// Copies one stereo pair of every frame from the DMA buffer to the S/PDIF buffer, for the
+// non-mixable formats. The samples are only moved, so they stay bit exact.
+template <UInt32 N>
+static void MirrorFrames(const SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 pair, UInt32 firstSampleFrame, UInt32 numSampleFrames)
+{
+    const UInt64 *samplePairs = (const UInt64 *) &sampleBuf[firstSampleFrame * N] + pair;
+    UInt64 *spdifPairs = (UInt64 *) &spdifBuf[firstSampleFrame * 2];
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        spdifPairs[frame] = samplePairs[frame * (N / 2)];
+    }
+}
+
+// Copies the first of every ratio frames of the oversampled DMA buffer, a stereo pair at a time like
+// the mirror
+template <UInt32 N>
+static void PhaseFrames(const SInt32 *hardwareBuf, SInt32 *sampleBuf, UInt32 ratio, UInt32 numSampleFrames)
+{
+    const UInt64 *hardwarePairs = (const UInt64 *) hardwareBuf;
+    UInt64 *samplePairs = (UInt64 *) sampleBuf;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 pair = 0; pair < N / 2; pair++) {
+            samplePairs[pair] = hardwarePairs[pair];
+        }
+
+        samplePairs += N / 2;
+        hardwarePairs += ratio * (N / 2);
+    }
+}
+
+// Tells whether all of the samples are 0.0 or -0.0, both clip to 0. Only the bits are looked
+// at, so the integer kernels use it too. Silence has to be read all the way through, so four
+// samples are tested at once.
+static bool ScanSilence_Scalar(const float *mixBuf, UInt32 numSamples)
+{
+    const UInt32 *mixBits = (const UInt32 *) mixBuf;
+    UInt32 i = 0;
+
+    for (; i + 4 <= numSamples; i += 4) {
+        if ((mixBits[i] | mixBits[i + 1] | mixBits[i + 2] | mixBits[i + 3]) << 1) {
+            return false;
+        }
+    }
+    for (; i < numSamples; i++) {
+        if (mixBits[i] << 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Routing. Permutations only move the sample bits around, the matrix sums up the mix channels
+// that feed a slot in the order of route->column, which the SIMD kernels follow so their output is
+// bit-identical (no FMA either, it would round differently).
+template <UInt32 N>
+static inline __attribute__((always_inline)) void PermuteFrames(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, const ClipRouteTable *route)
+{
+    UInt32 source[N];
+
+    for (UInt32 slot = 0; slot < N; slot++) {
+        source[slot] = route->source[slot];
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 slot = 0; slot < N; slot++) {
+            ((UInt32 *) destBuf)[slot] = ((const UInt32 *) mixBuf)[source[slot]];
+        }
+
+        mixBuf += N;
+        destBuf += N;
+    }
+}
+
+template <UInt32 N>
+static void RouteFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipRouteTable *route = &state->route;
+
+    if (route->mode != kClipRouteMatrix) {
+        PermuteFrames<N>(mixBuf, destBuf, numSampleFrames, route);
+        return;
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 slot = 0; slot < N; slot++) {
+            float sum = 0.0f;
+
+            for (UInt32 k = 0; k < route->numColumns; k++) {
+                sum = sum + mixBuf[route->column[k]] * route->matrix[route->column[k]][slot];
+            }
+            destBuf[slot] = sum;
+        }
+
+        mixBuf += N;
+        destBuf += N;
+    }
+}
+
+// The S/PDIF feed. Every side sums up its slots in the order of spdif->column, like the routing
+// matrix, and is clipped like the DMA samples. The software volume is folded into the coefficients
+// once per chunk, so it follows a ramp in steps of CLIP_STAGE_FRAMES. A coefficient of 1.0 gives
+// the same samples as the undithered DMA slot.
+static inline void SpdifCoefficients(const ClipKernelState *state, float coef[CLIP_KERNEL_MAX_CHANNELS][2])
+{
+    for (UInt32 k = 0; k < state->spdif.numColumns; k++) {
+        UInt32 channel = state->spdif.column[k];
+
+        coef[k][0] = state->spdif.matrix[channel][0] * state->gain[channel];
+        coef[k][1] = state->spdif.matrix[channel][1] * state->gain[channel];
+    }
+}
+
+template <UInt32 N>
+static inline __attribute__((always_inline)) void SumSpdifFrames(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames,
+                                                                 const ClipRouteTable *spdif, const float coef[CLIP_KERNEL_MAX_CHANNELS][2])
+{
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        float left = 0.0f, right = 0.0f;
+
+        for (UInt32 k = 0; k < spdif->numColumns; k++) {
+            left = left + mixBuf[spdif->column[k]] * coef[k][0];
+            right = right + mixBuf[spdif->column[k]] * coef[k][1];
+        }
+        spdifBuf[0] = ClipSample(left);
+        spdifBuf[1] = ClipSample(right);
+
+        mixBuf += N;
+        spdifBuf += 2;
+    }
+}
+
+template <UInt32 N>
+static void SpdifFrames_Scalar(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    float coef[CLIP_KERNEL_MAX_CHANNELS][2];
+
+    SpdifCoefficients(state, coef);
+    SumSpdifFrames<N>(mixBuf, spdifBuf, numSampleFrames, &state->spdif, coef);
+}
+
+#ifdef ENVY24HT_SIMD
+
+// The DMA buffers are only ever read by the card, so the streaming kernels write them with non
+// temporal stores that bypass the cache instead of evicting the mix buffer and everything else.
+// These need aligned addresses.
+#if defined(__clang__)
+template <typename V>
+static inline __attribute__((always_inline)) void StoreStreaming(void *p, const V &v)
+{
+    __builtin_nontemporal_store(v, (V *) p);
+}
+#else
+template <typename V>
+static inline __attribute__((always_inline)) void StoreStreaming(void *p, const V &v);
+
+template <>
+inline __attribute__((always_inline)) void StoreStreaming<v4si>(void *p, const v4si &v)
+{
+    __asm__("movntdq %1, %0" : "=m" (*(v4si *) p) : "x" (v));
+}
+
+template <>
+inline __attribute__((always_inline)) void StoreStreaming<v8si>(void *p, const v8si &v)
+{
+    __asm__("vmovntdq %1, %0" : "=m" (*(v8si *) p) : "x" (v));
+}
+
+template <>
+inline __attribute__((always_inline)) void StoreStreaming<UInt64>(void *p, const UInt64 &v)
+{
+    __asm__("movnti %1, %0" : "=m" (*(UInt64 *) p) : "r" (v));
+}
+#endif
+
+// Non temporal stores are weakly ordered, this makes them visible before the engine moves on
+static inline __attribute__((always_inline)) void StoreFence()
+{
+    __asm__ __volatile__("sfence" : : : "memory");
+}
+
+// The vector code only uses the generic vector extensions, so the shared template below picks
+// up the instruction set of the (target attributed) function it gets inlined into.
+//
+// The clamp is done with compare and select. A NaN fails both compares against -1.0 and ends up
+// as -1.0, which converts to the same 0x80000000 the scalar cvttsd2si produces.
+// The scale is picked without a branch: INT_MAX, plus 1.0 for the negative lanes (= INT_MIN).
+template <typename VF, typename VI>
+static inline __attribute__((always_inline)) VF ClampSamples(const VF &in)
+{
+    const VF one = (VF) {} + 1.0f;
+
+    VI notBelow = (VI) (in >= -one);
+    VF x = (VF) (((VI) in & notBelow) | ((VI) -one & ~notBelow));
+    VI above = (VI) (x > one);
+    return (VF) (((VI) x & ~above) | ((VI) one & above));
+}
+
+template <typename VF, typename VI, typename VD, typename VL>
+static inline __attribute__((always_inline)) VI ScaleClamped(const VF &x)
+{
+    const VD intMax = (VD) {} + INT_MAX;
+    const VD oneD = (VD) {} + 1.0;
+
+    VD d = __builtin_convertvector(x, VD);
+    VD scale = intMax + (VD) ((VL) oneD & (VL) (d < (VD) {}));
+
+    return __builtin_convertvector(d * scale, VI);
+}
+
+template <typename VF, typename VI, typename VD, typename VL>
+static inline __attribute__((always_inline)) VI ClipScale(const VF &x)
+{
+    return ScaleClamped<VF, VI, VD, VL>(ClampSamples<VF, VI>(x));
+}
+
+// The block loops below have constant trip counts and have to be unrolled completely, so that the
+// S/PDIF lanes become constants
+#if defined(__clang__)
+	#define UNROLL_FULL _Pragma("clang loop unroll(full)")
+#else
+	#define UNROLL_FULL _Pragma("GCC unroll 24")
+#endif
+
+template <UInt32 A, UInt32 B> struct Gcd { enum { value = Gcd<B, A % B>::value }; };
+template <UInt32 A> struct Gcd<A, 0> { enum { value = A }; };
+
+// Clips and converts in blocks of whole frames that are also a whole number of W sample vectors
+// (1 frame for 8 channels, 2 or 4 frames for 6 channels, W / 2 frames for 2 channels). Since the
+// block layout is known at compile time, the S/PDIF pairs are extracted from constant lanes of
+// the converted vectors while they're still in registers and the DMA buffer is never read back.
+// The meters are kept per lane and only summed up per channel at the end.
+// Returns the number of frames done, the caller does the remainder.
+template <UInt32 N, typename VF, typename VI, typename VU, typename VD, typename VL, UInt32 W, bool Streaming, UInt32 Dither, bool Ramp>
+static inline __attribute__((always_inline)) UInt32 ClipBlocks(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 numSampleFrames,
+                                                               ClipKernelState *state)
+{
+    enum {
+        kBlockSamples = N / Gcd<N, W>::value * W,
+        kBlockFrames = kBlockSamples / N,
+        kBlockVectors = kBlockSamples / W,
+        kPrefetchSamples = 1024 / sizeof(float) // a few blocks ahead of the hardware prefetcher
+    };
+    const VI ditherMax = (VI) {} + DITHER_MAX;
+    const VI ditherMin = (VI) {} + DITHER_MIN;
+    const VF one = (VF) {} + 1.0f;
+    VF gain[kBlockVectors], blockMul[kBlockVectors], blockAdd[kBlockVectors];
+    VF peak[kBlockVectors], squares[kBlockVectors];
+    VI overs[kBlockVectors];
+    VU random = {};
+    SInt32 error[N];
+    UInt32 frame = 0;
+
+    // The channel gains laid out like the samples of a block. When ramping, every lane starts as
+    // many frames into the ramp as its frame is into the block, and moves a whole block per step.
+    for (UInt32 v = 0; v < kBlockVectors; v++) {
+        for (UInt32 lane = 0; lane < W; lane++) {
+            UInt32 channel = (v * W + lane) % N;
+            float channelGain = state->gain[channel];
+
+            if (Ramp) {
+                double mul = 1.0, add = 0.0;
+
+                for (UInt32 k = 0; k < (v * W + lane) / N; k++) {
+                    channelGain = channelGain * state->rampMul[channel] + state->rampAdd[channel];
+                }
+                for (UInt32 k = 0; k < kBlockFrames; k++) {
+                    add = add * state->rampMul[channel] + state->rampAdd[channel];
+                    mul *= state->rampMul[channel];
+                }
+                blockMul[v][lane] = (float) mul;
+                blockAdd[v][lane] = (float) add;
+            }
+            gain[v][lane] = channelGain;
+        }
+        peak[v] = (VF) {};
+        squares[v] = (VF) {};
+        overs[v] = (VI) {};
+    }
+
+    // The generators run one per lane. The shaper's errors stay per channel.
+    if (Dither != kClipDitherNone) {
+        random = LoadUnaligned<VU>(state->random);
+        for (UInt32 channel = 0; channel < N; channel++) {
+            error[channel] = state->error[channel];
+        }
+    }
+
+    for (; frame + kBlockFrames <= numSampleFrames; frame += kBlockFrames) {
+        if (Streaming) {
+            __builtin_prefetch(&mixBuf[kPrefetchSamples], 0, 3);
+        }
+
+        UNROLL_FULL
+        for (UInt32 v = 0; v < kBlockVectors; v++) {
+            VF sample = LoadUnaligned<VF>(&mixBuf[v * W]) * gain[v];
+            VF magnitude = Abs(sample);
+            VF clamped = ClampSamples<VF, VI>(sample);
+
+            // The overs are counted with a compare, the mask is -1 in the lanes that clip
+            peak[v] = Max(peak[v], magnitude);
+            squares[v] += clamped * clamped;
+            overs[v] -= ~(magnitude <= one);
+
+            VI x = ScaleClamped<VF, VI, VD, VL>(clamped);
+
+            if (Dither != kClipDitherNone) {
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+
+                VI dither = (VI) (random >> 25) - (VI) (random & (DITHER_LSB - 1));
+
+                if (Dither == kClipDitherTPDF) {
+                    x = ((x >> 1) + dither + DITHER_LSB / 2) & ~(DITHER_LSB - 1);
+
+                    VI over = x > ditherMax;
+                    x = (x & ~over) | (ditherMax & over);
+                    VI under = x < ditherMin;
+                    x = ((x & ~under) | (ditherMin & under)) * 2;
+                } else {
+                    // Each sample gets the error of the channel's previous sample, which can be in
+                    // the same vector, so the shaper itself runs lane by lane
+                    UNROLL_FULL
+                    for (UInt32 lane = 0; lane < W; lane++) {
+                        x[lane] = DitherSample<kClipDitherShaped>(x[lane], dither[lane], &error[(v * W + lane) % N]);
+                    }
+                }
+            }
+
+            if (Streaming) {
+                StoreStreaming<VI>(&sampleBuf[v * W], x);
+            } else {
+                StoreUnaligned<VI>(&sampleBuf[v * W], x);
+            }
+
+            // The frames starting within this vector
+            UNROLL_FULL
+            for (UInt32 start = (v * W + N - 1) / N * N; start < (v + 1) * W; start += N) {
+                if (Streaming) {
+                    StoreStreaming<UInt64>(&spdifBuf[start / N * 2],
+                                           (UInt32) x[start - v * W] | ((UInt64) (UInt32) x[start - v * W + 1] << 32));
+                } else {
+                    spdifBuf[start / N * 2] = x[start - v * W];
+                    spdifBuf[start / N * 2 + 1] = x[start - v * W + 1];
+                }
+            }
+        }
+
+        if (Ramp) {
+            UNROLL_FULL
+            for (UInt32 v = 0; v < kBlockVectors; v++) {
+                gain[v] = gain[v] * blockMul[v] + blockAdd[v];
+            }
+        }
+
+        mixBuf += kBlockSamples;
+        sampleBuf += kBlockSamples;
+        spdifBuf += kBlockFrames * 2;
+    }
+
+    if (Dither != kClipDitherNone) {
+        StoreUnaligned<VU>(state->random, random);
+        for (UInt32 channel = 0; channel < N; channel++) {
+            state->error[channel] = error[channel];
+        }
+    }
+
+    for (UInt32 v = 0; v < kBlockVectors; v++) {
+        for (UInt32 lane = 0; lane < W; lane++) {
+            UInt32 channel = (v * W + lane) % N;
+
+            state->meter.peak[channel] = Max(state->meter.peak[channel], peak[v][lane]);
+            state->meter.squares[channel] += squares[v][lane];
+            state->meter.overs[channel] += overs[v][lane];
+        }
+    }
+
+    // The first frame of the next block is where the remainder continues
+    if (Ramp) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            state->gain[channel] = gain[channel / W][channel % W];
+        }
+    }
+
+    return frame;
+}
+
+template <UInt32 N, typename VF, typename VI, typename VU, typename VD, typename VL, UInt32 W, bool Streaming, UInt32 Dither, bool Ramp>
+static inline __attribute__((always_inline)) void ClipFrames_SIMD(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                                                  ClipKernelState *state)
+{
+    UInt32 frame = 0;
+
+    mixBuf += firstSampleFrame * N;
+    sampleBuf += firstSampleFrame * N;
+    spdifBuf += firstSampleFrame * 2;
+
+    if (Streaming) {
+        // Do the frames before the first vector aligned one in the DMA buffer the normal way. The
+        // DMA buffers are 512 byte aligned, so there are less than W of them. Unaligned buffers
+        // (only the self test has those) just get the normal stores.
+        UInt32 head = 0;
+
+        while (head < W && head < numSampleFrames && ((unsigned long) &sampleBuf[head * N] & (sizeof(VI) - 1))) {
+            head++;
+        }
+
+        if (((unsigned long) &sampleBuf[head * N] & (sizeof(VI) - 1)) == 0) {
+            ClipFrames_Scalar<N, Dither, Ramp>(mixBuf, sampleBuf, spdifBuf, 0, head, state);
+            frame = head + ClipBlocks<N, VF, VI, VU, VD, VL, W, true, Dither, Ramp>(&mixBuf[head * N], &sampleBuf[head * N], &spdifBuf[head * 2],
+                                                                              numSampleFrames - head, state);
+            StoreFence();
+        } else {
+            frame = ClipBlocks<N, VF, VI, VU, VD, VL, W, false, Dither, Ramp>(mixBuf, sampleBuf, spdifBuf, numSampleFrames, state);
+        }
+    } else {
+        frame = ClipBlocks<N, VF, VI, VU, VD, VL, W, false, Dither, Ramp>(mixBuf, sampleBuf, spdifBuf, numSampleFrames, state);
+    }
+
+    ClipFrames_Scalar<N, Dither, Ramp>(&mixBuf[frame * N], &sampleBuf[frame * N], &spdifBuf[frame * 2], 0, numSampleFrames - frame, state);
+}
+
+// Same trick in the other direction: one multiply in double precision with the scale selected per
+// lane (INT_MINDIV for negative samples), then rounded to float just like the scalar assignment.
+template <typename VF, typename VI, typename VD, typename VL>
+static inline __attribute__((always_inline)) VF ConvertScale(const VI &x)
+{
+    const VD maxDiv = (VD) {} + INT_MAXDIV;
+    const VD minDiv = (VD) {} + INT_MINDIV;
+
+    VD d = __builtin_convertvector(x, VD);
+    VL negative = (VL) (d < (VD) {});
+    VD scale = (VD) (((VL) maxDiv & ~negative) | ((VL) minDiv & negative));
+
+    return __builtin_convertvector(d * scale, VF);
+}
+
+// The meters are kept per lane, which works as long as every lane stays with one channel. Other
+// channel counts (no card has them) are left to the scalar kernel.
+template <typename VF, typename VI, typename VD, typename VL, UInt32 W>
+static inline __attribute__((always_inline)) void ConvertSamples(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels,
+                                                                 ClipMeterState *meter)
+{
+    const VI overLevel = (VI) {} + CLIP_INPUT_OVER_LEVEL;
+    VF peakA = {}, peakB = {}, squaresA = {}, squaresB = {};
+    VI oversA = {}, oversB = {};
+    UInt32 i = 0;
+
+    if (numChannels - 1 >= CLIP_KERNEL_MAX_CHANNELS || (2 * W) % numChannels) {
+        ConvertSInt32ToFloat_Scalar(sampleBuf, destBuf, numSamples, numChannels, meter);
+        return;
+    }
+
+    for (; i + 2 * W <= numSamples; i += 2 * W) {
+        VI x = LoadUnaligned<VI>(&sampleBuf[i]);
+        VI y = LoadUnaligned<VI>(&sampleBuf[i + W]);
+        VF a = ConvertScale<VF, VI, VD, VL>(x);
+        VF b = ConvertScale<VF, VI, VD, VL>(y);
+
+        StoreUnaligned<VF>(&destBuf[i], a);
+        StoreUnaligned<VF>(&destBuf[i + W], b);
+
+        peakA = Max(peakA, Abs(a));
+        peakB = Max(peakB, Abs(b));
+        squaresA += a * a;
+        squaresB += b * b;
+        oversA -= (x >= overLevel) | (x <= -overLevel);
+        oversB -= (y >= overLevel) | (y <= -overLevel);
+    }
+
+    for (UInt32 lane = 0; lane < W && meter; lane++) {
+        UInt32 channel = lane % numChannels;
+
+        meter->peak[channel] = Max(meter->peak[channel], Max(peakA[lane], peakB[lane]));
+        meter->squares[channel] += squaresA[lane] + squaresB[lane];
+        meter->overs[channel] += oversA[lane] + oversB[lane];
+    }
+
+    ConvertSInt32ToFloat_Scalar(&sampleBuf[i], &destBuf[i], numSamples - i, numChannels, meter);
+}
+
+template <UInt32 N, bool Streaming, UInt32 Dither, bool Ramp>
+static void ClipFrames_SSE2(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                            ClipKernelState *state)
+{
+    ClipFrames_SIMD<N, v4sf, v4si, v4su, v4df, v4di, 4, Streaming, Dither, Ramp>(mixBuf, sampleBuf, spdifBuf, firstSampleFrame, numSampleFrames, state);
+}
+
+template <UInt32 N, bool Streaming, UInt32 Dither, bool Ramp>
+static __attribute__((target("avx2"))) void ClipFrames_AVX2(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                                            ClipKernelState *state)
+{
+    ClipFrames_SIMD<N, v8sf, v8si, v8su, v8df, v8di, 8, Streaming, Dither, Ramp>(mixBuf, sampleBuf, spdifBuf, firstSampleFrame, numSampleFrames, state);
+}
+
+template <UInt32 N, bool Streaming, UInt32 Dither>
+static void ClipFramesRamped_SSE2(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                  ClipKernelState *state)
+{
+    RunGainRamp(ClipFrames_SSE2<N, Streaming, Dither, false>, ClipFrames_SSE2<N, Streaming, Dither, true>,
+                mixBuf, sampleBuf, spdifBuf, firstSampleFrame, numSampleFrames, state);
+}
+
+template <UInt32 N, bool Streaming, UInt32 Dither>
+static void ClipFramesRamped_AVX2(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                  ClipKernelState *state)
+{
+    RunGainRamp(ClipFrames_AVX2<N, Streaming, Dither, false>, ClipFrames_AVX2<N, Streaming, Dither, true>,
+                mixBuf, sampleBuf, spdifBuf, firstSampleFrame, numSampleFrames, state);
+}
+
+void ConvertSInt32ToFloat_SSE2(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels, ClipMeterState *meter)
+{
+    ConvertSamples<v4sf, v4si, v4df, v4di, 4>(sampleBuf, destBuf, numSamples, numChannels, meter);
+}
+
+__attribute__((target("avx2"))) void ConvertSInt32ToFloat_AVX2(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels,
+                                                               ClipMeterState *meter)
+{
+    ConvertSamples<v8sf, v8si, v8df, v8di, 8>(sampleBuf, destBuf, numSamples, numChannels, meter);
+}
+
+// Four vectors (a cache line, two with AVX2) are ORed together and only the sign bits are masked
+// off, then the two or four 64 bit halves. The first block with sound in it ends the scan, so a
+// buffer that isn't silent costs next to nothing.
+template <typename VU, typename VQ, UInt32 W>
+static inline __attribute__((always_inline)) bool ScanSilence_SIMD(const float *mixBuf, UInt32 numSamples)
+{
+    const VU magnitude = (VU) {} + 0x7fffffff;
+    UInt32 i = 0;
+
+    for (; i + 4 * W <= numSamples; i += 4 * W) {
+        VQ bits = (VQ) ((LoadUnaligned<VU>(&mixBuf[i]) | LoadUnaligned<VU>(&mixBuf[i + W]) |
+                         LoadUnaligned<VU>(&mixBuf[i + 2 * W]) | LoadUnaligned<VU>(&mixBuf[i + 3 * W])) & magnitude);
+        UInt64 any = 0;
+
+        for (UInt32 half = 0; half < W / 2; half++) {
+            any |= bits[half];
+        }
+        if (any) {
+            return false;
+        }
+    }
+
+    return ScanSilence_Scalar(&mixBuf[i], numSamples - i);
+}
+
+static bool ScanSilence_SSE2(const float *mixBuf, UInt32 numSamples)
+{
+    return ScanSilence_SIMD<v4su, v2du, 4>(mixBuf, numSamples);
+}
+
+static __attribute__((target("avx2"))) bool ScanSilence_AVX2(const float *mixBuf, UInt32 numSamples)
+{
+    return ScanSilence_SIMD<v8su, v4du, 8>(mixBuf, numSamples);
+}
+
+// The matrix works on a frame per vector, like the limiter: every mix channel that feeds anything
+// gets broadcast and multiplied with its column of slot gains
+template <UInt32 N, typename VF>
+static inline __attribute__((always_inline)) void MatrixFrames_SIMD(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, const ClipRouteTable *route)
+{
+    const UInt32 numColumns = route->numColumns;
+    VF column[CLIP_KERNEL_MAX_CHANNELS];
+
+    for (UInt32 k = 0; k < numColumns; k++) {
+        column[k] = (VF) {};
+        __builtin_memcpy(&column[k], route->matrix[route->column[k]], N * sizeof(float));
+    }
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        VF out = {};
+
+        for (UInt32 k = 0; k < numColumns; k++) {
+            out = out + ((VF) {} + mixBuf[route->column[k]]) * column[k];
+        }
+        __builtin_memcpy(destBuf, &out, N * sizeof(float));
+
+        mixBuf += N;
+        destBuf += N;
+    }
+}
+
+// A slot of consecutive frames, every sample twice: { a, a, b, b, ... }. Built with shuffles, lane
+// by lane the compiler goes through memory and stalls on the store forwarding.
+static inline __attribute__((always_inline)) v4sf SlotPairs(const float *slot, UInt32 stride, const v4sf &)
+{
+    return __builtin_shufflevector((v4sf) {} + slot[0], (v4sf) {} + slot[stride], 0, 1, 4, 5);
+}
+
+static inline __attribute__((always_inline)) v8sf SlotPairs(const float *slot, UInt32 stride, const v8sf &)
+{
+    v4sf low = SlotPairs(slot, stride, v4sf()), high = SlotPairs(&slot[2 * stride], stride, v4sf());
+
+    return __builtin_shufflevector(low, high, 0, 1, 2, 3, 4, 5, 6, 7);
+}
+
+// The S/PDIF feed with W / 2 frames per vector, left and right interleaved like in the buffer. Every
+// slot that feeds it is picked up for those frames and multiplied with its pair of coefficients.
+template <UInt32 N, typename VF, typename VI, typename VD, typename VL, UInt32 W>
+static inline __attribute__((always_inline)) void SpdifFrames_SIMD(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipRouteTable *spdif = &state->spdif;
+    const UInt32 numColumns = spdif->numColumns;
+    float coef[CLIP_KERNEL_MAX_CHANNELS][2];
+    VF coefVector[CLIP_KERNEL_MAX_CHANNELS];
+    UInt32 frame = 0;
+
+    SpdifCoefficients(state, coef);
+    for (UInt32 k = 0; k < numColumns; k++) {
+        for (UInt32 lane = 0; lane < W; lane++) {
+            coefVector[k][lane] = coef[k][lane & 1];
+        }
+    }
+
+    for (; frame + W / 2 <= numSampleFrames; frame += W / 2) {
+        VF out = {};
+
+        for (UInt32 k = 0; k < numColumns; k++) {
+            out = out + SlotPairs(&mixBuf[frame * N + spdif->column[k]], N, out) * coefVector[k];
+        }
+        StoreUnaligned<VI>(&spdifBuf[frame * 2], ClipScale<VF, VI, VD, VL>(out));
+    }
+
+    SumSpdifFrames<N>(&mixBuf[frame * N], &spdifBuf[frame * 2], numSampleFrames - frame, spdif, coef);
+}
+
+template <UInt32 N>
+static void SpdifFrames_SSE2(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    SpdifFrames_SIMD<N, v4sf, v4si, v4df, v4di, 4>(mixBuf, spdifBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void SpdifFrames_AVX2(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    SpdifFrames_SIMD<N, v8sf, v8si, v8df, v8di, 8>(mixBuf, spdifBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static void RouteFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    // SSE2 has no variable shuffle, the permutations are moved a sample at a time
+    if (state->route.mode != kClipRouteMatrix) {
+        PermuteFrames<N>(mixBuf, destBuf, numSampleFrames, &state->route);
+        return;
+    }
+
+    MatrixFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, &state->route);
+}
+
+// AVX2 permutes a whole frame with one vpermps. The frames are loaded 8 wide, which for 6 channels
+// reaches into the next frame, so the last one is left to the scalar loop.
+template <UInt32 N>
+static inline __attribute__((always_inline, target("avx2"))) void PermuteFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames,
+                                                                                     const ClipRouteTable *route)
+{
+    UInt32 wide = (N < 8 && numSampleFrames > 0) ? numSampleFrames - 1 : numSampleFrames;
+    v8si index = {};
+
+    if (N == 2) {
+        PermuteFrames<N>(mixBuf, destBuf, numSampleFrames, route);
+        return;
+    }
+
+    for (UInt32 slot = 0; slot < N; slot++) {
+        index[slot] = route->source[slot];
+    }
+
+    for (UInt32 frame = 0; frame < wide; frame++) {
+        v8sf out = __builtin_ia32_permvarsf256(LoadUnaligned<v8sf>(mixBuf), index);
+
+        __builtin_memcpy(destBuf, &out, N * sizeof(float));
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    PermuteFrames<N>(mixBuf, destBuf, numSampleFrames - wide, route);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void RouteFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    if (state->route.mode != kClipRouteMatrix) {
+        PermuteFrames_AVX2<N>(mixBuf, destBuf, numSampleFrames, &state->route);
+        return;
+    }
+
+    MatrixFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, &state->route);
+}
+
+static inline void cpuid(UInt32 leaf, UInt32 subleaf, UInt32 *regs)
+{
+    __asm__ __volatile__("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3]) : "a" (leaf), "c" (subleaf));
+}
+
+static inline UInt64 xgetbv(UInt32 index)
+{
+    UInt32 lo, hi;
+
+    __asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (index));
+    return ((UInt64) hi << 32) | lo;
+}
+
+#endif /* ENVY24HT_SIMD */
+
+
+ClipKernelType DetectClipKernelType()
+{
+#if defined(ENVY24HT_INTEGER_CONVERSION)
+    return kClipKernelInteger;
+#elif defined(ENVY24HT_SIMD)
+    UInt32 regs[4];
+    UInt32 maxLeaf;
+
+    cpuid(0, 0, regs);
+    maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+
+    // AVX2 needs the CPU flag and the OS saving the ymm state (OSXSAVE + XCR0 bits 1 and 2)
+    if (maxLeaf >= 7 && (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && (xgetbv(0) & 0x6) == 0x6)
+    {
+        cpuid(7, 0, regs);
+        if (regs[1] & (1 << 5))
+        {
+            return kClipKernelAVX2;
+        }
+    }
+
+    // SSE2 is part of the x86_64 baseline
+    return kClipKernelSSE2;
+#else
+    return kClipKernelScalar;
+#endif
+}
+
+template <UInt32 N, UInt32 Dither>
+static ClipKernelFunc GetClipKernelForDither(ClipKernelType type, bool streaming)
+{
+#ifndef ENVY24HT_SIMD
+    (void) streaming; // no streaming stores without SIMD
+#endif
+
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return ClipFrames_Integer<N, Dither>;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return streaming ? ClipFramesRamped_AVX2<N, true, Dither> : ClipFramesRamped_AVX2<N, false, Dither>;
+        case kClipKernelSSE2:
+            return streaming ? ClipFramesRamped_SSE2<N, true, Dither> : ClipFramesRamped_SSE2<N, false, Dither>;
+#endif
+        default:
+            return ClipFramesRamped_Scalar<N, Dither>;
+    }
+}
+
+template <UInt32 N>
+static ClipKernelFunc GetClipKernelForChannels(ClipKernelType type, bool streaming, ClipDitherMode dither)
+{
+    switch (dither)
+    {
+        case kClipDitherTPDF:
+            return GetClipKernelForDither<N, kClipDitherTPDF>(type, streaming);
+        case kClipDitherShaped:
+            return GetClipKernelForDither<N, kClipDitherShaped>(type, streaming);
+        default:
+            return GetClipKernelForDither<N, kClipDitherNone>(type, streaming);
+    }
+}
+
+ClipKernelFunc GetClipKernel(ClipKernelType type, UInt32 numChannels, bool streaming, ClipDitherMode dither)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipKernelForChannels<2>(type, streaming, dither);
+        case 6:
+            return GetClipKernelForChannels<6>(type, streaming, dither);
+        case 8:
+            return GetClipKernelForChannels<8>(type, streaming, dither);
+        default:
+            return NULL;
+    }
+}
+
+template <UInt32 N>
+static ClipRouteFunc GetClipRouteForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return RouteFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return RouteFrames_SSE2<N>;
+#endif
+        default:
+            return RouteFrames_Scalar<N>;
+    }
+}
+
+ClipRouteFunc GetClipRoute(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipRouteForChannels<2>(type);
+        case 6:
+            return GetClipRouteForChannels<6>(type);
+        case 8:
+            return GetClipRouteForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+template <UInt32 N>
+static SpdifKernelFunc GetSpdifKernelForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return SpdifFrames_Integer<N>;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return SpdifFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return SpdifFrames_SSE2<N>;
+#endif
+        default:
+            return SpdifFrames_Scalar<N>;
+    }
+}
+
+SpdifKernelFunc GetSpdifKernel(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetSpdifKernelForChannels<2>(type);
+        case 6:
+            return GetSpdifKernelForChannels<6>(type);
+        case 8:
+            return GetSpdifKernelForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+EraseKernelFunc GetEraseKernel(UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return EraseFrames<2>;
+        case 6:
+            return EraseFrames<6>;
+        case 8:
+            return EraseFrames<8>;
+        default:
+            return NULL;
+    }
+}
+
+MirrorKernelFunc GetMirrorKernel(UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return MirrorFrames<2>;
+        case 6:
+            return MirrorFrames<6>;
+        case 8:
+            return MirrorFrames<8>;
+        default:
+            return NULL;
+    }
+}
+
+PhaseKernelFunc GetPhaseKernel(UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return PhaseFrames<2>;
+        case 6:
+            return PhaseFrames<6>;
+        case 8:
+            return PhaseFrames<8>;
+        default:
+            return NULL;
+    }
+}
+
+SilenceKernelFunc GetSilenceKernel(ClipKernelType type)
+{
+    switch (type)
+    {
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return ScanSilence_AVX2;
+        case kClipKernelSSE2:
+            return ScanSilence_SSE2;
+#endif
+        default:
+            return ScanSilence_Scalar;
+    }
+}
+
+ConvertKernelFunc GetConvertKernel(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return ConvertSInt32ToFloat_Integer;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return ConvertSInt32ToFloat_AVX2;
+        case kClipKernelSSE2:
+            return ConvertSInt32ToFloat_SSE2;
+#endif
+        default:
+            return ConvertSInt32ToFloat_Scalar;
+    }
+}
+
+void InitClipKernelState(ClipKernelState *state)
+{
+    UInt32 seed = 0x2545f491;
+
+    state->rampRequest = 0;
+
+    // xorshift32 needs a non-zero seed, every lane gets a different one
+    for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+    {
+        seed = NextRandom(seed);
+        state->random[i] = seed;
+        state->error[i] = 0;
+        SetClipGain(state, i, CLIP_GAIN_MAX);
+        state->gain[i] = state->targetGain[i];
+        state->rampMul[i] = 1.0f;
+        state->rampAdd[i] = 0.0f;
+    }
+    state->rampFrames = 0;
+    state->rampSetRequest = 0;
+    state->rampSetApplied = 0;
+    state->ramp.frames = 0;
+    state->ramp.shape = kClipRampOff;
+    state->rampStarted = state->rampRequest;
+
+    // Straight through, the S/PDIF output with the first pair
+    state->routeRequest = 0;
+    state->routeApplied = 0;
+    state->route.mode = kClipRouteIdentity;
+    state->route.numColumns = 0;
+    state->spdifRequest = 0;
+    state->spdifApplied = 0;
+    state->spdif.mode = kClipRouteIdentity;
+    state->spdif.numColumns = 0;
+    for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+    {
+        state->route.source[i] = i;
+        state->spdif.source[i] = (i < 2) ? i : 0;
+    }
+
+    // No bass management
+    state->bassRequest = 0;
+    state->bassApplied = 0;
+    state->bass.frequency = 0;
+    state->bassTable.on = 0;
+    __builtin_memset(state->bassState, 0, sizeof(state->bassState));
+
+    // No EQ
+    state->eqRequest = 0;
+    state->eqApplied = 0;
+    state->eq.numSections = 0;
+    __builtin_memset(state->eqState, 0, sizeof(state->eqState));
+
+    // No convolution until the engine sets one up
+    state->conv = NULL;
+
+    // No delays, nor lines for them
+    state->delayRequest = 0;
+    state->delayApplied = 0;
+    state->maxDelay = 0;
+    __builtin_memset(&state->delay, 0, sizeof(state->delay));
+    state->delayLines = NULL;
+
+    // Not oversampling
+    state->oversampleRequest = 0;
+    state->oversampleApplied = 0;
+    state->oversample.ratio = 1;
+    state->oversample.taps = CLIP_OVERSAMPLE_TAPS;
+    state->oversampleTable.ratio = 1;
+    state->oversampleTable.taps = CLIP_OVERSAMPLE_TAPS;
+    __builtin_memset(state->oversampleHistory, 0, sizeof(state->oversampleHistory));
+
+    InitClipMeters(&state->meter);
+    ResetClipStage(state);
+}
+
+#define GAIN_STEP 0xf1adf93dULL // 10^(-0.5 / 20) in 0.32 fixed point
+
+void SetClipGain(ClipKernelState *state, UInt32 channel, SInt32 level)
+{
+    UInt64 gain = 1ULL << 32;
+    UInt32 bits = 0;
+
+    if (channel >= CLIP_KERNEL_MAX_CHANNELS) {
+        return;
+    }
+
+    if (level > 0)
+    {
+        for (SInt32 step = (level < CLIP_GAIN_MAX) ? level : CLIP_GAIN_MAX; step < CLIP_GAIN_MAX; step++)
+        {
+            gain = (gain * GAIN_STEP + (1ULL << 31)) >> 32;
+        }
+        bits = MakeFloatBits(RoundToBits(gain, 24), -32);
+    }
+
+    // Stored as raw bits, the integer kernels read them that way too
+    __builtin_memcpy(&state->targetGain[channel], &bits, sizeof(bits));
+    state->rampRequest++;
+}
+
+// Between two bumps of its request count, like the tables below
+void SetClipRamp(ClipKernelState *state, UInt32 frames, ClipRampShape shape)
+{
+    state->rampSetRequest++;
+    CompilerBarrier();
+    state->pendingRamp.frames = frames;
+    state->pendingRamp.shape = shape;
+    CompilerBarrier();
+    state->rampSetRequest++;
+}
+
+// Classifies the first numSlots slots of route for numChannels mix channels
+static ClipRouteMode ClassifyRoute(const ClipRoute *route, UInt32 numSlots, UInt32 numChannels)
+{
+    bool identity = true, permutation = true;
+
+    for (UInt32 slot = 0; slot < numSlots && slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+    {
+        UInt32 taps = 0;
+
+        for (UInt32 channel = 0; channel < numChannels && channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+        {
+            SInt32 gain = route->gain[slot][channel];
+
+            if (gain != 0)
+            {
+                taps++;
+                permutation = permutation && (gain == CLIP_ROUTE_UNITY);
+            }
+            identity = identity && (gain == ((slot == channel) ? CLIP_ROUTE_UNITY : 0));
+        }
+        permutation = permutation && (taps == 1);
+    }
+
+    return identity ? kClipRouteIdentity : (permutation ? kClipRoutePermutation : kClipRouteMatrix);
+}
+
+ClipRouteMode ClassifyClipRoute(const ClipRoute *route, UInt32 numChannels)
+{
+    return ClassifyRoute(route, numChannels, numChannels);
+}
+
+ClipRouteMode ClassifyClipSpdif(const ClipRoute *route, UInt32 numChannels)
+{
+    return ClassifyRoute(route, 2, numChannels);
+}
+
+// Float bits for a 16.16 fixed point gain
+// The float bits of a fixed point number with fractionBits bits after the point
+UInt32 FixedBits(SInt32 value, SInt32 fractionBits)
+{
+    UInt32 magnitude = (value < 0) ? 0U - (UInt32) value : (UInt32) value;
+
+    if (!magnitude) {
+        return 0;
+    }
+    return ((value < 0) ? 0x80000000U : 0) | MakeFloatBits(RoundToBits(magnitude, 24), -fractionBits);
+}
+
+static UInt32 RouteGainBits(SInt32 gain)
+{
+    return FixedBits(gain, 16);
+}
+
+static void BuildRouteTable(ClipRouteTable *table, const ClipRoute *route, UInt32 numSlots, UInt32 numChannels)
+{
+    table->mode = ClassifyRoute(route, numSlots, numChannels);
+    table->numColumns = 0;
+    for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+    {
+        table->source[slot] = (slot < numSlots) ? slot : 0;
+    }
+    for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+    {
+        bool used = false;
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            UInt32 bits = 0;
+
+            if (slot < numSlots && channel < numChannels)
+            {
+                bits = RouteGainBits(route->gain[slot][channel]);
+                if (bits != 0) {
+                    table->source[slot] = channel;
+                    used = true;
+                }
+            }
+            __builtin_memcpy(&table->matrix[channel][slot], &bits, sizeof(bits));
+        }
+
+        if (used) {
+            table->column[table->numColumns++] = channel;
+        }
+    }
+}
+
+// The tables are written between two bumps of their request count, UpdateClipRoute() leaves them
+// alone while it's odd
+void SetClipRoute(ClipKernelState *state, const ClipRoute *route, UInt32 numChannels)
+{
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+
+    state->routeRequest++;
+    CompilerBarrier();
+    BuildRouteTable(&state->pendingRoute, route, numChannels, numChannels);
+    CompilerBarrier();
+    state->routeRequest++;
+}
+
+void SetClipSpdif(ClipKernelState *state, const ClipRoute *route, UInt32 numChannels)
+{
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+
+    state->spdifRequest++;
+    CompilerBarrier();
+    BuildRouteTable(&state->pendingSpdif, route, 2, numChannels);
+    CompilerBarrier();
+    state->spdifRequest++;
+}
+
+// The pending table goes to the scratch first, and only into the one the kernels use once the
+// request count shows no setter got in while it was copied. Otherwise it's copied again with the
+// next buffer.
+template <typename T>
+static void UpdateRouteTable(T *table, const T *pending, T *scratch, const volatile UInt32 *request, UInt32 *applied)
+{
+    UInt32 current = *request;
+
+    if (current == *applied || (current & 1)) {
+        return;
+    }
+
+    CompilerBarrier();
+    __builtin_memcpy(scratch, pending, sizeof(*scratch));
+    CompilerBarrier();
+
+    if (*request == current) {
+        __builtin_memcpy(table, scratch, sizeof(*table));
+        *applied = current;
+    }
+}
+
+void UpdateClipRoute(ClipKernelState *state)
+{
+    UpdateRouteTable(&state->ramp, &state->pendingRamp, &state->scratch.ramp, &state->rampSetRequest, &state->rampSetApplied);
+    UpdateRouteTable(&state->route, &state->pendingRoute, &state->scratch.route, &state->routeRequest, &state->routeApplied);
+    UpdateRouteTable(&state->spdif, &state->pendingSpdif, &state->scratch.route, &state->spdifRequest, &state->spdifApplied);
+
+    // The bass filters keep their state when just the crossover moves, anything else starts over
+    UInt32 bassApplied = state->bassApplied;
+    UpdateRouteTable(&state->bass, &state->pendingBass, &state->scratch.bass, &state->bassRequest, &state->bassApplied);
+    if (state->bassApplied != bassApplied) {
+        if (!state->bassTable.on || state->bassTable.lfeSlot != state->bass.lfeSlot || state->bassTable.managed != state->bass.managed) {
+            __builtin_memset(state->bassState, 0, sizeof(state->bassState));
+        }
+        BuildBassTable(&state->bassTable, &state->bass);
+    }
+
+    // Sections that were dropped mustn't ring with their old state when they come back
+    UInt32 eqApplied = state->eqApplied;
+    UpdateRouteTable(&state->eq, &state->pendingEq, &state->scratch.eq, &state->eqRequest, &state->eqApplied);
+    if (state->eqApplied != eqApplied) {
+        __builtin_memset(state->eqState[state->eq.numSections], 0,
+                         (CLIP_EQ_SECTIONS - state->eq.numSections) * sizeof(state->eqState[0]));
+    }
+
+    // The lines only keep the mix while they run, so they start over silent when they come back on
+    UInt32 delayApplied = state->delayApplied;
+    UpdateRouteTable(&state->delay, &state->pendingDelay, &state->scratch.delay, &state->delayRequest, &state->delayApplied);
+    if (state->delayApplied != delayApplied) {
+        UInt32 maxDelay = 0;
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++) {
+            maxDelay = (state->delay.frames[slot] > maxDelay) ? state->delay.frames[slot] : maxDelay;
+        }
+        if (!state->maxDelay && maxDelay && state->delayLines) {
+            ClearClipDelay(state->delayLines);
+        }
+        state->maxDelay = maxDelay;
+    }
+
+    // A new filter starts over silent
+    UInt32 oversampleApplied = state->oversampleApplied;
+    UpdateRouteTable(&state->oversample, &state->pendingOversample, &state->scratch.oversample, &state->oversampleRequest, &state->oversampleApplied);
+    if (state->oversampleApplied != oversampleApplied) {
+        BuildOversampleTable(&state->oversampleTable, &state->oversample);
+        __builtin_memset(state->oversampleHistory, 0, sizeof(state->oversampleHistory));
+    }
+
+    if (state->conv) {
+        PrepareClipConv(state->conv);
+    }
+}
+
+// log2 in 16.16 fixed point from the exponent and the top 16 bits of the mantissa. The fraction
+// is approximated as f + 0.3466 f (1 - f), which is within 0.009 (0.05 dB).
+static inline SInt32 Log2Fixed(SInt32 exponent, UInt32 fraction)
+{
+    return exponent * 65536 + (SInt32) (fraction + ((((fraction * (0x10000 - fraction)) >> 16) * 22713) >> 16));
+}
+
+// Of a positive float, from its bits. Zeros and denormals end up way below CLIP_METER_FLOOR.
+static SInt32 Log2FloatBits(UInt32 bits)
+{
+    if (bits < 0x00800000) {
+        return -200 * 65536;
+    }
+    if (bits >= 0x7f800000) {
+        bits = 0x7f7fffff;
+    }
+    return Log2Fixed((SInt32) (bits >> 23) - 127, (bits >> 7) & 0xffff);
+}
+
+static SInt32 Log2Integer(UInt64 v)
+{
+    SInt32 exponent = 63;
+
+    if (!v) {
+        return -200 * 65536;
+    }
+    while (!(v >> 63)) {
+        v <<= 1;
+        exponent--;
+    }
+    return Log2Fixed(exponent, (UInt32) (v >> 47) & 0xffff);
+}
+
+// 20 log10(x) = 6.0206 log2(x), in 16.16 and clamped to the floor
+static SInt32 MeterDecibels(SInt32 log2, UInt32 factor)
+{
+    SInt64 decibels = ((SInt64) log2 * factor) >> 16;
+
+    return (decibels < CLIP_METER_FLOOR) ? CLIP_METER_FLOOR : (SInt32) decibels;
+}
+
+#define METER_PEAK_FACTOR 394566	// 20 log10(2) in 16.16
+#define METER_POWER_FACTOR 197283	// 10 log10(2)
+
+// The float and the integer sums are turned into dB separately, only one of them grows unless the
+// kernel type changed in this period
+void PublishClipMeters(ClipMeterState *meter, UInt32 numChannels, UInt32 numSampleFrames, UInt32 sampleRate, UInt64 timestamp)
+{
+    ClipMeters meters;
+    SInt32 decay = 0;
+    SInt32 frames = Log2Integer(numSampleFrames);
+
+    if (numChannels > CLIP_KERNEL_MAX_CHANNELS) {
+        numChannels = CLIP_KERNEL_MAX_CHANNELS;
+    }
+    // The period in 1/4096 seconds, so nothing needs a 64 bit division
+    if (sampleRate && numSampleFrames < (1 << 20)) {
+        decay = (SInt32) ((numSampleFrames << 12) / sampleRate) * CLIP_METER_DECAY * 16;
+    }
+
+    for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++) {
+        UInt32 peakBits, squareBits;
+        SInt32 peak, held, power;
+
+        meters.overs[channel] = meter->meters.overs[channel] + meter->overs[channel];
+        meters.maxOvershoot[channel] = meter->meters.maxOvershoot[channel];
+        meters.lastOver[channel] = meter->overs[channel] ? timestamp : meter->meters.lastOver[channel];
+        if (channel >= numChannels || !numSampleFrames) {
+            meters.peak[channel] = CLIP_METER_FLOOR;
+            meters.rms[channel] = CLIP_METER_FLOOR;
+            continue;
+        }
+
+        __builtin_memcpy(&peakBits, &meter->peak[channel], sizeof(peakBits));
+        __builtin_memcpy(&squareBits, &meter->squares[channel], sizeof(squareBits));
+
+        peak = MeterDecibels(Log2FloatBits(peakBits), METER_PEAK_FACTOR);
+        held = meter->meters.peak[channel] - decay;
+        meters.peak[channel] = (peak > held) ? peak : held;
+        if (meter->overs[channel] && peak > meters.maxOvershoot[channel]) {
+            meters.maxOvershoot[channel] = peak;
+        }
+
+        power = Log2FloatBits(squareBits);
+        if (Log2Integer(meter->squaresFixed[channel]) - 30 * 65536 > power) {
+            power = Log2Integer(meter->squaresFixed[channel]) - 30 * 65536;
+        }
+        meters.rms[channel] = MeterDecibels(power - frames, METER_POWER_FACTOR);
+        if (meters.rms[channel] > 0) {
+            meters.rms[channel] = 0;
+        }
+        if (meters.peak[channel] < CLIP_METER_FLOOR) {
+            meters.peak[channel] = CLIP_METER_FLOOR;
+        }
+    }
+
+    // All zero bits are 0.0f as well
+    __builtin_memset(meter->peak, 0, sizeof(meter->peak));
+    __builtin_memset(meter->squares, 0, sizeof(meter->squares));
+    __builtin_memset(meter->squaresFixed, 0, sizeof(meter->squaresFixed));
+    __builtin_memset(meter->overs, 0, sizeof(meter->overs));
+
+    meter->sequence++;
+    CompilerBarrier();
+    __builtin_memcpy(&meter->meters, &meters, sizeof(meters));
+    CompilerBarrier();
+    meter->sequence++;
+}
+
+// A reader that keeps getting overtaken gives up rather than hold up anyone
+bool ReadClipMeters(const ClipMeterState *meter, ClipMeters *meters)
+{
+    for (UInt32 attempt = 0; attempt < 4; attempt++) {
+        UInt32 sequence = meter->sequence;
+
+        CompilerBarrier();
+        __builtin_memcpy(meters, &meter->meters, sizeof(*meters));
+        CompilerBarrier();
+
+        if (!(sequence & 1) && sequence == meter->sequence) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ResetClipMeters(ClipMeterState *meter)
+{
+    meter->sequence++;
+    CompilerBarrier();
+    __builtin_memset(meter->peak, 0, sizeof(meter->peak));
+    __builtin_memset(meter->squares, 0, sizeof(meter->squares));
+    __builtin_memset(meter->squaresFixed, 0, sizeof(meter->squaresFixed));
+    for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++) {
+        meter->meters.overs[channel] += meter->overs[channel];
+        meter->overs[channel] = 0;
+        meter->meters.peak[channel] = CLIP_METER_FLOOR;
+        meter->meters.rms[channel] = CLIP_METER_FLOOR;
+    }
+    CompilerBarrier();
+    meter->sequence++;
+}
+
+void InitClipMeters(ClipMeterState *meter)
+{
+    __builtin_memset(meter, 0, sizeof(*meter));
+    ResetClipMeters(meter);
+}
+
+const char *ClipKernelName(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelAVX2:
+            return "AVX2";
+        case kClipKernelSSE2:
+            return "SSE2";
+        case kClipKernelInteger:
+            return "integer";
+        default:
+            return "scalar";
+    }
+}
+
+const char *ClipDitherName(ClipDitherMode dither)
+{
+    switch (dither)
+    {
+        case kClipDitherTPDF:
+            return "TPDF";
+        case kClipDitherShaped:
+            return "TPDF + noise shaping";
+        default:
+            return "off";
+    }
+}
+
+const char *ClipRampName(ClipRampShape shape)
+{
+    switch (shape)
+    {
+        case kClipRampLinear:
+            return "linear";
+        case kClipRampExponential:
+            return "exponential";
+        default:
+            return "off";
+    }
+}
+
+const char *ClipStageName(ClipStageMode stage)
+{
+    switch (stage)
+    {
+        case kClipStageSoft:
+            return "soft clip";
+        case kClipStageLimiter:
+            return "limiter";
+        default:
+            return "hard clip";
+    }
+}
+
+const char *ClipRouteName(ClipRouteMode mode)
+{
+    switch (mode)
+    {
+        case kClipRoutePermutation:
+            return "permutation";
+        case kClipRouteMatrix:
+            return "matrix";
+        default:
+            return "identity";
+    }
+}
@@ -0,0 +1,598 @@
+#ifndef _Envy24HTClipKernels_H
+#define _Envy24HTClipKernels_H
+
+#include <libkern/OSTypes.h>
+
+// The SIMD kernels are written with the GCC/clang vector extensions so that they don't need the
+// compiler's intrinsic headers (AudioFloatLib is built with -nostdinc).
+// Older compilers (the 10.4u build) only get the scalar kernels.
+#if defined(__x86_64__) && (defined(__clang__) || (__GNUC__ >= 12))
+	#define ENVY24HT_SIMD 1
+#endif
+
+// Define ENVY24HT_INTEGER_CONVERSION (in the AudioFloatLib OTHER_CFLAGS) to do the clipping and the input
+// conversion without touching the FPU. The integer kernels take the floats apart into exponent and
+// mantissa bits and give bit-identical results to the float kernels, they're just slower.
+
+enum ClipKernelType
+{
+	kClipKernelScalar = 0,
+	kClipKernelSSE2,
+	kClipKernelAVX2,
+	kClipKernelInteger
+};
+
+// Optional dither for the 24 bit DACs: the output is rounded to 24 bits with triangular PDF dither of
+// +-1 LSB, optionally through a first order noise shaper
+enum ClipDitherMode
+{
+	kClipDitherNone = 0,
+	kClipDitherTPDF,
+	kClipDitherShaped
+};
+
+// Optional float stage in front of the hard clip: a polynomial soft clipper, or a brickwall limiter
+// that looks CLIP_LIMITER_LOOKAHEAD frames ahead (and delays the output by as much)
+enum ClipStageMode
+{
+	kClipStageHard = 0,
+	kClipStageSoft,
+	kClipStageLimiter
+};
+
+// Shape of the ramps the clip kernels run when a software gain changes: straight lines, or
+// constant dB per frame (which can't start or end at 0, those ramps run linear)
+enum ClipRampShape
+{
+	kClipRampOff = 0,
+	kClipRampLinear,
+	kClipRampExponential
+};
+
+// Routing from the mix channels to the DMA slots: straight through, every slot taking one mix
+// channel as is, or every slot a weighted sum of mix channels
+enum ClipRouteMode
+{
+	kClipRouteIdentity = 0,
+	kClipRoutePermutation,
+	kClipRouteMatrix
+};
+
+#define CLIP_KERNEL_MAX_CHANNELS 8
+
+// Software volume levels for boards without hardware attenuators, in 0.5 dB steps from -63 dB at 1
+// up to 0 dB at CLIP_GAIN_MAX. Level 0 mutes.
+#define CLIP_GAIN_MAX 127
+#define CLIP_LIMITER_LOOKAHEAD 32
+#define CLIP_STAGE_FRAMES 64
+
+// Output meters are 16.16 fixed point dBFS, like the dB ranges of IOAudioLevelControl, down to
+// CLIP_METER_FLOOR. The peaks fall back by CLIP_METER_DECAY dB per second (about the 20 dB in
+// 1.7 seconds of an IEC 60268-18 peak meter).
+#define CLIP_METER_FLOOR (-144 * 65536)
+#define CLIP_METER_DECAY 12
+
+// Input samples from here up count as overs, -0.1 dBFS
+#define CLIP_INPUT_OVER_LEVEL 0x7e880000
+
+// Route gains are 16.16 fixed point, like IOFixed, so the kext can hand them over without floats
+#define CLIP_ROUTE_UNITY 0x10000
+
+// The output EQ is a cascade of up to CLIP_EQ_SECTIONS biquads per DMA slot. Their coefficients
+// are 4.28 fixed point, enough for the boosts of a shelf and close to the precision of a float.
+#define CLIP_EQ_SECTIONS 8
+#define CLIP_EQ_UNITY 0x10000000
+
+// The output convolution runs FIR filters (room correction) of up to CLIP_CONV_MAX_TAPS taps per
+// DMA slot. They're cut into partitions of CLIP_CONV_PARTITION taps that are applied a block at a
+// time in the frequency domain (uniformly partitioned overlap-save), which delays the output by
+// one partition.
+#define CLIP_CONV_PARTITION 256
+#define CLIP_CONV_MAX_TAPS 65536
+#define CLIP_CONV_MAX_PARTITIONS (CLIP_CONV_MAX_TAPS / CLIP_CONV_PARTITION)
+
+// The filters run with all their taps up to CLIP_CONV_FULL_RATE. Above it the longest ones would
+// take the clip pass past its deadline, so they're cut to the taps that cost as much per second.
+#define CLIP_CONV_FULL_RATE 48000
+
+// The output delays (speaker time alignment) go up to CLIP_DELAY_MAX frames per DMA slot, 21 ms at
+// 192kHz. The delay lines are a ring of CLIP_DELAY_FRAMES frames, a power of two.
+#define CLIP_DELAY_FRAMES 4096
+#define CLIP_DELAY_MAX (CLIP_DELAY_FRAMES - 1)
+
+// Oversampling runs the DACs at 2 or CLIP_OVERSAMPLE_MAX (4) times the rate of the streams, which
+// keeps the DMA buffers wrapping at a frame of the streams. The clip pass upsamples the mix with a polyphase FIR of up to
+// CLIP_OVERSAMPLE_TAPS taps per phase, and the line input is taken back down with the same filter.
+#define CLIP_OVERSAMPLE_MAX 4
+#define CLIP_OVERSAMPLE_TAPS 64
+
+// Gain ramps as the engine sets them: the frames every one takes and its ClipRampShape
+struct ClipRamp
+{
+	UInt32 frames;
+	UInt32 shape;
+};
+
+// A routing as the engine sets it: the gain from every mix channel into every DMA slot
+struct ClipRoute
+{
+	SInt32 gain[CLIP_KERNEL_MAX_CHANNELS][CLIP_KERNEL_MAX_CHANNELS];	// [slot][mix channel]
+};
+
+// The same, the way the route kernels use it
+struct ClipRouteTable
+{
+	UInt32 mode;									// ClipRouteMode
+	UInt32 source[CLIP_KERNEL_MAX_CHANNELS];		// permutation: the mix channel each slot takes
+	UInt32 numColumns;								// matrix: the mix channels that feed any slot
+	UInt32 column[CLIP_KERNEL_MAX_CHANNELS];
+	float matrix[CLIP_KERNEL_MAX_CHANNELS][CLIP_KERNEL_MAX_CHANNELS];	// matrix: [mix channel][slot]
+};
+
+// An EQ as the engine sets it: b0 b1 b2 a1 a2 of every section for every slot, normalized to
+// a0 = 1. A section with b0 = CLIP_EQ_UNITY and the rest 0 passes the samples through.
+struct ClipEq
+{
+	SInt32 coef[CLIP_KERNEL_MAX_CHANNELS][CLIP_EQ_SECTIONS][5];	// [slot][section][b0 b1 b2 a1 a2]
+};
+
+// The same, the way the EQ kernels use it: every coefficient of a section has the slots across
+// the lanes of a vector. Only the first numSections sections run, none if it's 0.
+struct ClipEqTable
+{
+	UInt32 numSections;
+	float coef[CLIP_EQ_SECTIONS][5][CLIP_KERNEL_MAX_CHANNELS];
+};
+
+// Bass management as the engine sets it: the managed DMA slots are highpassed at the crossover
+// frequency, and what's below it is added to the LFE slot. Both sides are 4th order Linkwitz-Riley
+// filters (two Butterworth sections each), which add up to flat.
+struct ClipBass
+{
+	UInt32 frequency;							// the crossover in Hz, 0 turns it off
+	UInt32 sampleRate;
+	UInt32 lfeSlot;
+	UInt32 managed;								// bit mask of the slots
+};
+
+// The same, the way the bass kernels use it: a state variable filter run twice for every lane,
+// with the integrator coefficients a1 to a3 and the output mix m0 to m2 for a highpass on the
+// managed slots, a lowpass on the LFE slot, which takes the sum of the managed slots, and pass
+// through elsewhere
+struct ClipBassTable
+{
+	UInt32 on;
+	UInt32 lfeSlot;
+	UInt32 managed;
+	float coef[6][CLIP_KERNEL_MAX_CHANNELS];
+};
+
+// Delays as the engine sets them, in frames for every slot
+struct ClipDelay
+{
+	UInt32 frames[CLIP_KERNEL_MAX_CHANNELS];
+};
+
+// The delay lines, set up by InitClipDelay() in ClipDelaySize() bytes the engine allocates up
+// front. The frames of all the slots go through one ring, interleaved like the mix.
+struct ClipDelayLines
+{
+	UInt32 numChannels;
+	UInt32 position;							// frame of the ring the next one goes to
+	UInt32 quietFrames;							// silent frames in a row that went in, up to CLIP_DELAY_FRAMES
+	UInt32 *ring;								// [CLIP_DELAY_FRAMES][numChannels], the sample bits
+};
+
+// Oversampling as the engine sets it: the hardware rate over the rate of the streams, 1 (off) up
+// to CLIP_OVERSAMPLE_MAX, and the taps per phase of the filter, a multiple of 8 up to CLIP_OVERSAMPLE_TAPS
+struct ClipOversample
+{
+	UInt32 ratio;
+	UInt32 taps;
+};
+
+// The same, the way the upsampling kernels use it: a Kaiser windowed sinc with its zeros on the
+// frames that go in, cut into its phases. Output frame phase of every frame that goes in weighs
+// the frame k back with coef[phase][k]. Phase 0 is nothing but the frame taps / 2 back.
+struct ClipOversampleTable
+{
+	UInt32 ratio;
+	UInt32 taps;
+	float coef[CLIP_OVERSAMPLE_MAX][CLIP_OVERSAMPLE_TAPS];
+};
+
+// The line input side: the same filter over ratio times taps frames of the stereo recording for
+// every frame that comes out, and those frames, converted to float
+struct ClipDecimator
+{
+	UInt32 ratio;
+	UInt32 taps;
+	UInt32 bufferFrames;						// of the RDMA0 buffer
+	UInt32 built;								// coef is there for ratio and taps
+	UInt32 nextFrame;							// hardware frame after the history, it starts over silent anywhere else
+	float coef[CLIP_OVERSAMPLE_MAX * CLIP_OVERSAMPLE_TAPS * 2];	// oldest frame first, every tap twice
+	float history[CLIP_OVERSAMPLE_MAX * (CLIP_OVERSAMPLE_TAPS + CLIP_STAGE_FRAMES) * 2];
+};
+
+// The convolution, set up by InitClipConv() in ClipConvSize() bytes the engine allocates with the
+// first filter: the taps SetClipConv() set last, the spectra of the filters for every partition and
+// slot, twice, so a new filter can be transformed from the taps while the old one plays, and the
+// spectra of the input blocks they apply to.
+// A spectrum has the real parts of bins 0 .. CLIP_CONV_PARTITION - 1 followed by the imaginary
+// parts, with the (real) Nyquist bin in place of the imaginary part of bin 0.
+struct ClipConvState
+{
+	UInt32 numChannels;
+	volatile UInt32 sequence;					// bank in use (bit 0), SetClipConv() writing (bit 1), filters set (from bit 2)
+	UInt32 numTaps[CLIP_KERNEL_MAX_CHANNELS];	// of the taps, written by SetClipConv() only
+	UInt32 numPartitions[2];					// per bank, 0 turns the convolution off
+	UInt32 maxPartitions;						// of them that run at the rate SetClipConvRate() set
+	UInt32 filtered[2];							// per bank, the slots with a filter, the others are only delayed
+	UInt32 applied;								// sequence the bank in use was set with
+	UInt32 preparing;							// sequence the other bank is transformed for
+	UInt32 prepared;							// partitions times slots of it transformed so far
+	UInt32 position;							// frame in the current block
+	UInt32 head;								// partition of history with the newest input spectrum
+	UInt32 loud;								// the current block has sound in it
+	UInt32 quietBlocks;							// silent blocks in a row before it
+	UInt32 tables;								// the twiddles are there
+	UInt16 reversed[CLIP_CONV_PARTITION];		// bit reversed order for the complex FFT
+	float twiddle[2][CLIP_CONV_PARTITION];		// e^(-i pi k / CLIP_CONV_PARTITION), real and imaginary
+	float stageTwiddle[3][CLIP_CONV_PARTITION];	// the same per FFT stage, real, imaginary and imaginary inverted
+	float input[CLIP_KERNEL_MAX_CHANNELS][CLIP_CONV_PARTITION * 2];	// the last two blocks of every slot
+	float output[CLIP_CONV_PARTITION * CLIP_KERNEL_MAX_CHANNELS];	// the block being played, interleaved
+	float accumulator[CLIP_CONV_PARTITION * 2];
+	float work[CLIP_CONV_PARTITION * 2];
+	float *taps;								// [slot][CLIP_CONV_MAX_TAPS]
+	float *spectra[2];							// [partition][slot][CLIP_CONV_PARTITION * 2] per bank
+	float *history;								// [CLIP_CONV_MAX_PARTITIONS][slot][CLIP_CONV_PARTITION * 2]
+};
+
+// Levels per channel (DMA slot on the output), as PublishClipMeters() leaves them. The overs are
+// the samples the clip kernels clipped, or the input samples at or above CLIP_INPUT_OVER_LEVEL.
+// Everything from overs on only ever grows, until InitClipMeters().
+struct ClipMeters
+{
+	SInt32 peak[CLIP_KERNEL_MAX_CHANNELS];		// highest sample (before the clip), held and decaying
+	SInt32 rms[CLIP_KERNEL_MAX_CHANNELS];		// of the clipped samples over the last period
+	UInt64 overs[CLIP_KERNEL_MAX_CHANNELS];
+	SInt32 maxOvershoot[CLIP_KERNEL_MAX_CHANNELS];	// highest peak above full scale in dB, 0 without overs
+	UInt64 lastOver[CLIP_KERNEL_MAX_CHANNELS];	// timestamp of the period with the last over, 0 without
+};
+
+// What the kernels measure on the way, and the meters made of that
+struct ClipMeterState
+{
+	float peak[CLIP_KERNEL_MAX_CHANNELS];		// since the last PublishClipMeters()
+	float squares[CLIP_KERNEL_MAX_CHANNELS];
+	UInt64 squaresFixed[CLIP_KERNEL_MAX_CHANNELS];	// the integer kernels sum the squares of the top 16 bits here
+	UInt32 overs[CLIP_KERNEL_MAX_CHANNELS];
+	struct ClipMeters meters;
+	volatile UInt32 sequence;					// odd while PublishClipMeters() writes
+};
+
+// State the clip kernels carry from one call to the next. There is one per engine, so nothing
+// has to be allocated in the clip path.
+struct ClipKernelState
+{
+	UInt32 random[CLIP_KERNEL_MAX_CHANNELS];	// xorshift32 generators, one per channel or vector lane
+	SInt32 error[CLIP_KERNEL_MAX_CHANNELS];		// last quantization error per channel, for the noise shaper
+	float gain[CLIP_KERNEL_MAX_CHANNELS];		// software volume per channel, ramps towards targetGain
+	float targetGain[CLIP_KERNEL_MAX_CHANNELS];	// set with SetClipGain()
+	float rampMul[CLIP_KERNEL_MAX_CHANNELS];	// per frame, gain = gain * rampMul + rampAdd while ramping
+	float rampAdd[CLIP_KERNEL_MAX_CHANNELS];
+	UInt32 rampFrames;							// frames left in the current ramp
+	struct ClipRamp ramp;						// picked up from pendingRamp by UpdateClipRoute()
+	struct ClipRamp pendingRamp;				// written by SetClipRamp()
+	volatile UInt32 rampSetRequest;
+	UInt32 rampSetApplied;
+	volatile UInt32 rampRequest;				// bumped by SetClipGain(), the clip pass starts a ramp when it changes
+	UInt32 rampStarted;
+	
+	float limiterDelay[CLIP_LIMITER_LOOKAHEAD][CLIP_KERNEL_MAX_CHANNELS];
+	float limiterEnvelope[CLIP_KERNEL_MAX_CHANNELS];
+	float limiterGain[CLIP_KERNEL_MAX_CHANNELS];
+	UInt32 limiterPosition;
+	
+	struct ClipRouteTable route;					// picked up from pendingRoute by UpdateClipRoute()
+	struct ClipRouteTable pendingRoute;			// written by SetClipRoute()
+	volatile UInt32 routeRequest;				// odd while SetClipRoute() is writing
+	UInt32 routeApplied;
+	struct ClipRouteTable spdif;					// the S/PDIF feed, slots 0 and 1 are left and right
+	struct ClipRouteTable pendingSpdif;			// written by SetClipSpdif()
+	volatile UInt32 spdifRequest;
+	UInt32 spdifApplied;
+	
+	struct ClipBass bass;						// picked up from pendingBass by UpdateClipRoute()
+	struct ClipBass pendingBass;				// written by SetClipBass()
+	volatile UInt32 bassRequest;
+	UInt32 bassApplied;
+	struct ClipBassTable bassTable;				// made from bass in the clip pass
+	float bassState[2][2][CLIP_KERNEL_MAX_CHANNELS];	// both integrators of both sections
+	
+	struct ClipEqTable eq;						// picked up from pendingEq by UpdateClipRoute()
+	struct ClipEqTable pendingEq;				// written by SetClipEq()
+	volatile UInt32 eqRequest;
+	UInt32 eqApplied;
+	float eqState[CLIP_EQ_SECTIONS][2][CLIP_KERNEL_MAX_CHANNELS];	// z1 and z2 of every section
+	
+	struct ClipConvState *conv;					// NULL until the engine sets one up
+	
+	struct ClipDelay delay;						// picked up from pendingDelay by UpdateClipRoute()
+	struct ClipDelay pendingDelay;				// written by SetClipDelay()
+	volatile UInt32 delayRequest;
+	UInt32 delayApplied;
+	UInt32 maxDelay;							// longest of them, 0 turns the delays off
+	struct ClipDelayLines *delayLines;			// NULL until the engine sets them up
+	
+	struct ClipOversample oversample;			// picked up from pendingOversample by UpdateClipRoute()
+	struct ClipOversample pendingOversample;	// written by SetClipOversample()
+	volatile UInt32 oversampleRequest;
+	UInt32 oversampleApplied;
+	struct ClipOversampleTable oversampleTable;	// made from oversample in the clip pass
+	float oversampleHistory[CLIP_OVERSAMPLE_TAPS - 1 + CLIP_STAGE_FRAMES][CLIP_KERNEL_MAX_CHANNELS];	// the frames that went in, a lane per slot
+	
+	union {										// where UpdateClipRoute() copies the pending tables to
+		struct ClipRamp ramp;
+		struct ClipRouteTable route;
+		struct ClipBass bass;
+		struct ClipEqTable eq;
+		struct ClipDelay delay;
+		struct ClipOversample oversample;
+	} scratch;
+	
+	float routeBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];	// output of the routing
+	float bassBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];	// output of the bass management
+	float eqBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];		// output of the EQ
+	float convBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];	// output of the convolution
+	float delayBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];	// output of the delays
+	SInt32 spdifBuf[CLIP_STAGE_FRAMES * 2];		// takes the clip kernel's S/PDIF copy while the feed is computed
+	float stageBuf[CLIP_STAGE_FRAMES * CLIP_KERNEL_MAX_CHANNELS];	// output of the stage, input of the clip kernel
+	float oversampleBuf[CLIP_STAGE_FRAMES * CLIP_OVERSAMPLE_MAX * CLIP_KERNEL_MAX_CHANNELS];	// output of the upsampling
+	
+	struct ClipMeterState meter;				// the output levels
+};
+
+void InitClipKernelState(struct ClipKernelState *state);
+
+// Clears the limiter's delay line and envelopes. Only on the clip pass, it runs on them
+void ResetClipStage(struct ClipKernelState *state);
+
+// Sets the software volume of a channel to a level from 0 to CLIP_GAIN_MAX. The clip pass ramps
+// to it, starting with the next frame it clips. This only does integer math, so it can be called
+// from the control handlers.
+void SetClipGain(struct ClipKernelState *state, UInt32 channel, SInt32 level);
+
+// Sets the length and shape of the ramps for the following gain changes, from the next
+// UpdateClipRoute() on. The integer kernels never ramp, they jump to the new gain.
+void SetClipRamp(struct ClipKernelState *state, UInt32 frames, ClipRampShape shape);
+
+// Tells what kind of routing route is for the first numChannels slots and mix channels
+ClipRouteMode ClassifyClipRoute(const struct ClipRoute *route, UInt32 numChannels);
+
+// Hands a new routing for numChannels channels to the clip pass, which switches to it with the
+// next buffer it clips. Integer math only, like SetClipGain().
+void SetClipRoute(struct ClipKernelState *state, const struct ClipRoute *route, UInt32 numChannels);
+
+// Sets what the S/PDIF output carries: slots 0 and 1 of route are its left and right channel, with
+// the gain from every DMA slot (after the routing and the stage). The first pair straight through
+// is the copy the clip kernels make anyway, anything else is computed in the clip pass, without
+// dither. Integer math only, like SetClipRoute().
+ClipRouteMode ClassifyClipSpdif(const struct ClipRoute *route, UInt32 numChannels);
+void SetClipSpdif(struct ClipKernelState *state, const struct ClipRoute *route, UInt32 numChannels);
+
+// Hands new bass management for numChannels slots to the clip pass, which works out the filters
+// and switches to them with the next buffer. The LFE slot is never managed. Set it again when the
+// sample rate changes. Integer math only, like SetClipRoute().
+void SetClipBass(struct ClipKernelState *state, const struct ClipBass *bass, UInt32 numChannels);
+
+// Tells whether bass management is off, or its filters have rung out, like ClipEqSettled()
+bool ClipBassSettled(const struct ClipKernelState *state);
+
+// Hands a new EQ for numChannels slots to the clip pass, which switches to it with the next
+// buffer, keeping the filter state. Integer math only, like SetClipRoute().
+void SetClipEq(struct ClipKernelState *state, const struct ClipEq *eq, UInt32 numChannels);
+
+// Tells whether the EQ is off, or its filters have rung out (below -180 dBFS), so silence going in
+// means silence coming out. Integer math only.
+bool ClipEqSettled(const struct ClipKernelState *state);
+
+// The bytes the convolution of numChannels slots takes, about 14 MB for 8, and sets it up in them
+// (aligned to 64 bytes), off. Integer math only.
+UInt32 ClipConvSize(UInt32 numChannels);
+struct ClipConvState *InitClipConv(void *memory, UInt32 numChannels);
+
+// Hands new filters to the convolution: numTaps[slot] floats from taps[slot] for every slot, up to
+// CLIP_CONV_MAX_TAPS. Slots without taps are only delayed, no taps at all turn it off. The clip
+// pass transforms them a few partitions at a time and then switches over, keeping the input it
+// has, within a second or two. Integer math only, the taps are just copied.
+void SetClipConv(struct ClipConvState *conv, const float *const taps[CLIP_KERNEL_MAX_CHANNELS], const UInt32 numTaps[CLIP_KERNEL_MAX_CHANNELS]);
+
+// Cuts the filters to what the clip pass has time for at sampleRate, see CLIP_CONV_FULL_RATE.
+// They're all there again when the rate goes back down. Integer math only.
+void SetClipConvRate(struct ClipConvState *conv, UInt32 sampleRate);
+
+// Tells whether the clip pass has a convolution to run. Integer math only.
+bool ClipConvActive(const struct ClipKernelState *state);
+
+// Tells whether the convolution is off, or has only had silence in for longer than its filters,
+// so silence going in means silence coming out. Integer math only.
+bool ClipConvSettled(const struct ClipKernelState *state);
+
+// The bytes the delay lines of numChannels slots take, 128 kB for 8, and sets them up in them,
+// silent. Integer math only.
+UInt32 ClipDelaySize(UInt32 numChannels);
+struct ClipDelayLines *InitClipDelay(void *memory, UInt32 numChannels);
+
+// Hands new delays for numChannels slots to the clip pass, which switches to them with the next
+// buffer. Delays of 0 everywhere turn them off, the lines start out silent when they come back on.
+// Integer math only, like SetClipRoute().
+void SetClipDelay(struct ClipKernelState *state, const struct ClipDelay *delay, UInt32 numChannels);
+
+// Tells whether the clip pass has delays to run. Integer math only.
+bool ClipDelayActive(const struct ClipKernelState *state);
+
+// Tells whether the delays are off, or have only had silence in for longer than the longest of
+// them, so silence going in means silence coming out. Integer math only.
+bool ClipDelaySettled(const struct ClipKernelState *state);
+
+// Hands a new oversampling ratio and filter length to the clip pass, which works out the filter
+// and switches to it with the next buffer, starting over silent. Ratios other than 2 and
+// CLIP_OVERSAMPLE_MAX turn it off, the taps are rounded down to a multiple of 8 (at least 8). Integer math only, like
+// SetClipRoute().
+void SetClipOversample(struct ClipKernelState *state, const struct ClipOversample *oversample);
+
+// Tells whether oversampling is off, or the frames the filter still has are silent, so silence
+// going in means silence coming out. Integer math only.
+bool ClipOversampleSettled(const struct ClipKernelState *state);
+
+// Sets the decimator for the line input up for oversample and an RDMA0 buffer of bufferFrames
+// frames, the input conversion works out the filter the first time it runs. Also starts it over
+// silent. Integer math only.
+void SetClipDecimator(struct ClipDecimator *decimator, const struct ClipOversample *oversample, UInt32 bufferFrames);
+
+// Called at the start of the clip pass, picks up what SetClipRoute(), SetClipSpdif(), SetClipBass(),
+// SetClipEq(), SetClipDelay() and SetClipOversample() set, and transforms some of the filters
+// SetClipConv() set
+void UpdateClipRoute(struct ClipKernelState *state);
+
+// Clears the meters and the over counts
+void InitClipMeters(struct ClipMeterState *meter);
+
+// Called by the clip pass (or the input conversion) once per period (a loop through the DMA
+// buffer of numSampleFrames frames), turns what the kernels measured into the meters. timestamp
+// (in absolute time units) goes to lastOver of the channels that had overs. Integer math only,
+// so the meters work with the integer kernels too.
+void PublishClipMeters(struct ClipMeterState *meter, UInt32 numChannels, UInt32 numSampleFrames, UInt32 sampleRate, UInt64 timestamp);
+
+// Copies the meters for any other thread, without locking. Returns false if the clip pass kept
+// writing them.
+bool ReadClipMeters(const struct ClipMeterState *meter, struct ClipMeters *meters);
+
+// Drops the meters to the floor while nothing is converted, the over counts stay
+void ResetClipMeters(struct ClipMeterState *meter);
+
+// Scales numSampleFrames frames starting at firstSampleFrame from mixBuf by the channel gains in the
+// state, clips them to -1.0 .. 1.0 and converts them to SInt32 in sampleBuf, copying the first
+// stereo pair of every frame to spdifBuf in the same pass. The peak, the sum of squares and the
+// number of clipped samples of every channel are added to the meters in the state on the way.
+// The buffers point at the start of the mix, DMA and S/PDIF buffers. There is one kernel per channel
+// count, picked by GetClipKernel(). All variants produce bit-identical output to the scalar ones.
+// The streaming SIMD variants write the DMA and S/PDIF buffers with non temporal stores.
+// The dithering kernels round to 24 bits, their output only matches to within the dither.
+typedef void (*ClipKernelFunc)(const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                               struct ClipKernelState *state);
+
+// Runs the output stage over numSampleFrames frames (at most CLIP_STAGE_FRAMES) from mixBuf into
+// destBuf. Both point at the first frame to process.
+typedef void (*ClipStageFunc)(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, struct ClipKernelState *state);
+
+// The routing runs the same way, from the mix into state->routeBuf, in front of the stage. It
+// picks the permutation or the matrix from state->route.
+typedef ClipStageFunc ClipRouteFunc;
+
+// Bass management runs right behind the routing, into state->bassBuf. The SIMD kernels run the
+// slots of a frame in the lanes of a vector, with the sum for the LFE slot in its lane, and produce
+// bit-identical output to the scalar ones.
+typedef ClipStageFunc ClipBassFunc;
+
+// So does the EQ, between the bass management and the stage, into state->eqBuf. Every section is
+// a biquad in transposed direct form II, the SIMD kernels run the channels of a frame in the lanes
+// of a vector and produce bit-identical output to the scalar ones.
+typedef ClipStageFunc ClipEqFunc;
+
+// The convolution runs behind the EQ, into state->convBuf, with the ClipConvState in state->conv
+// that was set up for the same channel count. It collects CLIP_CONV_PARTITION frames and then
+// convolves them all at once, so a chunk that completes a block costs a lot more than the others.
+// The SIMD kernels produce bit-identical output to the scalar ones.
+typedef ClipStageFunc ClipConvFunc;
+
+// The delays run behind the convolution, into state->delayBuf, with the lines in state->delayLines
+// that were set up for the same channel count. They only move the sample bits, so there's one
+// kernel for all the types, the integer ones included.
+typedef ClipStageFunc ClipDelayFunc;
+
+// The upsampling runs last, behind the stage, from the chunk into state->oversampleBuf: ratio frames
+// for every frame, in state->oversampleTable. The clip kernel takes them from there at the hardware
+// rate. The SIMD kernels run the slots of a frame in the lanes of a vector and produce
+// bit-identical output to the scalar ones.
+typedef ClipStageFunc ClipUpsampleFunc;
+
+// Takes numSampleFrames frames (at most CLIP_STAGE_FRAMES) of the stereo line input back down from
+// the hardware rate: converts the ratio times as many frames from firstSampleFrame on in the RDMA0
+// buffer sampleBuf, metering them like the convert kernels, and filters them into destBuf. They
+// may wrap around the end of the buffer, which the ratio needn't divide. The SIMD kernels produce
+// bit-identical output to the scalar ones.
+typedef void (*ClipDecimateFunc)(const SInt32 *sampleBuf, UInt32 firstSampleFrame, float *destBuf, UInt32 numSampleFrames,
+                                 struct ClipDecimator *decimator, struct ClipMeterState *meter);
+
+// Computes numSampleFrames frames (at most CLIP_STAGE_FRAMES) of the S/PDIF feed in state->spdif
+// from the slots in mixBuf, with the software volume, clipped to SInt32 in spdifBuf. Both point at
+// the first frame. All variants produce bit-identical output to the scalar ones.
+typedef void (*SpdifKernelFunc)(const float *mixBuf, SInt32 *spdifBuf, UInt32 numSampleFrames, struct ClipKernelState *state);
+
+// Clears numSampleFrames frames of the mix buffer (if there is one), the DMA buffer and their
+// S/PDIF pairs (if there is an S/PDIF buffer) in one pass
+typedef void (*EraseKernelFunc)(float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames);
+
+// Copies stereo pair pair (0 for the first two slots) of numSampleFrames frames starting at
+// firstSampleFrame from the DMA buffer to the S/PDIF buffer, for the non-mixable formats, where the
+// clients write the DMA buffer themselves. Integer only.
+typedef void (*MirrorKernelFunc)(const SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 pair, UInt32 firstSampleFrame, UInt32 numSampleFrames);
+
+// Copies the first of every ratio frames, numSampleFrames of them, from the oversampled DMA buffer
+// hardwareBuf to sampleBuf, which has the stream's frames for the loopback input. Both point at the
+// first frame. Integer only.
+typedef void (*PhaseKernelFunc)(const SInt32 *hardwareBuf, SInt32 *sampleBuf, UInt32 ratio, UInt32 numSampleFrames);
+
+// Tells whether numSamples samples from mixBuf are all 0.0 or -0.0, which the clip pass would
+// turn into digital silence whatever the gain. mixBuf points at the first sample to look at.
+typedef bool (*SilenceKernelFunc)(const float *mixBuf, UInt32 numSamples);
+
+// Converts numSamples SInt32 samples from the RDMA0 buffer to floats in the range -1.0 .. 1.0.
+// sampleBuf points at the first frame to convert. All variants produce bit-identical output to
+// ConvertSInt32ToFloat_Scalar(). The peak, the sum of squares and the overs of each of the
+// numChannels channels are added to meter on the way, unless it's NULL.
+typedef void (*ConvertKernelFunc)(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels,
+                                  struct ClipMeterState *meter);
+
+void ConvertSInt32ToFloat_Scalar(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels, struct ClipMeterState *meter);
+
+// Picks the fastest kernel the CPU we're loaded on supports, or the integer kernels if they were
+// selected at build time
+ClipKernelType DetectClipKernelType();
+
+// Returns NULL for channel counts no card uses (anything but 2, 6 and 8). The scalar and integer
+// kernels ignore streaming.
+ClipKernelFunc GetClipKernel(ClipKernelType type, UInt32 numChannels, bool streaming, ClipDitherMode dither);
+// Returns NULL for the hard clip, which needs no stage, and for the integer kernels, which
+// only hard clip
+ClipStageFunc GetClipStage(ClipKernelType type, UInt32 numChannels, ClipStageMode stage);
+// The integer kernels only do permutations, which just move the bits around
+ClipRouteFunc GetClipRoute(ClipKernelType type, UInt32 numChannels);
+// Returns NULL for the integer kernels, which have no bass management
+ClipBassFunc GetClipBass(ClipKernelType type, UInt32 numChannels);
+// Returns NULL for the integer kernels, which have no EQ
+ClipEqFunc GetClipEq(ClipKernelType type, UInt32 numChannels);
+// Returns NULL for the integer kernels, which have no convolution
+ClipConvFunc GetClipConv(ClipKernelType type, UInt32 numChannels);
+// The same kernel for all types
+ClipDelayFunc GetClipDelay(ClipKernelType type, UInt32 numChannels);
+// Return NULL for the integer kernels, which don't oversample. The decimator only takes 2 channels.
+ClipUpsampleFunc GetClipUpsample(ClipKernelType type, UInt32 numChannels);
+ClipDecimateFunc GetClipDecimate(ClipKernelType type, UInt32 numChannels);
+// The integer kernel only takes a single channel for each side, it can't sum
+SpdifKernelFunc GetSpdifKernel(ClipKernelType type, UInt32 numChannels);
+EraseKernelFunc GetEraseKernel(UInt32 numChannels);
+MirrorKernelFunc GetMirrorKernel(UInt32 numChannels);
+PhaseKernelFunc GetPhaseKernel(UInt32 numChannels);
+// The scalar kernel only looks at the bits, it serves the integer kernels as well
+SilenceKernelFunc GetSilenceKernel(ClipKernelType type);
+ConvertKernelFunc GetConvertKernel(ClipKernelType type);
+const char *ClipKernelName(ClipKernelType type);
+const char *ClipDitherName(ClipDitherMode dither);
+const char *ClipStageName(ClipStageMode stage);
+const char *ClipRampName(ClipRampShape shape);
+const char *ClipRouteName(ClipRouteMode mode);
+
+#endif /* _Envy24HTClipKernels_H */
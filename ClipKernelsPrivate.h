@@ -0,0 +1,194 @@
+#ifndef _Envy24HTClipKernelsPrivate_H
+#define _Envy24HTClipKernelsPrivate_H
+
+// What the clip kernel files share, ClipKernels.h is what the engine sees
+#include "ClipKernels.h"
+// ClipKernelsTest.cpp builds these files in userspace, and brings its own
+#ifdef KERNEL
+#include <IOKit/IOLib.h>
+#include <libkern/OSAtomic.h>
+#endif
+
+// The SIMD helpers are templates on the vector type, shared by the SSE2 kernels and the AVX2 ones,
+// and only the kernels carry the AVX2 target. GCC warns that returning a v8sf without it changes
+// the ABI, which doesn't matter as they're all always inlined. The helpers take their vectors by
+// reference, passing them has the same problem without a way to turn the note off.
+#if defined(ENVY24HT_SIMD) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+static inline float Abs(float x)
+{
+    return x < 0 ? -x : x;
+}
+
+static inline float Max(float a, float b)
+{
+    return a < b ? b : a;
+}
+
+static inline float Min(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float CopySign(float magnitude, float x)
+{
+    return x < 0 ? -magnitude : magnitude;
+}
+
+// The mix buffer and the DMA buffer are only guaranteed to be 4 byte aligned at a given frame.
+// Alignment attributes don't survive being passed as template arguments, so unaligned accesses
+// go through a fixed size memcpy, which compiles to a single movups/vmovups. With a float it's
+// a plain load, so the scalar kernels can share code with the SIMD ones.
+template <typename V>
+static inline __attribute__((always_inline)) V LoadUnaligned(const void *p)
+{
+    V v;
+    __builtin_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) void StoreUnaligned(void *p, const V &v)
+{
+    __builtin_memcpy(p, &v, sizeof(v));
+}
+
+#ifdef ENVY24HT_SIMD
+// The vector versions, with compare and select
+template <typename V>
+static inline __attribute__((always_inline)) V Abs(const V &x)
+{
+    typedef __typeof__(x < x) VM;
+
+    return (V) ((VM) x & ((VM) {} + 0x7fffffff));
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) V Max(const V &a, const V &b)
+{
+    typedef __typeof__(a < b) VM;
+    VM less = a < b;
+
+    return (V) (((VM) a & ~less) | ((VM) b & less));
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) V Min(const V &a, const V &b)
+{
+    typedef __typeof__(a < b) VM;
+    VM less = a < b;
+
+    return (V) (((VM) b & ~less) | ((VM) a & less));
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) V CopySign(const V &magnitude, const V &x)
+{
+    typedef __typeof__(x < x) VM;
+    const VM sign = (VM) {} + (SInt32) 0x80000000;
+
+    return (V) (((VM) magnitude & ~sign) | ((VM) x & sign));
+}
+#endif
+
+#ifdef ENVY24HT_SIMD
+typedef float  v4sf __attribute__((vector_size(16)));
+typedef double v4df __attribute__((vector_size(32)));
+typedef SInt64 v4di __attribute__((vector_size(32)));
+typedef SInt32 v4si __attribute__((vector_size(16)));
+typedef float  v8sf __attribute__((vector_size(32)));
+typedef double v8df __attribute__((vector_size(64)));
+typedef SInt64 v8di __attribute__((vector_size(64)));
+typedef SInt32 v8si __attribute__((vector_size(32)));
+typedef UInt32 v4su __attribute__((vector_size(16)));
+typedef UInt32 v8su __attribute__((vector_size(32)));
+typedef UInt64 v2du __attribute__((vector_size(16)));
+typedef UInt64 v4du __attribute__((vector_size(32)));
+
+// The stages with state that runs from frame to frame work on one frame per vector, with a lane
+// per channel
+template <UInt32 N> struct FrameVector { typedef v8sf type; };
+template <> struct FrameVector<2> { typedef v4sf type; };
+#endif
+
+// The setters and the clip pass only need their stores and their loads to stay in order. x86,
+// the only one this builds for, does that by itself, so keeping the compiler from moving them is enough.
+#if !defined(__i386__) && !defined(__x86_64__)
+#error "CompilerBarrier() is not a memory barrier on this architecture"
+#endif
+
+static inline void CompilerBarrier()
+{
+    __asm__ __volatile__("" : : : "memory");
+}
+
+// The filter state of the EQ, the bass management and the oversampling
+#define FILTER_STATE_FLOOR 1.0e-15f		// state below this (-300 dB) is dropped before it gets denormal and slow
+#define FILTER_SETTLED_BITS 0x30800000	// 2^-30, -180 dB
+
+// Once per chunk. A NaN that got into the state is dropped as well, or it would stay there for
+// good (an infinity turns into one with the next sample).
+static inline void FlushFilterState(float *z, UInt32 count)
+{
+    for (UInt32 i = 0; i < count; i++) {
+        if (!(Abs(z[i]) >= FILTER_STATE_FLOOR)) {
+            z[i] = 0.0f;
+        }
+    }
+}
+
+static inline bool FilterStateSettled(const float *z, UInt32 count)
+{
+    const UInt32 *bits = (const UInt32 *) z;
+
+    for (UInt32 i = 0; i < count; i++) {
+        if ((bits[i] & 0x7fffffff) >= FILTER_SETTLED_BITS) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#define CLIP_PI 3.14159265358979323846
+
+// sin and cos of 0 .. pi, for the filters built in the clip pass (there's no libm)
+static inline void SinCos(double x, double *sine, double *cosine)
+{
+    bool mirrored = (x > CLIP_PI / 2);
+    double x2, sineTerm, cosineTerm;
+
+    if (mirrored) {
+        x = CLIP_PI - x;
+    }
+    x2 = x * x;
+    sineTerm = x;
+    cosineTerm = 1.0;
+    *sine = x;
+    *cosine = 1.0;
+    for (UInt32 i = 1; i < 12; i++) {
+        sineTerm *= -x2 / ((2 * i) * (2 * i + 1));
+        cosineTerm *= -x2 / ((2 * i - 1) * (2 * i));
+        *sine += sineTerm;
+        *cosine += cosineTerm;
+    }
+    if (mirrored) {
+        *cosine = -*cosine;
+    }
+}
+
+// The tables UpdateClipRoute() builds, and what the other files need from ClipKernels.cpp
+UInt32 FixedBits(SInt32 value, SInt32 fractionBits);
+void BuildBassTable(ClipBassTable *table, const ClipBass *bass);
+void ClearClipDelay(ClipDelayLines *lines);
+void BuildOversampleTable(ClipOversampleTable *table, const ClipOversample *oversample);
+void PrepareClipConv(ClipConvState *conv);
+#ifdef ENVY24HT_SIMD
+void ConvertSInt32ToFloat_SSE2(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels, ClipMeterState *meter);
+__attribute__((target("avx2"))) void ConvertSInt32ToFloat_AVX2(const SInt32 *sampleBuf, float *destBuf, UInt32 numSamples, UInt32 numChannels,
+                                                               ClipMeterState *meter);
+#endif
+
+#endif /* _Envy24HTClipKernelsPrivate_H */
@@ -0,0 +1,2191 @@
+// The self test and the benchmark of the clip kernels. They build in userspace from
+// ClipKernels.cpp and the stage files, so none of it ends up in the kext:
+//
+//     c++ -O2 -Wall -o ClipKernelsTest ClipKernelsTest.cpp
+//
+// Add -DENVY24HT_INTEGER_CONVERSION for the integer kernels. Every kernel the CPU can run is
+// compared against the scalar one, the exit status is 0 if they all passed. With "benchmark" as
+// its argument it then times the fastest one as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libkern/OSTypes.h>
+#if !defined(__i386__) && !defined(__x86_64__)
+#include <mach/mach_time.h>
+#endif
+
+// What the kext gets from IOKit and libkern
+#define IOLog printf
+
+static inline void *IOMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+static inline void IOFree(void *address, size_t)
+{
+    free(address);
+}
+
+static inline void *IOMallocAligned(size_t size, size_t alignment)
+{
+    void *address;
+
+    return posix_memalign(&address, (alignment < sizeof(void *)) ? sizeof(void *) : alignment, size) ? NULL : address;
+}
+
+static inline void IOFreeAligned(void *address, size_t)
+{
+    free(address);
+}
+
+static inline bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+#include "ClipKernels.cpp"
+#include "ClipLimiter.cpp"
+#include "ClipEq.cpp"
+#include "ClipBass.cpp"
+#include "ClipConv.cpp"
+#include "ClipDelay.cpp"
+#include "ClipOversample.cpp"
+
+#define SELFTEST_FRAMES 259 // not a multiple of any vector width, so the tails get exercised too
+#define SELFTEST_SAMPLES (SELFTEST_FRAMES * 8)
+#define SELFTEST_RAMP_FRAMES 150
+
+// Runs a stage over a whole buffer, CLIP_STAGE_FRAMES at a time like the engine does
+static void RunClipStage(ClipStageFunc stage, const float *mixBuf, float *destBuf, UInt32 numSampleFrames, UInt32 numChannels,
+                         ClipKernelState *state)
+{
+    for (UInt32 done = 0; done < numSampleFrames; done += CLIP_STAGE_FRAMES)
+    {
+        UInt32 count = (numSampleFrames - done < CLIP_STAGE_FRAMES) ? numSampleFrames - done : CLIP_STAGE_FRAMES;
+
+        stage(&mixBuf[done * numChannels], &destBuf[done * numChannels], count, state);
+    }
+}
+
+// Compares the output stages against the scalar ones, and checks what they're there for: the soft
+// clipper stays within full scale and leaves anything below its knee alone, the limiter keeps hot
+// signals under its ceiling and only delays quiet ones.
+static bool ClipStagesSelfTest(ClipKernelType type, const float *mix)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    float *quiet = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    float *ref = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    float *out = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    ClipKernelState state;
+    bool result = false;
+
+    if (!quiet || !ref || !out) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < SELFTEST_SAMPLES; i++)
+    {
+        quiet[i] = Max(Min(mix[i], 1.0f), -1.0f) * 0.5f;
+    }
+
+    result = true;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+
+        for (UInt32 mode = kClipStageSoft; mode <= kClipStageLimiter; mode++)
+        {
+            ClipStageFunc stage = GetClipStage(type, numChannels, (ClipStageMode) mode);
+
+            if (!stage) {
+                continue;
+            }
+
+            InitClipKernelState(&state);
+            RunClipStage(GetClipStage(kClipKernelScalar, numChannels, (ClipStageMode) mode), mix, ref, SELFTEST_FRAMES, numChannels, &state);
+            InitClipKernelState(&state);
+            RunClipStage(stage, mix, out, SELFTEST_FRAMES, numChannels, &state);
+
+            for (UInt32 i = 0; i < numSamples; i++)
+            {
+                float difference = Abs(out[i] - ref[i]);
+                float limit = (mode == kClipStageSoft) ? 1.0f : LIMITER_CEILING;
+
+                if (difference > 1.0e-6f || !(Abs(out[i]) <= limit) ||
+                    (mode == kClipStageSoft && Abs(mix[i]) <= SOFTCLIP_THRESHOLD && out[i] != mix[i]))
+                {
+                    IOLog("ClipKernelsSelfTest: %s %s out of range at %u (%u channels)\n",
+                          ClipKernelName(type), ClipStageName((ClipStageMode) mode), (unsigned int) i, (unsigned int) numChannels);
+                    result = false;
+                    break;
+                }
+            }
+        }
+
+        // Nothing in the quiet signal gets near the ceiling, so it has to come out untouched
+        // CLIP_LIMITER_LOOKAHEAD frames later
+        if (GetClipStage(type, numChannels, kClipStageLimiter))
+        {
+            InitClipKernelState(&state);
+            RunClipStage(GetClipStage(type, numChannels, kClipStageLimiter), quiet, out, SELFTEST_FRAMES, numChannels, &state);
+
+            for (UInt32 i = 0; i < numSamples; i++)
+            {
+                float expected = (i < CLIP_LIMITER_LOOKAHEAD * numChannels) ? 0.0f : quiet[i - CLIP_LIMITER_LOOKAHEAD * numChannels];
+
+                if (out[i] != expected)
+                {
+                    IOLog("ClipKernelsSelfTest: %s limiter changed a quiet signal at %u (%u channels)\n",
+                          ClipKernelName(type), (unsigned int) i, (unsigned int) numChannels);
+                    result = false;
+                    break;
+                }
+            }
+        }
+    }
+
+Done:
+    if (quiet) {
+        IOFree(quiet, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (ref) {
+        IOFree(ref, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (out) {
+        IOFree(out, SELFTEST_SAMPLES * sizeof(float));
+    }
+
+    return result;
+}
+
+// Runs the routes against the scalar ones bit for bit: a permutation that reverses the channels,
+// which also has to come out as exactly the mix samples, and a matrix with a silent slot, negative
+// gains and a slot taking three channels. The integer kernels only get the permutation. The mix
+// kernels get the permutation as well.
+static bool ClipRoutesSelfTest(ClipKernelType type, const float *mix)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    float *ref = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    float *out = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    ClipKernelState state;
+    ClipRoute route;
+    bool result = false;
+
+    if (!ref || !out) {
+        goto Done;
+    }
+
+    result = true;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+
+        for (UInt32 mode = kClipRoutePermutation; mode <= kClipRouteMatrix; mode++)
+        {
+            if (mode == kClipRouteMatrix && type == kClipKernelInteger) {
+                continue;
+            }
+
+            for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+            {
+                for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+                {
+                    route.gain[slot][channel] = (channel == numChannels - 1 - slot) ? CLIP_ROUTE_UNITY : 0;
+                }
+                if (mode == kClipRouteMatrix)
+                {
+                    route.gain[slot][0] -= CLIP_ROUTE_UNITY / 3;
+                    route.gain[slot][1] += (slot == 1) ? 0 : 0x8000;
+                }
+            }
+            if (mode == kClipRouteMatrix)
+            {
+                route.gain[1][numChannels - 2] = 0;
+                route.gain[1][0] = 0;
+            }
+
+            InitClipKernelState(&state);
+            SetClipRoute(&state, &route, numChannels);
+            UpdateClipRoute(&state);
+            if (state.route.mode != mode)
+            {
+                IOLog("ClipKernelsSelfTest: %s route classified wrong (%u channels)\n", ClipRouteName((ClipRouteMode) mode), (unsigned int) numChannels);
+                result = false;
+                continue;
+            }
+
+            RunClipStage(GetClipRoute(kClipKernelScalar, numChannels), mix, ref, SELFTEST_FRAMES, numChannels, &state);
+            RunClipStage(GetClipRoute(type, numChannels), mix, out, SELFTEST_FRAMES, numChannels, &state);
+
+            for (UInt32 i = 0; i < numSamples; i++)
+            {
+                UInt32 slot = i % numChannels;
+                const float *expected = (mode == kClipRoutePermutation) ? &mix[i - slot + numChannels - 1 - slot] : &ref[i];
+
+                if (__builtin_memcmp(&out[i], &ref[i], sizeof(float)) != 0 || __builtin_memcmp(&out[i], expected, sizeof(float)) != 0)
+                {
+                    IOLog("ClipKernelsSelfTest: %s %s route mismatch at %u (%u channels)\n",
+                          ClipKernelName(type), ClipRouteName((ClipRouteMode) mode), (unsigned int) i, (unsigned int) numChannels);
+                    result = false;
+                    break;
+                }
+            }
+        }
+    }
+
+Done:
+    if (ref) {
+        IOFree(ref, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (out) {
+        IOFree(out, SELFTEST_SAMPLES * sizeof(float));
+    }
+
+    return result;
+}
+
+// Runs a lowpass and a peaking filter, different on every slot, against the scalar kernel bit for
+// bit, checks that a section that only halves the samples does just that, and that an EQ of pass
+// through sections is off and the filters ring out
+static bool ClipEqSelfTest(ClipKernelType type)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    static const SInt32 lowpass[5] = { 26199986, 52399972, 26199986, -253085744, 89478485 };	// fs / 8, Q 0.707
+    static const SInt32 peaking[5] = { 322122547, -429496730, 161061274, -429496730, 214748365 };
+    float *in = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    float *ref = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    float *out = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    ClipKernelState state;
+    ClipEq eq;
+    UInt32 seed = 0x2468ace0;
+    bool result = false;
+
+    if (!in || !ref || !out) {
+        goto Done;
+    }
+
+    result = true;
+    if (type == kClipKernelInteger) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < SELFTEST_SAMPLES; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        in[i] = ((SInt32) seed) * (1.0f / 2147483648.0f);
+    }
+
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+        bool settled;
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            for (UInt32 section = 0; section < CLIP_EQ_SECTIONS; section++)
+            {
+                for (UInt32 k = 0; k < 5; k++)
+                {
+                    eq.coef[slot][section][k] = (k == 0) ? CLIP_EQ_UNITY : 0;
+                    if (section == 0) {
+                        eq.coef[slot][section][k] = lowpass[k];
+                    }
+                    if (section == 2 && slot != 1) {
+                        eq.coef[slot][section][k] = peaking[k] + ((k == 0) ? (SInt32) slot * (CLIP_EQ_UNITY / 16) : 0);
+                    }
+                }
+            }
+        }
+
+        for (UInt32 run = 0; run < 2; run++)
+        {
+            InitClipKernelState(&state);
+            SetClipEq(&state, &eq, numChannels);
+            UpdateClipRoute(&state);
+            RunClipStage(GetClipEq(run ? type : kClipKernelScalar, numChannels), in, run ? out : ref, SELFTEST_FRAMES, numChannels, &state);
+        }
+
+        if (state.eq.numSections != 3 || __builtin_memcmp(ref, out, numSamples * sizeof(float)) != 0)
+        {
+            IOLog("ClipKernelsSelfTest: %s EQ mismatch (%u channels, %u sections)\n",
+                  ClipKernelName(type), (unsigned int) numChannels, (unsigned int) state.eq.numSections);
+            result = false;
+        }
+
+        // Silence rings the filters out
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            ref[i] = 0.0f;
+        }
+        settled = ClipEqSettled(&state);
+        RunClipStage(GetClipEq(type, numChannels), ref, out, SELFTEST_FRAMES, numChannels, &state);
+        if (settled || !ClipEqSettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s EQ doesn't settle (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            for (UInt32 section = 0; section < CLIP_EQ_SECTIONS; section++)
+            {
+                for (UInt32 k = 0; k < 5; k++)
+                {
+                    eq.coef[slot][section][k] = (k == 0) ? CLIP_EQ_UNITY : 0;
+                }
+            }
+        }
+        SetClipEq(&state, &eq, numChannels);
+        UpdateClipRoute(&state);
+        if (state.eq.numSections != 0) {
+            IOLog("ClipKernelsSelfTest: %s EQ doesn't turn off (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        eq.coef[numChannels - 1][1][0] = CLIP_EQ_UNITY / 2;
+        SetClipEq(&state, &eq, numChannels);
+        UpdateClipRoute(&state);
+        RunClipStage(GetClipEq(type, numChannels), in, out, SELFTEST_FRAMES, numChannels, &state);
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            float expected = (i % numChannels == numChannels - 1) ? in[i] * 0.5f : in[i];
+
+            if (__builtin_memcmp(&out[i], &expected, sizeof(float)) != 0)
+            {
+                IOLog("ClipKernelsSelfTest: %s EQ gain wrong at %u (%u channels)\n", ClipKernelName(type), (unsigned int) i, (unsigned int) numChannels);
+                result = false;
+                break;
+            }
+        }
+    }
+
+Done:
+    if (in) {
+        IOFree(in, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (ref) {
+        IOFree(ref, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (out) {
+        IOFree(out, SELFTEST_SAMPLES * sizeof(float));
+    }
+
+    return result;
+}
+
+#define BASS_TEST_FRAMES 8195
+#define BASS_TEST_PERIODS 4800	// the last 8 periods of 80Hz at 48kHz
+
+// Runs the kernels against the scalar one bit for bit at a crossover of 80Hz, and checks what the
+// crossover is there for: an impulse on a managed slot keeps its energy across it and the LFE slot
+// (the two sides add up to an allpass), DC ends up in the LFE slot and Nyquist stays where it was,
+// a sine at the crossover comes out 6dB down on both, slots that aren't managed are left alone, it
+// rings out, and it turns off
+static bool ClipBassSelfTest(ClipKernelType type)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    const UInt32 bytes = BASS_TEST_FRAMES * CLIP_KERNEL_MAX_CHANNELS * sizeof(float);
+    float *in = (float *) IOMalloc(bytes);
+    float *ref = (float *) IOMalloc(bytes);
+    float *out = (float *) IOMalloc(bytes);
+    ClipKernelState state;
+    ClipBass bass;
+    UInt32 seed = 0x5a5a1234;
+    bool result = false;
+
+    if (!in || !ref || !out) {
+        goto Done;
+    }
+
+    result = true;
+    if (type == kClipKernelInteger) {
+        goto Done;
+    }
+
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = BASS_TEST_FRAMES * numChannels;
+        UInt32 last = (BASS_TEST_FRAMES - 1) * numChannels;
+        ClipBassFunc kernel = GetClipBass(type, numChannels);
+        bool settled;
+
+        // 5.1 and 7.1 with the last surround left alone, stereo with the right slot as the LFE
+        bass.frequency = 80;
+        bass.sampleRate = 48000;
+        bass.lfeSlot = (numChannels > 2) ? 3 : 1;
+        bass.managed = (numChannels > 2) ? 0xffU & ~(1U << (numChannels - 1)) : 1;
+
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            in[i] = ((SInt32) seed) * (1.0f / 2147483648.0f);
+        }
+
+        for (UInt32 run = 0; run < 2; run++)
+        {
+            InitClipKernelState(&state);
+            SetClipBass(&state, &bass, numChannels);
+            UpdateClipRoute(&state);
+            RunClipStage(GetClipBass(run ? type : kClipKernelScalar, numChannels), in, run ? out : ref, BASS_TEST_FRAMES, numChannels, &state);
+        }
+
+        if (!state.bassTable.on || __builtin_memcmp(ref, out, numSamples * sizeof(float)) != 0)
+        {
+            IOLog("ClipKernelsSelfTest: %s bass management mismatch (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+        for (UInt32 i = numChannels - 1; numChannels > 2 && i < numSamples; i += numChannels)
+        {
+            if (__builtin_memcmp(&out[i], &in[i], sizeof(float)) != 0)
+            {
+                IOLog("ClipKernelsSelfTest: %s bass management touches slot %u (%u channels)\n",
+                      ClipKernelName(type), (unsigned int) (numChannels - 1), (unsigned int) numChannels);
+                result = false;
+                break;
+            }
+        }
+
+        // Silence rings the filters out
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            in[i] = 0.0f;
+        }
+        settled = ClipBassSettled(&state);
+        RunClipStage(kernel, in, out, BASS_TEST_FRAMES, numChannels, &state);
+        if (settled || !ClipBassSettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s bass management doesn't settle (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        // An impulse, DC, Nyquist and a sine at the crossover on the first slot
+        for (UInt32 signal = 0; signal < 4; signal++)
+        {
+            double energy = 0.0, sine, cosine, re = 1.0, im = 0.0;
+            float error;
+
+            SinCos(CLIP_PI * 2 * bass.frequency / bass.sampleRate, &sine, &cosine);
+            for (UInt32 frame = 0; frame < BASS_TEST_FRAMES; frame++)
+            {
+                double next = re * cosine - im * sine;
+
+                in[frame * numChannels] = (signal == 0) ? ((frame == 0) ? 1.0f : 0.0f) :
+                                          ((signal == 3) ? (float) im : ((signal == 1 || !(frame & 1)) ? 0.5f : -0.5f));
+                im = re * sine + im * cosine;
+                re = next;
+            }
+            InitClipKernelState(&state);
+            SetClipBass(&state, &bass, numChannels);
+            UpdateClipRoute(&state);
+            RunClipStage(kernel, in, out, BASS_TEST_FRAMES, numChannels, &state);
+
+            if (signal == 0)
+            {
+                for (UInt32 frame = 0; frame < BASS_TEST_FRAMES; frame++)
+                {
+                    double sum = (double) out[frame * numChannels] + out[frame * numChannels + bass.lfeSlot];
+
+                    energy += sum * sum;
+                }
+                error = (float) (energy - 1.0);
+            }
+            else if (signal == 1)
+            {
+                error = Abs(out[last]) + Abs(out[last + bass.lfeSlot] - 0.5f);
+            }
+            else if (signal == 2)
+            {
+                error = Abs(out[last] - in[last]) + Abs(out[last + bass.lfeSlot]);
+            }
+            else
+            {
+                double lfe = 0.0;
+
+                for (UInt32 frame = BASS_TEST_FRAMES - BASS_TEST_PERIODS; frame < BASS_TEST_FRAMES; frame++)
+                {
+                    energy += (double) out[frame * numChannels] * out[frame * numChannels];
+                    lfe += (double) out[frame * numChannels + bass.lfeSlot] * out[frame * numChannels + bass.lfeSlot];
+                }
+                error = Abs((float) (energy / BASS_TEST_PERIODS - 0.125)) + Abs((float) (lfe / BASS_TEST_PERIODS - 0.125));
+            }
+            if (!(Abs(error) < 1.0e-4f))
+            {
+                IOLog("ClipKernelsSelfTest: %s bass management crossover off by %d ppm (signal %u, %u channels)\n",
+                      ClipKernelName(type), (int) (error * 1.0e6f), (unsigned int) signal, (unsigned int) numChannels);
+                result = false;
+            }
+        }
+
+        bass.frequency = 0;
+        SetClipBass(&state, &bass, numChannels);
+        UpdateClipRoute(&state);
+        if (state.bassTable.on || !ClipBassSettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s bass management doesn't turn off (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+    }
+
+Done:
+    if (in) {
+        IOFree(in, bytes);
+    }
+    if (ref) {
+        IOFree(ref, bytes);
+    }
+    if (out) {
+        IOFree(out, bytes);
+    }
+
+    return result;
+}
+
+#define DELAY_TEST_FRAMES (CLIP_DELAY_FRAMES * 2 + 77)
+#define DELAY_TEST_CHANGE 100
+
+// Checks every slot against its input as many frames back bit for bit, around the ring a couple of
+// times, that a delay that changes finds the history it needs, that the lines ring out after the
+// longest delay, and that they start over silent when they come back on
+static bool ClipDelaySelfTest(ClipKernelType type)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    static const UInt32 delays[CLIP_KERNEL_MAX_CHANNELS] = { 0, 1, 63, 64, 1000, CLIP_DELAY_MAX, 7, 2049 };
+    const UInt32 bytes = DELAY_TEST_FRAMES * CLIP_KERNEL_MAX_CHANNELS * sizeof(float);
+    float *in = (float *) IOMalloc(bytes);
+    float *out = (float *) IOMalloc(bytes);
+    void *memory = IOMallocAligned(ClipDelaySize(CLIP_KERNEL_MAX_CHANNELS), 64);
+    ClipKernelState state;
+    ClipDelay delay;
+    UInt32 seed = 0x0de1a7ed;
+    bool result = false;
+
+    if (!in || !out || !memory) {
+        goto Done;
+    }
+
+    result = true;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = DELAY_TEST_FRAMES * numChannels;
+        ClipDelayFunc kernel = GetClipDelay(type, numChannels);
+        UInt32 maxDelay = 0;
+        bool settled;
+
+        // Any bits, NaNs included, go through as they are
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            ((UInt32 *) in)[i] = seed;
+        }
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            delay.frames[slot] = (slot < numChannels) ? delays[slot] : 0;
+            maxDelay = (delay.frames[slot] > maxDelay) ? delay.frames[slot] : maxDelay;
+        }
+
+        InitClipKernelState(&state);
+        state.delayLines = InitClipDelay(memory, numChannels);
+        SetClipDelay(&state, &delay, numChannels);
+        UpdateClipRoute(&state);
+        RunClipStage(kernel, in, out, DELAY_TEST_FRAMES, numChannels, &state);
+
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            UInt32 frames = delay.frames[i % numChannels];
+            UInt32 expected = (i / numChannels >= frames) ? ((const UInt32 *) in)[i - frames * numChannels] : 0;
+
+            if (!ClipDelayActive(&state) || ((const UInt32 *) out)[i] != expected)
+            {
+                IOLog("ClipKernelsSelfTest: %s delay wrong at %u (%u channels)\n", ClipKernelName(type), (unsigned int) i, (unsigned int) numChannels);
+                result = false;
+                break;
+            }
+        }
+
+        // The next chunk with a shorter delay everywhere
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            delay.frames[slot] = DELAY_TEST_CHANGE;
+        }
+        SetClipDelay(&state, &delay, numChannels);
+        UpdateClipRoute(&state);
+        RunClipStage(kernel, in, out, CLIP_STAGE_FRAMES, numChannels, &state);
+        for (UInt32 i = 0; i < CLIP_STAGE_FRAMES * numChannels; i++)
+        {
+            if (((const UInt32 *) out)[i] != ((const UInt32 *) in)[numSamples - DELAY_TEST_CHANGE * numChannels + i])
+            {
+                IOLog("ClipKernelsSelfTest: %s delay loses its history at %u (%u channels)\n", ClipKernelName(type), (unsigned int) i, (unsigned int) numChannels);
+                result = false;
+                break;
+            }
+        }
+
+        // Silence is through after the longest delay, one frame less isn't enough
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            in[i] = 0.0f;
+        }
+        RunClipStage(kernel, in, out, DELAY_TEST_CHANGE - 1, numChannels, &state);
+        settled = ClipDelaySettled(&state);
+        RunClipStage(kernel, in, out, 1, numChannels, &state);
+        if (settled || !ClipDelaySettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s delay doesn't settle (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        // Off, on again after sound went by, and nothing but silence comes out
+        delay.frames[0] = 0;
+        SetClipDelay(&state, &delay, 1);
+        UpdateClipRoute(&state);
+        if (ClipDelayActive(&state) || !ClipDelaySettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s delay doesn't turn off (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            state.delayLines->ring[i % (CLIP_DELAY_FRAMES * numChannels)] = 0x3f800000;
+        }
+        delay.frames[0] = maxDelay;
+        SetClipDelay(&state, &delay, numChannels);
+        UpdateClipRoute(&state);
+        RunClipStage(kernel, in, out, DELAY_TEST_FRAMES, numChannels, &state);
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            if (((const UInt32 *) out)[i] != 0)
+            {
+                IOLog("ClipKernelsSelfTest: %s delay doesn't start silent at %u (%u channels)\n", ClipKernelName(type), (unsigned int) i, (unsigned int) numChannels);
+                result = false;
+                break;
+            }
+        }
+    }
+
+Done:
+    if (in) {
+        IOFree(in, bytes);
+    }
+    if (out) {
+        IOFree(out, bytes);
+    }
+    if (memory) {
+        IOFreeAligned(memory, ClipDelaySize(CLIP_KERNEL_MAX_CHANNELS));
+    }
+
+    return result;
+}
+
+#define OVERSAMPLE_TEST_FRAMES (CLIP_STAGE_FRAMES * 6 + 19)
+#define OVERSAMPLE_TEST_RING 256
+
+// Runs an upsampler chunk by chunk, ratio frames out for every frame that goes in
+static void RunClipUpsample(ClipUpsampleFunc upsample, const float *mixBuf, float *destBuf, UInt32 numSampleFrames, UInt32 numChannels,
+                            UInt32 ratio, ClipKernelState *state)
+{
+    for (UInt32 done = 0; done < numSampleFrames; done += CLIP_STAGE_FRAMES)
+    {
+        UInt32 count = (numSampleFrames - done < CLIP_STAGE_FRAMES) ? numSampleFrames - done : CLIP_STAGE_FRAMES;
+
+        upsample(&mixBuf[done * numChannels], &destBuf[done * numChannels * ratio], count, state);
+    }
+}
+
+// Runs the upsampler against the scalar one bit for bit and checks that the frames that went in
+// come out again half the taps later. DC and a tone at 0.4 of the rate have to come out right in
+// between them too, which they can't with the images left over, and the history has to ring out.
+// The decimator goes around a ring against its scalar kernel, takes DC through unchanged and
+// keeps a tone above the new Nyquist out.
+static bool ClipOversampleSelfTest(ClipKernelType type)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    static const UInt32 tapCounts[] = { CLIP_OVERSAMPLE_TAPS, 24 };
+    const UInt32 bytes = OVERSAMPLE_TEST_FRAMES * CLIP_OVERSAMPLE_MAX * CLIP_KERNEL_MAX_CHANNELS * sizeof(float);
+    float *in = (float *) IOMalloc(bytes);
+    float *ref = (float *) IOMalloc(bytes);
+    float *out = (float *) IOMalloc(bytes);
+    ClipKernelState state;
+    ClipDecimator decimator;
+    ClipMeterState meter;
+    ClipOversample oversample;
+    UInt32 seed = 0x0b5e0a11;
+    bool result = false;
+
+    if (!in || !ref || !out) {
+        goto Done;
+    }
+
+    result = true;
+    if (type == kClipKernelInteger) {
+        goto Done;
+    }
+
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = OVERSAMPLE_TEST_FRAMES * numChannels;
+
+        for (UInt32 ratio = 2; ratio <= CLIP_OVERSAMPLE_MAX; ratio *= 2)
+        {
+            bool settled;
+
+            for (UInt32 t = 0; t < sizeof(tapCounts) / sizeof(tapCounts[0]); t++)
+            {
+                UInt32 delay = tapCounts[t] / 2;
+
+                oversample.ratio = ratio;
+                oversample.taps = tapCounts[t];
+                for (UInt32 i = 0; i < numSamples; i++)
+                {
+                    seed = seed * 1664525 + 1013904223;
+                    in[i] = ((SInt32) seed) * (1.0f / 2147483648.0f);
+                }
+                for (UInt32 run = 0; run < 2; run++)
+                {
+                    InitClipKernelState(&state);
+                    SetClipOversample(&state, &oversample);
+                    UpdateClipRoute(&state);
+                    RunClipUpsample(GetClipUpsample(run ? type : kClipKernelScalar, numChannels), in, run ? out : ref, OVERSAMPLE_TEST_FRAMES,
+                                    numChannels, ratio, &state);
+                }
+
+                for (UInt32 i = 0; i < numSamples * ratio; i++)
+                {
+                    UInt32 frame = i / (numChannels * ratio), phase = i / numChannels % ratio;
+                    UInt32 expected = (frame >= delay) ? ((const UInt32 *) in)[(frame - delay) * numChannels + i % numChannels] : 0;
+
+                    if (((const UInt32 *) out)[i] != ((const UInt32 *) ref)[i] || (phase == 0 && ((const UInt32 *) out)[i] != expected))
+                    {
+                        IOLog("ClipKernelsSelfTest: %s oversampling mismatch at %u (%u channels, %ux, %u taps)\n", ClipKernelName(type),
+                              (unsigned int) i, (unsigned int) numChannels, (unsigned int) ratio, (unsigned int) tapCounts[t]);
+                        result = false;
+                        break;
+                    }
+                }
+            }
+
+            // A tone at 0.4 of the rate (19.2kHz at 48kHz) and then DC on every slot, against the
+            // same tone at the new rate once the filter is full
+            for (UInt32 signal = 0; signal < 2; signal++)
+            {
+                double sine, cosine, re = 0.5, im = 0.0;
+                float error = 0.0f;
+
+                SinCos((signal == 0) ? CLIP_PI * 0.8 / ratio : 0.0, &sine, &cosine);
+                for (UInt32 frame = 0; frame < OVERSAMPLE_TEST_FRAMES * ratio; frame++)
+                {
+                    double next = re * cosine - im * sine;
+
+                    for (UInt32 channel = 0; channel < numChannels; channel++)
+                    {
+                        if (frame % ratio == 0) {
+                            in[frame / ratio * numChannels + channel] = (float) re;
+                        }
+                    }
+                    ref[frame] = (float) re;
+                    im = re * sine + im * cosine;
+                    re = next;
+                }
+
+                oversample.ratio = ratio;
+                oversample.taps = CLIP_OVERSAMPLE_TAPS;
+                InitClipKernelState(&state);
+                SetClipOversample(&state, &oversample);
+                UpdateClipRoute(&state);
+                RunClipUpsample(GetClipUpsample(type, numChannels), in, out, OVERSAMPLE_TEST_FRAMES, numChannels, ratio, &state);
+
+                for (UInt32 frame = CLIP_OVERSAMPLE_TAPS * ratio; frame < OVERSAMPLE_TEST_FRAMES * ratio; frame++)
+                {
+                    for (UInt32 channel = 0; channel < numChannels; channel++)
+                    {
+                        float difference = Abs(out[frame * numChannels + channel] - ref[frame - CLIP_OVERSAMPLE_TAPS / 2 * ratio]);
+
+                        error = (difference > error) ? difference : error;
+                    }
+                }
+                if (!(error < 1.0e-4f))
+                {
+                    IOLog("ClipKernelsSelfTest: %s oversampling off by %d ppm (signal %u, %u channels, %ux)\n", ClipKernelName(type),
+                          (int) (error * 1.0e6f), (unsigned int) signal, (unsigned int) numChannels, (unsigned int) ratio);
+                    result = false;
+                }
+            }
+
+            // Silence is through after the taps but one, one frame less isn't enough
+            for (UInt32 i = 0; i < numSamples; i++)
+            {
+                in[i] = 0.0f;
+            }
+            RunClipUpsample(GetClipUpsample(type, numChannels), in, out, CLIP_OVERSAMPLE_TAPS - 2, numChannels, ratio, &state);
+            settled = ClipOversampleSettled(&state);
+            RunClipUpsample(GetClipUpsample(type, numChannels), in, out, 1, numChannels, ratio, &state);
+            if (settled || !ClipOversampleSettled(&state))
+            {
+                IOLog("ClipKernelsSelfTest: %s oversampling doesn't settle (%u channels, %ux)\n", ClipKernelName(type),
+                      (unsigned int) numChannels, (unsigned int) ratio);
+                result = false;
+            }
+
+            oversample.ratio = 1;
+            SetClipOversample(&state, &oversample);
+            UpdateClipRoute(&state);
+            if (state.oversampleTable.ratio != 1 || !ClipOversampleSettled(&state))
+            {
+                IOLog("ClipKernelsSelfTest: %s oversampling doesn't turn off (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+                result = false;
+            }
+        }
+    }
+
+    // The line input, in chunks of the engine's size going around the ring
+    for (UInt32 ratio = 2; ratio <= CLIP_OVERSAMPLE_MAX; ratio *= 2)
+    {
+        SInt32 *ring = (SInt32 *) in;
+
+        oversample.ratio = ratio;
+        oversample.taps = CLIP_OVERSAMPLE_TAPS;
+
+        // Noise against the scalar kernel, then DC and a tone at 0.6 of the new rate, which go
+        // around the ring without a seam
+        for (UInt32 signal = 0; signal < 3; signal++)
+        {
+            double sine, cosine, re = 0.5, im = 0.0;
+            float expected = 0.0f, error = 0.0f;
+
+            SinCos(CLIP_PI * 2 * ((signal == 2) ? 154 / ratio : 0) / OVERSAMPLE_TEST_RING, &sine, &cosine);
+            for (UInt32 frame = 0; frame < OVERSAMPLE_TEST_RING; frame++)
+            {
+                double next = re * cosine - im * sine;
+
+                for (UInt32 channel = 0; channel < 2; channel++)
+                {
+                    seed = seed * 1664525 + 1013904223;
+                    ring[frame * 2 + channel] = (signal == 0) ? (SInt32) seed : (SInt32) (re * 2147483648.0) & ~0xff;
+                }
+                im = re * sine + im * cosine;
+                re = next;
+            }
+            if (signal == 1) {
+                ConvertSInt32ToFloat_Scalar(ring, &expected, 1, 2, &meter);
+            }
+
+            for (UInt32 run = (signal == 0) ? 0 : 1; run < 2; run++)
+            {
+                ClipDecimateFunc decimate = GetClipDecimate(run ? type : kClipKernelScalar, 2);
+
+                SetClipDecimator(&decimator, &oversample, OVERSAMPLE_TEST_RING);
+                InitClipMeters(&meter);
+                for (UInt32 done = 0, count; done < OVERSAMPLE_TEST_FRAMES; done += count)
+                {
+                    count = OVERSAMPLE_TEST_FRAMES - done;
+                    count = (count < CLIP_STAGE_FRAMES) ? count : CLIP_STAGE_FRAMES;
+                    decimate(ring, done * ratio % OVERSAMPLE_TEST_RING, &(run ? out : ref)[done * 2], count, &decimator, &meter);
+                }
+            }
+
+            for (UInt32 i = 0; i < OVERSAMPLE_TEST_FRAMES * 2; i++)
+            {
+                if (signal == 0 && ((const UInt32 *) out)[i] != ((const UInt32 *) ref)[i])
+                {
+                    IOLog("ClipKernelsSelfTest: %s decimator mismatch at %u (%ux)\n", ClipKernelName(type), (unsigned int) i, (unsigned int) ratio);
+                    result = false;
+                    break;
+                }
+                if (signal != 0 && i >= CLIP_OVERSAMPLE_TAPS * 2)
+                {
+                    float difference = Abs(out[i] - expected);
+
+                    error = (difference > error) ? difference : error;
+                }
+            }
+            if (!(error < 1.0e-4f))
+            {
+                IOLog("ClipKernelsSelfTest: %s decimator off by %d ppm (signal %u, %ux)\n", ClipKernelName(type),
+                      (int) (error * 1.0e6f), (unsigned int) signal, (unsigned int) ratio);
+                result = false;
+            }
+        }
+    }
+
+Done:
+    if (in) {
+        IOFree(in, bytes);
+    }
+    if (ref) {
+        IOFree(ref, bytes);
+    }
+    if (out) {
+        IOFree(out, bytes);
+    }
+
+    return result;
+}
+
+#define CONV_TEST_FRAMES (CLIP_CONV_PARTITION * 5 + 37)
+#define CONV_TEST_TAPS 700
+
+// Runs filters of different lengths (and a slot without one) against the scalar kernel bit for
+// bit and against the convolution done the long way, one partition late, checks that they ring
+// out after as many blocks as they're long, and that no filters turn the convolution off
+static bool ClipConvSelfTest(ClipKernelType type)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    static const UInt32 tapCounts[CLIP_KERNEL_MAX_CHANNELS] = { CONV_TEST_TAPS, 0, 1, 256, 257, 40, 512, 3 };
+    const UInt32 numSamples = CONV_TEST_FRAMES * CLIP_KERNEL_MAX_CHANNELS;
+    float *in = (float *) IOMalloc(numSamples * sizeof(float));
+    float *ref = (float *) IOMalloc(numSamples * sizeof(float));
+    float *out = (float *) IOMalloc(numSamples * sizeof(float));
+    float *taps = (float *) IOMalloc(CONV_TEST_TAPS * CLIP_KERNEL_MAX_CHANNELS * sizeof(float));
+    void *memory = IOMallocAligned(ClipConvSize(CLIP_KERNEL_MAX_CHANNELS), 64);
+    const float *tapPointers[CLIP_KERNEL_MAX_CHANNELS];
+    UInt32 numTaps[CLIP_KERNEL_MAX_CHANNELS];
+    ClipKernelState state;
+    UInt32 seed = 0x0badcafe;
+    bool result = false;
+
+    if (!in || !ref || !out || !taps || !memory) {
+        goto Done;
+    }
+
+    result = true;
+    if (type == kClipKernelInteger) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < numSamples; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        in[i] = ((SInt32) seed) * (1.0f / 2147483648.0f);
+    }
+    for (UInt32 i = 0; i < CONV_TEST_TAPS * CLIP_KERNEL_MAX_CHANNELS; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        taps[i] = ((SInt32) seed) * (1.0f / 32.0f / 2147483648.0f);
+    }
+
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numPartitions = 0;
+        double maxError = 0.0;
+        bool settled;
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++)
+        {
+            tapPointers[slot] = &taps[slot * CONV_TEST_TAPS];
+            numTaps[slot] = tapCounts[slot];
+            if (slot < numChannels && (tapCounts[slot] + CLIP_CONV_PARTITION - 1) / CLIP_CONV_PARTITION > numPartitions) {
+                numPartitions = (tapCounts[slot] + CLIP_CONV_PARTITION - 1) / CLIP_CONV_PARTITION;
+            }
+        }
+
+        for (UInt32 run = 0; run < 2; run++)
+        {
+            InitClipKernelState(&state);
+            state.conv = InitClipConv(memory, numChannels);
+
+            // Set twice in a row the second time, while the first filters are still transformed
+            if (run)
+            {
+                const float *otherPointers[CLIP_KERNEL_MAX_CHANNELS];
+
+                for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++) {
+                    otherPointers[slot] = &taps[(CLIP_KERNEL_MAX_CHANNELS - 1 - slot) * CONV_TEST_TAPS];
+                }
+                SetClipConv(state.conv, otherPointers, tapCounts);
+                UpdateClipRoute(&state);
+            }
+            SetClipConv(state.conv, tapPointers, numTaps);
+            for (UInt32 pass = 0; pass < 1000 && (state.conv->sequence & ~CONV_ACTIVE) != state.conv->applied; pass++) {
+                UpdateClipRoute(&state);
+            }
+            RunClipStage(GetClipConv(run ? type : kClipKernelScalar, numChannels), in, run ? out : ref, CONV_TEST_FRAMES, numChannels, &state);
+        }
+
+        if (__builtin_memcmp(ref, out, CONV_TEST_FRAMES * numChannels * sizeof(float)) != 0)
+        {
+            IOLog("ClipKernelsSelfTest: %s convolution mismatch (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        for (UInt32 frame = 0; frame < CONV_TEST_FRAMES; frame++)
+        {
+            for (UInt32 slot = 0; slot < numChannels; slot++)
+            {
+                SInt32 t = (SInt32) frame - CLIP_CONV_PARTITION;
+                double expected = 0.0;
+                double error;
+
+                if (t >= 0 && !numTaps[slot]) {
+                    expected = in[t * numChannels + slot];
+                }
+                for (SInt32 j = 0; j < (SInt32) numTaps[slot] && j <= t; j++) {
+                    expected += (double) tapPointers[slot][j] * in[(t - j) * numChannels + slot];
+                }
+                error = out[frame * numChannels + slot] - expected;
+                if (error < 0) {
+                    error = -error;
+                }
+                if (error > maxError) {
+                    maxError = error;
+                }
+            }
+        }
+        if (maxError > 1.0e-5)
+        {
+            IOLog("ClipKernelsSelfTest: %s convolution off by %d ppm (%u channels)\n", ClipKernelName(type),
+                  (int) (maxError * 1.0e6), (unsigned int) numChannels);
+            result = false;
+        }
+
+        // Silence for as long as the filters and one block rings them out
+        __builtin_memset(ref, 0, (numPartitions + 2) * CLIP_CONV_PARTITION * numChannels * sizeof(float));
+        settled = ClipConvSettled(&state);
+        RunClipStage(GetClipConv(type, numChannels), ref, out, (numPartitions + 2) * CLIP_CONV_PARTITION, numChannels, &state);
+        if (settled || !ClipConvSettled(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s convolution doesn't settle (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        // Above CLIP_CONV_FULL_RATE the filters run as if they were that much shorter
+        for (UInt32 run = 0; run < 2; run++)
+        {
+            UInt32 cutTaps[CLIP_KERNEL_MAX_CHANNELS];
+
+            for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++) {
+                cutTaps[slot] = (run || numTaps[slot] < 2 * CLIP_CONV_PARTITION) ? numTaps[slot] : 2 * CLIP_CONV_PARTITION;
+            }
+            InitClipKernelState(&state);
+            state.conv = InitClipConv(memory, numChannels);
+            SetClipConvRate(state.conv, run ? CLIP_CONV_FULL_RATE * (CLIP_CONV_MAX_PARTITIONS / 2) : CLIP_CONV_FULL_RATE);
+            SetClipConv(state.conv, tapPointers, cutTaps);
+            for (UInt32 pass = 0; pass < 1000 && !ClipConvActive(&state); pass++) {
+                UpdateClipRoute(&state);
+            }
+            RunClipStage(GetClipConv(type, numChannels), in, run ? out : ref, CONV_TEST_FRAMES, numChannels, &state);
+        }
+        if (__builtin_memcmp(ref, out, CONV_TEST_FRAMES * numChannels * sizeof(float)) != 0)
+        {
+            IOLog("ClipKernelsSelfTest: %s convolution isn't cut above the full rate (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+
+        for (UInt32 slot = 0; slot < CLIP_KERNEL_MAX_CHANNELS; slot++) {
+            numTaps[slot] = 0;
+        }
+        SetClipConv(state.conv, tapPointers, numTaps);
+        UpdateClipRoute(&state);
+        if (ClipConvActive(&state))
+        {
+            IOLog("ClipKernelsSelfTest: %s convolution doesn't turn off (%u channels)\n", ClipKernelName(type), (unsigned int) numChannels);
+            result = false;
+        }
+    }
+
+Done:
+    if (in) {
+        IOFree(in, numSamples * sizeof(float));
+    }
+    if (ref) {
+        IOFree(ref, numSamples * sizeof(float));
+    }
+    if (out) {
+        IOFree(out, numSamples * sizeof(float));
+    }
+    if (taps) {
+        IOFree(taps, CONV_TEST_TAPS * CLIP_KERNEL_MAX_CHANNELS * sizeof(float));
+    }
+    if (memory) {
+        IOFreeAligned(memory, ClipConvSize(CLIP_KERNEL_MAX_CHANNELS));
+    }
+
+    return result;
+}
+
+// Checks the S/PDIF feed at mixed software gains: the last pair has to come out exactly like those
+// DMA slots, and a downmix has to match the scalar kernel bit for bit (not on the integer kernels,
+// they don't sum).
+static bool ClipSpdifSelfTest(ClipKernelType type, const float *mix)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    SInt32 *samples = (SInt32 *) IOMalloc((SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    SInt32 *ref = (SInt32 *) IOMalloc(SELFTEST_FRAMES * 2 * sizeof(SInt32));
+    SInt32 *out = (SInt32 *) IOMalloc(SELFTEST_FRAMES * 2 * sizeof(SInt32));
+    ClipKernelState state;
+    ClipRoute route;
+    bool result = false;
+
+    if (!samples || !ref || !out) {
+        goto Done;
+    }
+
+    result = true;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+
+        for (UInt32 mode = kClipRoutePermutation; mode <= kClipRouteMatrix; mode++)
+        {
+            if (mode == kClipRouteMatrix && (type == kClipKernelInteger || numChannels == 2)) {
+                continue;
+            }
+
+            // The last pair, or the ITU downmix with the LFE thrown in
+            for (UInt32 side = 0; side < 2; side++)
+            {
+                for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+                {
+                    route.gain[side][channel] = (channel == numChannels - 2 + side) ? CLIP_ROUTE_UNITY : 0;
+                }
+                if (mode == kClipRouteMatrix)
+                {
+                    route.gain[side][side] = CLIP_ROUTE_UNITY;
+                    route.gain[side][2] = 46341;
+                    route.gain[side][3] = CLIP_ROUTE_UNITY / 2;
+                    route.gain[side][4 + side] = 46341;
+                }
+            }
+
+            // The clip kernel jumps to the gains without a ramp
+            InitClipKernelState(&state);
+            for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+            {
+                SetClipGain(&state, i, (i == 3) ? 0 : CLIP_GAIN_MAX - 9 * i);
+            }
+            GetClipKernel(kClipKernelScalar, numChannels, false, kClipDitherNone)(mix, samples, &samples[SELFTEST_FRAMES * numChannels], 0,
+                                                                                  SELFTEST_FRAMES, &state);
+            SetClipSpdif(&state, &route, numChannels);
+            UpdateClipRoute(&state);
+
+            GetSpdifKernel(kClipKernelScalar, numChannels)(mix, ref, SELFTEST_FRAMES, &state);
+            GetSpdifKernel(type, numChannels)(mix, out, SELFTEST_FRAMES, &state);
+
+            for (UInt32 i = 0; i < SELFTEST_FRAMES * 2; i++)
+            {
+                SInt32 expected = (mode == kClipRoutePermutation) ? samples[i / 2 * numChannels + numChannels - 2 + i % 2] : ref[i];
+
+                if (out[i] != ref[i] || out[i] != expected)
+                {
+                    IOLog("ClipKernelsSelfTest: %s S/PDIF %s mismatch at %u (%u channels)\n",
+                          ClipKernelName(type), (mode == kClipRoutePermutation) ? "pair" : "downmix", (unsigned int) i, (unsigned int) numChannels);
+                    result = false;
+                    break;
+                }
+            }
+        }
+    }
+
+Done:
+    if (samples) {
+        IOFree(samples, (SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    }
+    if (ref) {
+        IOFree(ref, SELFTEST_FRAMES * 2 * sizeof(SInt32));
+    }
+    if (out) {
+        IOFree(out, SELFTEST_FRAMES * 2 * sizeof(SInt32));
+    }
+
+    return result;
+}
+
+// The peaks and the overs have to match the scalar kernel exactly, the sums of squares are added
+// up in a different order and only have to give the same RMS to within 0.1 dB. A square wave at half
+// scale has to read -6.02 dB on both meters, and the peak has to fall by the decay after that.
+static bool ClipMetersSelfTest(ClipKernelType type, const float *mix)
+{
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    SInt32 *samples = (SInt32 *) IOMalloc((SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    float *half = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    ClipKernelState state;
+    ClipMeters ref, out;
+    bool result = false;
+
+    if (!samples || !half) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < SELFTEST_SAMPLES; i++)
+    {
+        half[i] = (i / 8 % 2) ? -0.5f : 0.5f;
+    }
+
+    result = true;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        SInt32 decay = ((SELFTEST_FRAMES << 12) / 48000) * CLIP_METER_DECAY * 16;
+
+        for (UInt32 run = 0; run < 2; run++)
+        {
+            ClipMeters *meters = run ? &out : &ref;
+
+            InitClipKernelState(&state);
+            for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+            {
+                SetClipGain(&state, i, (i == 3) ? 0 : CLIP_GAIN_MAX - 9 * i);
+            }
+            GetClipKernel(run ? type : kClipKernelScalar, numChannels, true, kClipDitherNone)(mix, samples, &samples[SELFTEST_FRAMES * numChannels],
+                                                                                               0, SELFTEST_FRAMES, &state);
+            PublishClipMeters(&state.meter, numChannels, SELFTEST_FRAMES, 48000, 1);
+            ReadClipMeters(&state.meter, meters);
+        }
+
+        for (UInt32 channel = 0; channel < CLIP_KERNEL_MAX_CHANNELS; channel++)
+        {
+            SInt32 difference = out.rms[channel] - ref.rms[channel];
+
+            if (out.peak[channel] != ref.peak[channel] || difference > 6554 || difference < -6554 ||
+                out.overs[channel] != ref.overs[channel] || out.maxOvershoot[channel] != ref.maxOvershoot[channel] ||
+                out.lastOver[channel] != (out.overs[channel] ? 1 : 0) ||
+                (channel >= numChannels && out.peak[channel] != CLIP_METER_FLOOR) || (channel == 0 && !out.overs[channel]))
+            {
+                IOLog("ClipKernelsSelfTest: %s meter mismatch on channel %u (%u channels): peak %d != %d, rms %d != %d, overs %u != %u\n",
+                      ClipKernelName(type), (unsigned int) channel, (unsigned int) numChannels,
+                      (int) out.peak[channel], (int) ref.peak[channel], (int) out.rms[channel], (int) ref.rms[channel],
+                      (unsigned int) out.overs[channel], (unsigned int) ref.overs[channel]);
+                result = false;
+                break;
+            }
+        }
+
+        InitClipKernelState(&state);
+        GetClipKernel(type, numChannels, false, kClipDitherNone)(half, samples, &samples[SELFTEST_FRAMES * numChannels], 0, SELFTEST_FRAMES, &state);
+        PublishClipMeters(&state.meter, numChannels, SELFTEST_FRAMES, 48000, 1);
+        ReadClipMeters(&state.meter, &ref);
+        PublishClipMeters(&state.meter, numChannels, SELFTEST_FRAMES, 48000, 1);
+        ReadClipMeters(&state.meter, &out);
+
+        for (UInt32 channel = 0; channel < numChannels; channel++)
+        {
+            SInt32 peak = ref.peak[channel] + 394566, rms = ref.rms[channel] + 394566;
+
+            if (peak > 6554 || peak < -6554 || rms > 6554 || rms < -6554 ||
+                out.peak[channel] != ref.peak[channel] - decay || out.rms[channel] != CLIP_METER_FLOOR)
+            {
+                IOLog("ClipKernelsSelfTest: %s meter off on channel %u (%u channels): peak %d then %d, rms %d then %d\n",
+                      ClipKernelName(type), (unsigned int) channel, (unsigned int) numChannels,
+                      (int) ref.peak[channel], (int) out.peak[channel], (int) ref.rms[channel], (int) out.rms[channel]);
+                result = false;
+                break;
+            }
+        }
+    }
+
+Done:
+    if (samples) {
+        IOFree(samples, (SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    }
+    if (half) {
+        IOFree(half, SELFTEST_SAMPLES * sizeof(float));
+    }
+
+    return result;
+}
+
+// Hides the smallest denormal, of either sign, at a number of places in a buffer of zeros of both
+// signs, and checks that the silence scan finds it exactly when it's in the range scanned
+static bool ClipSilenceSelfTest(ClipKernelType type)
+{
+    UInt32 *mixBits = (UInt32 *) IOMalloc(SELFTEST_SAMPLES * sizeof(UInt32));
+    SilenceKernelFunc scan = GetSilenceKernel(type);
+    bool result = false;
+
+    if (!mixBits) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < SELFTEST_SAMPLES; i++)
+    {
+        mixBits[i] = (i % 3) ? 0 : 0x80000000;
+    }
+
+    result = true;
+    for (UInt32 position = 0; position < SELFTEST_SAMPLES && result; position += 37)
+    {
+        mixBits[position] |= 1;
+        for (UInt32 offset = 0; offset < 4; offset++)
+        {
+            UInt32 numSamples = SELFTEST_SAMPLES - 4 - position % 5;
+            bool silent = position < offset || position >= offset + numSamples;
+
+            if (scan((const float *) &mixBits[offset], numSamples) != silent ||
+                (position > offset && !scan((const float *) &mixBits[offset], position - offset)))
+            {
+                IOLog("ClipKernelsSelfTest: %s silence scan wrong at %u (offset %u)\n",
+                      ClipKernelName(type), (unsigned int) position, (unsigned int) offset);
+                result = false;
+                break;
+            }
+        }
+        mixBits[position] &= ~1U;
+    }
+
+Done:
+    if (mixBits) {
+        IOFree(mixBits, SELFTEST_SAMPLES * sizeof(UInt32));
+    }
+
+    return result;
+}
+
+// Compares a kernel against the scalar reference for every channel count the cards use, at unity
+// and at mixed software gains, checking both the DMA and the S/PDIF buffer. The pattern covers the
+// clip points, values just inside and outside of them, signed zeros and pseudo random samples
+// beyond full scale.
+static bool ClipKernelsSelfTest(ClipKernelType type)
+{
+    static const float edges[] = { 1.0f, -1.0f, 0.0f, -0.0f, 1.0000001f, -1.0000001f, 0.99999994f, -0.99999994f,
+                                   0.5f, -0.5f, 1.0e-10f, -1.0e-10f, 4.0f, -4.0f, 1.0e30f, -1.0e30f };
+    static const UInt32 channelCounts[] = { 2, 6, 8 };
+    float *mix = (float *) IOMalloc(SELFTEST_SAMPLES * sizeof(float));
+    SInt32 *ref = (SInt32 *) IOMalloc((SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    // Aligned like the DMA buffers, so the streaming kernels actually stream
+    SInt32 *out = (SInt32 *) IOMallocAligned((SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32), 512);
+    ClipKernelState state;
+    UInt32 seed = 0x12345678;
+    bool result = false;
+
+    if (!mix || !ref || !out) {
+        goto Done;
+    }
+
+    for (UInt32 i = 0; i < SELFTEST_SAMPLES; i++)
+    {
+        if (i < sizeof(edges) / sizeof(edges[0]))
+        {
+            mix[i] = edges[i];
+        }
+        else
+        {
+            seed = seed * 1664525 + 1013904223;
+            mix[i] = ((SInt32) seed) * (1.5f / 2147483648.0f);
+        }
+    }
+
+    result = ClipStagesSelfTest(type, mix);
+    result = ClipRoutesSelfTest(type, mix) && result;
+    result = ClipBassSelfTest(type) && result;
+    result = ClipEqSelfTest(type) && result;
+    result = ClipConvSelfTest(type) && result;
+    result = ClipDelaySelfTest(type) && result;
+    result = ClipOversampleSelfTest(type) && result;
+    result = ClipSpdifSelfTest(type, mix) && result;
+    result = ClipMetersSelfTest(type, mix) && result;
+    result = ClipSilenceSelfTest(type) && result;
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+
+        ClipKernelFunc reference = GetClipKernel(kClipKernelScalar, numChannels, false, kClipDitherNone);
+
+        // At unity gain, then with a different software volume on every channel (one of them muted)
+        for (UInt32 levels = 0; levels < 2; levels++)
+        {
+            InitClipKernelState(&state);
+            for (UInt32 i = 0; levels && i < CLIP_KERNEL_MAX_CHANNELS; i++)
+            {
+                SetClipGain(&state, i, (i == 3) ? 0 : CLIP_GAIN_MAX - 9 * i);
+            }
+
+            for (UInt32 streaming = 0; streaming < 2; streaming++)
+            {
+                ClipKernelFunc kernel = GetClipKernel(type, numChannels, streaming, kClipDitherNone);
+
+                // Run at different frame offsets so unaligned heads are covered as well
+                for (UInt32 offset = 0; offset < 4; offset++)
+                {
+                    UInt32 first = offset * numChannels;
+
+                    reference(mix, ref, &ref[numSamples], offset, SELFTEST_FRAMES - offset, &state);
+                    kernel(mix, out, &out[numSamples], offset, SELFTEST_FRAMES - offset, &state);
+
+                    for (UInt32 i = first; i < numSamples + SELFTEST_FRAMES * 2; i++)
+                    {
+                        if (ref[i] != out[i])
+                        {
+                            IOLog("ClipKernelsSelfTest: %s%s mismatch at %u (%u channels, offset %u, %s gain): %d != %d\n",
+                                  ClipKernelName(type), streaming ? " streaming" : "", (unsigned int) i,
+                                  (unsigned int) numChannels, (unsigned int) offset, levels ? "software" : "unity",
+                                  (int) out[i], (int) ref[i]);
+                            result = false;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // The ramps take a different path through the float math in the block loops, so the vector
+    // kernels only have to be close to the scalar ones while ramping. Once the ramp is done they're
+    // back to the exact target gains. The calls don't line up with the ramp on purpose.
+    for (UInt32 c = 0; type != kClipKernelInteger && c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+
+        for (UInt32 shape = kClipRampLinear; shape <= kClipRampExponential; shape++)
+        {
+            for (UInt32 run = 0; run < 2; run++)
+            {
+                ClipKernelFunc kernel = GetClipKernel(run ? type : kClipKernelScalar, numChannels, true, kClipDitherNone);
+
+                InitClipKernelState(&state);
+                SetClipRamp(&state, SELFTEST_RAMP_FRAMES, (ClipRampShape) shape);
+                UpdateClipRoute(&state);
+                for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+                {
+                    SetClipGain(&state, i, (i == 3) ? 0 : CLIP_GAIN_MAX - 9 * i);
+                }
+
+                for (UInt32 frame = 0; frame < SELFTEST_FRAMES; frame += 37)
+                {
+                    UInt32 count = (SELFTEST_FRAMES - frame < 37) ? SELFTEST_FRAMES - frame : 37;
+
+                    kernel(mix, run ? out : ref, run ? &out[numSamples] : &ref[numSamples], frame, count, &state);
+                }
+            }
+
+            for (UInt32 i = 0; i < numSamples; i++)
+            {
+                SInt64 difference = (SInt64) out[i] - ref[i];
+                SInt64 limit = (i < SELFTEST_RAMP_FRAMES * numChannels) ? 16384 : 0; // 2^-17 of full scale
+
+                if (difference > limit || difference < -limit)
+                {
+                    IOLog("ClipKernelsSelfTest: %s %s ramp mismatch at %u (%u channels): %d != %d\n",
+                          ClipKernelName(type), ClipRampName((ClipRampShape) shape), (unsigned int) i, (unsigned int) numChannels,
+                          (int) out[i], (int) ref[i]);
+                    result = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    // The dithered output can't be compared bit for bit. It has to be on the 24 bit grid, within the
+    // dither (+-1 LSB plus rounding, another 1.5 LSB of error with the shaper) of the undithered
+    // output, and the S/PDIF buffer has to carry the same dithered samples.
+    for (UInt32 c = 0; c < sizeof(channelCounts) / sizeof(channelCounts[0]); c++)
+    {
+        UInt32 numChannels = channelCounts[c];
+        UInt32 numSamples = SELFTEST_FRAMES * numChannels;
+
+        InitClipKernelState(&state);
+        GetClipKernel(kClipKernelScalar, numChannels, false, kClipDitherNone)(mix, ref, &ref[numSamples], 0, SELFTEST_FRAMES, &state);
+
+        for (UInt32 dither = kClipDitherTPDF; dither <= kClipDitherShaped; dither++)
+        {
+            SInt64 limit = (dither == kClipDitherShaped) ? 3 * 256 : 2 * 256;
+
+            for (UInt32 streaming = 0; streaming < 2; streaming++)
+            {
+                InitClipKernelState(&state);
+                GetClipKernel(type, numChannels, streaming, (ClipDitherMode) dither)(mix, out, &out[numSamples], 0, SELFTEST_FRAMES, &state);
+
+                for (UInt32 i = 0; i < numSamples; i++)
+                {
+                    SInt64 difference = (SInt64) out[i] - ref[i];
+
+                    if ((out[i] & 0xff) || difference > limit || difference < -limit ||
+                        (i % numChannels < 2 && out[numSamples + i / numChannels * 2 + i % numChannels] != out[i]))
+                    {
+                        IOLog("ClipKernelsSelfTest: %s%s %s dither out of range at %u (%u channels): %d for %d\n",
+                              ClipKernelName(type), streaming ? " streaming" : "", ClipDitherName((ClipDitherMode) dither),
+                              (unsigned int) i, (unsigned int) numChannels, (int) out[i], (int) ref[i]);
+                        result = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // The clipped samples include both full scale values and zero, so they double as input
+    // for the record side conversion. The floats are compared bit for bit, the meters like the
+    // output ones, and the overs have to match exactly.
+    for (UInt32 offset = 0; offset < 4; offset++)
+    {
+        float *outFloat = (float *) out;
+        ClipMeterState refMeter, outMeter;
+        ClipMeters refMeters, outMeters;
+
+        InitClipMeters(&refMeter);
+        InitClipMeters(&outMeter);
+        ConvertSInt32ToFloat_Scalar(&ref[offset * 2], &mix[offset * 2], SELFTEST_SAMPLES - offset * 2, 2, &refMeter);
+        GetConvertKernel(type)(&ref[offset * 2], &outFloat[offset * 2], SELFTEST_SAMPLES - offset * 2, 2, &outMeter);
+        PublishClipMeters(&refMeter, 2, SELFTEST_FRAMES * 4 - offset, 48000, 1);
+        PublishClipMeters(&outMeter, 2, SELFTEST_FRAMES * 4 - offset, 48000, 1);
+        ReadClipMeters(&refMeter, &refMeters);
+        ReadClipMeters(&outMeter, &outMeters);
+
+        for (UInt32 channel = 0; channel < 2; channel++)
+        {
+            SInt32 difference = outMeters.rms[channel] - refMeters.rms[channel];
+
+            if (outMeters.peak[channel] != refMeters.peak[channel] || difference > 6554 || difference < -6554 ||
+                outMeters.overs[channel] != refMeters.overs[channel] || !refMeters.overs[channel])
+            {
+                IOLog("ClipKernelsSelfTest: %s input meter mismatch on channel %u (offset %u): peak %d != %d, rms %d != %d, overs %u != %u\n",
+                      ClipKernelName(type), (unsigned int) channel, (unsigned int) offset, (int) outMeters.peak[channel], (int) refMeters.peak[channel],
+                      (int) outMeters.rms[channel], (int) refMeters.rms[channel], (unsigned int) outMeters.overs[channel],
+                      (unsigned int) refMeters.overs[channel]);
+                result = false;
+                break;
+            }
+        }
+
+        for (UInt32 i = offset * 2; i < SELFTEST_SAMPLES; i++)
+        {
+            if (((SInt32 *) mix)[i] != out[i])
+            {
+                IOLog("ClipKernelsSelfTest: %s input mismatch at %u (offset %u) for %d\n",
+                      ClipKernelName(type), (unsigned int) i, (unsigned int) offset, (int) ref[i]);
+                result = false;
+                break;
+            }
+        }
+
+        // Without a meter the samples come out the same
+        __builtin_memset(outFloat, 0, SELFTEST_SAMPLES * sizeof(float));
+        GetConvertKernel(type)(&ref[offset * 2], &outFloat[offset * 2], SELFTEST_SAMPLES - offset * 2, 2, NULL);
+        for (UInt32 i = offset * 2; i < SELFTEST_SAMPLES; i++)
+        {
+            if (((SInt32 *) mix)[i] != out[i])
+            {
+                IOLog("ClipKernelsSelfTest: %s input mismatch without a meter at %u (offset %u) for %d\n",
+                      ClipKernelName(type), (unsigned int) i, (unsigned int) offset, (int) ref[i]);
+                result = false;
+                break;
+            }
+        }
+    }
+
+    IOLog("ClipKernelsSelfTest: %s %s\n", ClipKernelName(type), result ? "passed" : "FAILED");
+
+Done:
+    if (mix) {
+        IOFree(mix, SELFTEST_SAMPLES * sizeof(float));
+    }
+    if (ref) {
+        IOFree(ref, (SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    }
+    if (out) {
+        IOFreeAligned(out, (SELFTEST_SAMPLES + SELFTEST_FRAMES * 2) * sizeof(SInt32));
+    }
+
+    return result;
+}
+
+#define BENCHMARK_FRAMES 16384 // NUM_SAMPLE_FRAMES
+#define BENCHMARK_RUNS 16
+#define BENCHMARK_SAMPLES (BENCHMARK_FRAMES * 2)
+
+// The TSC counts core cycles on anything recent, other CPUs fall back to absolute time ticks
+#if defined(__i386__) || defined(__x86_64__)
+	#define BENCHMARK_UNIT "cycles"
+static inline UInt64 ReadCycles()
+{
+    UInt32 lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((UInt64) hi << 32) | lo;
+}
+#else
+	#define BENCHMARK_UNIT "ticks"
+static inline UInt64 ReadCycles()
+{
+    return mach_absolute_time();
+}
+#endif
+
+// Times a clip kernel over a whole buffer, returns hundredths of a cycle per sample
+static UInt32 TimeClipKernel(ClipKernelFunc kernel, const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf, UInt32 numChannels,
+                             ClipKernelState *state)
+{
+    UInt64 start = ReadCycles();
+
+    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        kernel(mixBuf, sampleBuf, spdifBuf, 0, BENCHMARK_FRAMES, state);
+    }
+    return (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_FRAMES * numChannels));
+}
+
+// Times a convert kernel over the whole 2 channel RDMA0 buffer, returns hundredths of a cycle per sample
+static UInt32 TimeConvertKernel(ConvertKernelFunc kernel, const SInt32 *sampleBuf, float *destBuf)
+{
+    ClipMeterState meter;
+    UInt64 start;
+
+    InitClipMeters(&meter);
+    start = ReadCycles();
+    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        kernel(sampleBuf, destBuf, BENCHMARK_SAMPLES, 2, &meter);
+    }
+    return (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_SAMPLES));
+}
+
+// Times a silence scan over a whole silent buffer, returns hundredths of a cycle per sample
+static UInt32 TimeSilenceKernel(SilenceKernelFunc kernel, const float *mixBuf)
+{
+    UInt64 start = ReadCycles();
+    UInt32 silent = 0;
+
+    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        silent += kernel(mixBuf, BENCHMARK_SAMPLES);
+    }
+    if (silent != BENCHMARK_RUNS) {
+        IOLog("ClipKernelsBenchmark: silence scan missed the silence\n");
+    }
+    return (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_SAMPLES));
+}
+
+// Times a stage (or the routing matrix) and the clip kernel behind it over a whole 8 channel
+// buffer, chunked the way the engine runs them, returns hundredths of a cycle per sample
+static UInt32 TimeClipStage(ClipStageFunc stage, ClipKernelFunc kernel, const float *mixBuf, SInt32 *sampleBuf, SInt32 *spdifBuf,
+                            ClipKernelState *state)
+{
+    UInt64 start = ReadCycles();
+
+    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+    {
+        for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+        {
+            stage(&mixBuf[done * 8], state->stageBuf, CLIP_STAGE_FRAMES, state);
+            kernel(state->stageBuf, &sampleBuf[done * 8], &spdifBuf[done * 2], 0, CLIP_STAGE_FRAMES, state);
+        }
+    }
+    return (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_FRAMES * 8));
+}
+
+#define WORKING_SET_SIZE (256 * 1024) // about what's left of the L2 for the app
+#define CACHE_LINE_SIZE 64
+
+// Reads one word per cache line of the working set, returns hundredths of a cycle per line. This
+// goes up with the number of lines the clip kernel evicted.
+static UInt32 TimeWorkingSet(const volatile UInt32 *workingSet)
+{
+    UInt64 start = ReadCycles();
+
+    for (UInt32 i = 0; i < WORKING_SET_SIZE / sizeof(UInt32); i += CACHE_LINE_SIZE / sizeof(UInt32))
+    {
+        (void) workingSet[i];
+    }
+    return (UInt32) ((ReadCycles() - start) * 100 / (WORKING_SET_SIZE / CACHE_LINE_SIZE));
+}
+
+// What the dither may add to the clip pass, in percent of the undithered kernel
+#define DITHER_BUDGET 75
+
+// Benchmarks the output side on the biggest layout, 8 channels x 16384 frames in 512 byte aligned
+// buffers like the real DMA buffers.
+// For the SIMD kernels this compares cached and streaming stores. Next to the throughput it measures
+// what the kernel does to the rest of the cache: a working set is loaded, the whole buffer gets
+// clipped and then the working set is read again.
+// Then it checks what the dither adds against DITHER_BUDGET, and times the output stages, the
+// routing and the S/PDIF downmix.
+static void BenchmarkOutput(ClipKernelType type)
+{
+    const UInt32 numSamples = BENCHMARK_FRAMES * 8;
+    const bool streaming = (type == kClipKernelSSE2 || type == kClipKernelAVX2);
+    float *mixBuf = (float *) IOMallocAligned(numSamples * sizeof(float), 512);
+    SInt32 *sampleBuf = (SInt32 *) IOMallocAligned(numSamples * sizeof(SInt32), 512);
+    SInt32 *spdifBuf = (SInt32 *) IOMallocAligned(BENCHMARK_SAMPLES * sizeof(SInt32), 512);
+    UInt32 *workingSet = (UInt32 *) IOMalloc(WORKING_SET_SIZE);
+    ClipKernelState state;
+    UInt32 seed = 0x13572468;
+
+    InitClipKernelState(&state);
+
+    if (mixBuf && sampleBuf && spdifBuf && workingSet)
+    {
+        UInt32 plain = 0;
+
+        for (UInt32 i = 0; i < numSamples; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            mixBuf[i] = ((SInt32) seed) * (1.25f / 2147483648.0f);
+        }
+        for (UInt32 i = 0; i < WORKING_SET_SIZE / sizeof(UInt32); i++)
+        {
+            workingSet[i] = i;
+        }
+
+        for (UInt32 s = 0; s < (streaming ? 2U : 1U); s++)
+        {
+            ClipKernelFunc kernel = GetClipKernel(type, 8, s, kClipDitherNone);
+            UInt32 reload = 0, warm = 0;
+
+            kernel(mixBuf, sampleBuf, spdifBuf, 0, BENCHMARK_FRAMES, &state);
+            plain = TimeClipKernel(kernel, mixBuf, sampleBuf, spdifBuf, 8, &state);
+
+            for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+            {
+                TimeWorkingSet(workingSet);
+                warm += TimeWorkingSet(workingSet);
+                kernel(mixBuf, sampleBuf, spdifBuf, 0, BENCHMARK_FRAMES, &state);
+                reload += TimeWorkingSet(workingSet);
+            }
+            warm /= BENCHMARK_RUNS;
+            reload /= BENCHMARK_RUNS;
+
+            IOLog("ClipKernelsBenchmark: %s %s stores: clip %u.%02u " BENCHMARK_UNIT "/sample, working set %u.%02u "
+                  BENCHMARK_UNIT "/line after the clip (%u.%02u warm) (8ch x %u frames)\n",
+                  ClipKernelName(type), s ? "streaming" : "cached",
+                  (unsigned int) (plain / 100), (unsigned int) (plain % 100),
+                  (unsigned int) (reload / 100), (unsigned int) (reload % 100),
+                  (unsigned int) (warm / 100), (unsigned int) (warm % 100), BENCHMARK_FRAMES);
+        }
+
+        // Compared against the kernel the engine uses without dither, the last one timed above
+        for (UInt32 dither = kClipDitherTPDF; dither <= kClipDitherShaped; dither++)
+        {
+            ClipKernelFunc kernel = GetClipKernel(type, 8, streaming, (ClipDitherMode) dither);
+            UInt32 dithered, added;
+
+            kernel(mixBuf, sampleBuf, spdifBuf, 0, BENCHMARK_FRAMES, &state);
+            dithered = TimeClipKernel(kernel, mixBuf, sampleBuf, spdifBuf, 8, &state);
+            added = (dithered > plain) ? dithered - plain : 0;
+
+            IOLog("ClipKernelsBenchmark: %s dither %s: clip %u.%02u " BENCHMARK_UNIT "/sample, %u.%02u added, %s the %u%% budget\n",
+                  ClipKernelName(type), ClipDitherName((ClipDitherMode) dither),
+                  (unsigned int) (dithered / 100), (unsigned int) (dithered % 100),
+                  (unsigned int) (added / 100), (unsigned int) (added % 100),
+                  (added * 100 <= plain * DITHER_BUDGET) ? "within" : "OVER", DITHER_BUDGET);
+        }
+
+        for (UInt32 mode = kClipStageSoft; mode <= kClipStageLimiter; mode++)
+        {
+            ClipStageFunc stage = GetClipStage(type, 8, (ClipStageMode) mode);
+            UInt32 staged;
+
+            if (!stage) {
+                continue;
+            }
+
+            staged = TimeClipStage(stage, GetClipKernel(type, 8, streaming, kClipDitherNone), mixBuf, sampleBuf, spdifBuf, &state);
+
+            IOLog("ClipKernelsBenchmark: %s %s: clip %u.%02u " BENCHMARK_UNIT "/sample\n",
+                  ClipKernelName(type), ClipStageName((ClipStageMode) mode),
+                  (unsigned int) (staged / 100), (unsigned int) (staged % 100));
+        }
+
+        // A permutation that swaps the pairs around runs in front of the clip kernel like the matrix
+        if (type != kClipKernelInteger)
+        {
+            ClipRoute route;
+            UInt32 permuted;
+
+            for (UInt32 slot = 0; slot < 8; slot++)
+            {
+                for (UInt32 channel = 0; channel < 8; channel++)
+                {
+                    route.gain[slot][channel] = (channel == (slot ^ 2)) ? CLIP_ROUTE_UNITY : 0;
+                }
+            }
+            SetClipRoute(&state, &route, 8);
+            UpdateClipRoute(&state);
+
+            permuted = TimeClipStage(GetClipRoute(type, 8), GetClipKernel(type, 8, streaming, kClipDitherNone), mixBuf, sampleBuf, spdifBuf, &state);
+
+            IOLog("ClipKernelsBenchmark: %s permutation: clip %u.%02u " BENCHMARK_UNIT "/sample, %u.%02u without\n",
+                  ClipKernelName(type), (unsigned int) (permuted / 100), (unsigned int) (permuted % 100),
+                  (unsigned int) (plain / 100), (unsigned int) (plain % 100));
+        }
+
+        // The matrix runs in front of the clip kernel like a stage, adding half of the centre to
+        // every other slot
+        if (type != kClipKernelInteger)
+        {
+            ClipRoute route;
+            UInt32 routed;
+
+            for (UInt32 slot = 0; slot < 8; slot++)
+            {
+                for (UInt32 channel = 0; channel < 8; channel++)
+                {
+                    route.gain[slot][channel] = (channel == slot) ? CLIP_ROUTE_UNITY : 0;
+                }
+                if (slot != 2) {
+                    route.gain[slot][2] = CLIP_ROUTE_UNITY / 2;
+                }
+            }
+            SetClipRoute(&state, &route, 8);
+            UpdateClipRoute(&state);
+
+            routed = TimeClipStage(GetClipRoute(type, 8), GetClipKernel(type, 8, streaming, kClipDitherNone), mixBuf, sampleBuf, spdifBuf, &state);
+
+            IOLog("ClipKernelsBenchmark: %s matrix: clip %u.%02u " BENCHMARK_UNIT "/sample, %u.%02u without\n",
+                  ClipKernelName(type), (unsigned int) (routed / 100), (unsigned int) (routed % 100),
+                  (unsigned int) (plain / 100), (unsigned int) (plain % 100));
+        }
+
+        // Delays on all 8 channels, per block of CLIP_STAGE_FRAMES frames
+        {
+            void *memory = IOMallocAligned(ClipDelaySize(8), 64);
+            ClipDelay delay = { { 0, 17, 100, 960, 1500, 2000, 3000, CLIP_DELAY_MAX } };
+            UInt32 block;
+            UInt64 start;
+
+            if (memory)
+            {
+                state.delayLines = InitClipDelay(memory, 8);
+                SetClipDelay(&state, &delay, 8);
+                UpdateClipRoute(&state);
+
+                start = ReadCycles();
+                for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+                {
+                    for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                    {
+                        GetClipDelay(type, 8)(&mixBuf[done * 8], state.delayBuf, CLIP_STAGE_FRAMES, &state);
+                    }
+                }
+                block = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * (BENCHMARK_FRAMES / CLIP_STAGE_FRAMES)));
+
+                IOLog("ClipKernelsBenchmark: %s delays (8ch): %u.%02u " BENCHMARK_UNIT "/block of %u frames, %u.%02u/sample\n",
+                      ClipKernelName(type), (unsigned int) (block / 100), (unsigned int) (block % 100), CLIP_STAGE_FRAMES,
+                      (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) / 100), (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) % 100));
+
+                InitClipKernelState(&state);
+                IOFreeAligned(memory, ClipDelaySize(8));
+            }
+        }
+
+        // Bass management of 7.1 at 80Hz, per block of CLIP_STAGE_FRAMES frames
+        if (type != kClipKernelInteger)
+        {
+            ClipBass bass = { 80, 192000, 3, 0xf7 };
+            UInt32 block;
+            UInt64 start;
+
+            SetClipBass(&state, &bass, 8);
+            UpdateClipRoute(&state);
+
+            start = ReadCycles();
+            for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+            {
+                for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                {
+                    GetClipBass(type, 8)(&mixBuf[done * 8], state.bassBuf, CLIP_STAGE_FRAMES, &state);
+                }
+            }
+            block = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * (BENCHMARK_FRAMES / CLIP_STAGE_FRAMES)));
+
+            IOLog("ClipKernelsBenchmark: %s bass management (8ch): %u.%02u " BENCHMARK_UNIT "/block of %u frames, %u.%02u/sample\n",
+                  ClipKernelName(type), (unsigned int) (block / 100), (unsigned int) (block % 100), CLIP_STAGE_FRAMES,
+                  (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) / 100), (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) % 100));
+
+            InitClipKernelState(&state);
+        }
+
+        // A full EQ, CLIP_EQ_SECTIONS biquads on each of the 8 channels, per block of
+        // CLIP_STAGE_FRAMES frames and for a second of 192kHz
+        if (type != kClipKernelInteger)
+        {
+            static const SInt32 peaking[5] = { 322122547, -429496730, 161061274, -429496730, 214748365 };
+            ClipEq eq;
+            UInt32 block;
+            UInt64 start;
+
+            for (UInt32 slot = 0; slot < 8; slot++)
+            {
+                for (UInt32 section = 0; section < CLIP_EQ_SECTIONS; section++)
+                {
+                    __builtin_memcpy(eq.coef[slot][section], peaking, sizeof(peaking));
+                }
+            }
+            SetClipEq(&state, &eq, 8);
+            UpdateClipRoute(&state);
+
+            start = ReadCycles();
+            for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+            {
+                for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                {
+                    GetClipEq(type, 8)(&mixBuf[done * 8], state.eqBuf, CLIP_STAGE_FRAMES, &state);
+                }
+            }
+            block = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * (BENCHMARK_FRAMES / CLIP_STAGE_FRAMES)));
+
+            IOLog("ClipKernelsBenchmark: %s EQ (%u biquads x 8ch): %u.%02u " BENCHMARK_UNIT "/block of %u frames, %u.%02u/sample, %u M" BENCHMARK_UNIT " per second at 192kHz\n",
+                  ClipKernelName(type), CLIP_EQ_SECTIONS, (unsigned int) (block / 100), (unsigned int) (block % 100), CLIP_STAGE_FRAMES,
+                  (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) / 100), (unsigned int) (block / (CLIP_STAGE_FRAMES * 8) % 100),
+                  (unsigned int) ((UInt64) block * (192000 / CLIP_STAGE_FRAMES) / 100000000));
+
+            InitClipKernelState(&state);
+        }
+
+        // The convolution of all 8 channels with filters of 4k, 16k and 64k taps: what it costs per
+        // sample and per channel for a second of 192kHz, the worst chunk (the one that completes a
+        // block), and how many clip passes it takes to get a new filter ready
+        if (type != kClipKernelInteger)
+        {
+            void *memory = IOMallocAligned(ClipConvSize(8), 64);
+            float *taps = (float *) IOMalloc(CLIP_CONV_MAX_TAPS * sizeof(float));
+
+            if (memory && taps)
+            {
+                const float *tapPointers[8];
+                UInt32 numTaps[8];
+
+                for (UInt32 i = 0; i < CLIP_CONV_MAX_TAPS; i++)
+                {
+                    seed = seed * 1664525 + 1013904223;
+                    taps[i] = ((SInt32) seed) * (1.0f / 256.0f / 2147483648.0f);
+                }
+                state.conv = InitClipConv(memory, 8);
+
+                for (UInt32 length = 4096; length <= CLIP_CONV_MAX_TAPS; length *= 4)
+                {
+                    UInt64 start, worst = 0;
+                    UInt32 sample, passes = 0;
+
+                    for (UInt32 slot = 0; slot < 8; slot++)
+                    {
+                        tapPointers[slot] = taps;
+                        numTaps[slot] = length;
+                    }
+                    SetClipConv(state.conv, tapPointers, numTaps);
+                    while ((state.conv->sequence & ~CONV_ACTIVE) != state.conv->applied)
+                    {
+                        UpdateClipRoute(&state);
+                        passes++;
+                    }
+
+                    start = ReadCycles();
+                    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+                    {
+                        for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                        {
+                            UInt64 chunk = ReadCycles();
+
+                            GetClipConv(type, 8)(&mixBuf[done * 8], state.convBuf, CLIP_STAGE_FRAMES, &state);
+                            chunk = ReadCycles() - chunk;
+                            if (chunk > worst) {
+                                worst = chunk;
+                            }
+                        }
+                    }
+                    sample = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_FRAMES * 8));
+
+                    IOLog("ClipKernelsBenchmark: %s convolution (%u taps x 8ch): %u.%02u " BENCHMARK_UNIT "/sample, %u M" BENCHMARK_UNIT " per channel per second at 192kHz, "
+                          "worst chunk %u k" BENCHMARK_UNIT ", ready after %u clip passes\n",
+                          ClipKernelName(type), (unsigned int) length, (unsigned int) (sample / 100), (unsigned int) (sample % 100),
+                          (unsigned int) ((UInt64) sample * 192000 / 100000000), (unsigned int) (worst / 1000), (unsigned int) passes);
+                }
+            }
+
+            InitClipKernelState(&state);
+            if (memory) {
+                IOFreeAligned(memory, ClipConvSize(8));
+            }
+            if (taps) {
+                IOFree(taps, CLIP_CONV_MAX_TAPS * sizeof(float));
+            }
+        }
+
+        // Oversampling 8 channels and decimating the line input, 2x and 4x with a short, a medium
+        // and the full filter, per channel and frame that goes in or comes out at the client rate
+        if (type != kClipKernelInteger)
+        {
+            static const UInt32 tapCounts[] = { 16, 32, CLIP_OVERSAMPLE_TAPS };
+            ClipDecimator *decimator = (ClipDecimator *) IOMalloc(sizeof(ClipDecimator));
+            ClipMeterState meter;
+
+            InitClipMeters(&meter);
+            for (UInt32 ratio = 2; decimator && ratio <= CLIP_OVERSAMPLE_MAX; ratio *= 2)
+            {
+                for (UInt32 t = 0; t < sizeof(tapCounts) / sizeof(tapCounts[0]); t++)
+                {
+                    ClipOversample oversample = { ratio, tapCounts[t] };
+                    UInt32 period = BENCHMARK_FRAMES / ratio & ~(CLIP_STAGE_FRAMES - 1), upsample, decimate;
+                    UInt64 start;
+
+                    SetClipOversample(&state, &oversample);
+                    UpdateClipRoute(&state);
+                    start = ReadCycles();
+                    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+                    {
+                        for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                        {
+                            GetClipUpsample(type, 8)(&mixBuf[done * 8], state.oversampleBuf, CLIP_STAGE_FRAMES, &state);
+                        }
+                    }
+                    upsample = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_FRAMES * 8));
+
+                    // The record buffer holds as many stereo frames as the mix has samples
+                    SetClipDecimator(decimator, &oversample, BENCHMARK_FRAMES * 4);
+                    start = ReadCycles();
+                    for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+                    {
+                        for (UInt32 done = 0; done < period; done += CLIP_STAGE_FRAMES)
+                        {
+                            GetClipDecimate(type, 2)(sampleBuf, done * ratio, (float *) &spdifBuf[done * 2], CLIP_STAGE_FRAMES, decimator, &meter);
+                        }
+                    }
+                    decimate = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * period * 2));
+
+                    IOLog("ClipKernelsBenchmark: %s %ux oversampling (%u taps): %u.%02u " BENCHMARK_UNIT "/sample out of 8ch, %u.%02u "
+                          BENCHMARK_UNIT "/sample decimating the line input\n", ClipKernelName(type), (unsigned int) ratio,
+                          (unsigned int) tapCounts[t], (unsigned int) (upsample / 100), (unsigned int) (upsample % 100),
+                          (unsigned int) (decimate / 100), (unsigned int) (decimate % 100));
+                }
+            }
+            InitClipKernelState(&state);
+            if (decimator) {
+                IOFree(decimator, sizeof(ClipDecimator));
+            }
+        }
+
+        // The ITU downmix of all 8 channels for the S/PDIF output, what it costs per frame and for
+        // a second of 192kHz
+        if (type != kClipKernelInteger)
+        {
+            ClipRoute route;
+            UInt32 downmix;
+            UInt64 start;
+
+            for (UInt32 side = 0; side < 2; side++)
+            {
+                for (UInt32 channel = 0; channel < 8; channel++)
+                {
+                    route.gain[side][channel] = (channel == side) ? CLIP_ROUTE_UNITY : 0;
+                }
+                route.gain[side][2] = 46341;
+                route.gain[side][4 + side] = 46341;
+                route.gain[side][6 + side] = 46341;
+            }
+            SetClipSpdif(&state, &route, 8);
+            UpdateClipRoute(&state);
+
+            start = ReadCycles();
+            for (UInt32 run = 0; run < BENCHMARK_RUNS; run++)
+            {
+                for (UInt32 done = 0; done < BENCHMARK_FRAMES; done += CLIP_STAGE_FRAMES)
+                {
+                    GetSpdifKernel(type, 8)(&mixBuf[done * 8], &spdifBuf[done * 2], CLIP_STAGE_FRAMES, &state);
+                }
+            }
+            downmix = (UInt32) ((ReadCycles() - start) * 100 / (BENCHMARK_RUNS * BENCHMARK_FRAMES));
+
+            IOLog("ClipKernelsBenchmark: %s S/PDIF downmix: %u.%02u " BENCHMARK_UNIT "/frame, %u M" BENCHMARK_UNIT " per second at 8ch x 192kHz\n",
+                  ClipKernelName(type), (unsigned int) (downmix / 100), (unsigned int) (downmix % 100),
+                  (unsigned int) ((UInt64) downmix * 192000 / 100000000));
+        }
+    }
+
+    if (mixBuf) {
+        IOFreeAligned(mixBuf, numSamples * sizeof(float));
+    }
+    if (sampleBuf) {
+        IOFreeAligned(sampleBuf, numSamples * sizeof(SInt32));
+    }
+    if (spdifBuf) {
+        IOFreeAligned(spdifBuf, BENCHMARK_SAMPLES * sizeof(SInt32));
+    }
+    if (workingSet) {
+        IOFree(workingSet, WORKING_SET_SIZE);
+    }
+}
+
+// Compares the kernels for the given type against the scalar float and the integer kernels and prints
+// the cost per sample
+static void ClipKernelsBenchmark(ClipKernelType type)
+{
+    ClipKernelType types[] = { kClipKernelScalar, kClipKernelInteger, type };
+    UInt32 numTypes = (type == kClipKernelScalar || type == kClipKernelInteger) ? 2 : 3;
+    float *mixBuf = (float *) IOMalloc(BENCHMARK_SAMPLES * sizeof(float));
+    SInt32 *sampleBuf = (SInt32 *) IOMalloc(BENCHMARK_SAMPLES * sizeof(SInt32));
+    SInt32 *spdifBuf = (SInt32 *) IOMalloc(BENCHMARK_SAMPLES * sizeof(SInt32));
+    float *destBuf = (float *) IOMalloc(BENCHMARK_SAMPLES * sizeof(float));
+    ClipKernelState state;
+    UInt32 seed = 0x87654321;
+
+    InitClipKernelState(&state);
+
+    if (mixBuf && sampleBuf && spdifBuf && destBuf)
+    {
+        // A mix that's slightly hotter than full scale, so the clip branches get exercised too
+        for (UInt32 i = 0; i < BENCHMARK_SAMPLES; i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            mixBuf[i] = ((SInt32) seed) * (1.25f / 2147483648.0f);
+        }
+
+        for (UInt32 t = 0; t < numTypes; t++)
+        {
+            ClipKernelFunc clipKernel = GetClipKernel(types[t], 2, false, kClipDitherNone);
+            ConvertKernelFunc convertKernel = GetConvertKernel(types[t]);
+            UInt32 output, input, silence;
+
+            // Warm up the caches first, the real buffers are hot from the mixer and the DMA engine as well
+            clipKernel(mixBuf, sampleBuf, spdifBuf, 0, BENCHMARK_FRAMES, &state);
+            output = TimeClipKernel(clipKernel, mixBuf, sampleBuf, spdifBuf, 2, &state);
+
+            // The clipped samples are the input for the record side
+            convertKernel(sampleBuf, destBuf, BENCHMARK_SAMPLES, 2, &state.meter);
+            input = TimeConvertKernel(convertKernel, sampleBuf, destBuf);
+
+            // A silent mix has to be scanned all the way through
+            __builtin_memset(destBuf, 0, BENCHMARK_SAMPLES * sizeof(float));
+            silence = TimeSilenceKernel(GetSilenceKernel(types[t]), destBuf);
+
+            IOLog("ClipKernelsBenchmark: %s output %u.%02u, input %u.%02u, silence scan %u.%02u " BENCHMARK_UNIT "/sample (2ch x %u frames)\n",
+                  ClipKernelName(types[t]), (unsigned int) (output / 100), (unsigned int) (output % 100),
+                  (unsigned int) (input / 100), (unsigned int) (input % 100),
+                  (unsigned int) (silence / 100), (unsigned int) (silence % 100), BENCHMARK_FRAMES);
+        }
+    }
+
+    if (mixBuf) {
+        IOFree(mixBuf, BENCHMARK_SAMPLES * sizeof(float));
+    }
+    if (sampleBuf) {
+        IOFree(sampleBuf, BENCHMARK_SAMPLES * sizeof(SInt32));
+    }
+    if (spdifBuf) {
+        IOFree(spdifBuf, BENCHMARK_SAMPLES * sizeof(SInt32));
+    }
+    if (destBuf) {
+        IOFree(destBuf, BENCHMARK_SAMPLES * sizeof(float));
+    }
+
+    BenchmarkOutput(type);
+}
+
+int main(int argc, char **argv)
+{
+    ClipKernelType detected = DetectClipKernelType();
+    bool result;
+
+    printf("ClipKernelsTest: the CPU runs the %s kernels\n", ClipKernelName(detected));
+    result = ClipKernelsSelfTest(kClipKernelScalar);
+    if (detected == kClipKernelInteger)
+    {
+        result = ClipKernelsSelfTest(kClipKernelInteger) && result;
+    }
+    for (UInt32 type = kClipKernelSSE2; detected != kClipKernelInteger && type <= (UInt32) detected; type++)
+    {
+        result = ClipKernelsSelfTest((ClipKernelType) type) && result;
+    }
+    if (result && argc > 1 && !strcmp(argv[1], "benchmark"))
+    {
+        ClipKernelsBenchmark(detected);
+    }
+
+    return result ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+#include "ClipKernelsPrivate.h"
+
+// Output stages. These run in float in front of the clip kernel, a chunk of frames at a time,
+// and only soften what the hard clip would otherwise do. The same templates are used for single
+// samples and, in the SIMD kernels, for a whole frame across the lanes of a vector.
+#define SOFTCLIP_THRESHOLD 0.75f	// the knee runs from here to 2 - SOFTCLIP_THRESHOLD (+1.9 dBFS)
+#define LIMITER_CEILING 0.977f		// -0.2 dBFS
+#define LIMITER_ATTACK 0.1175f		// 1 - e^(-4 / lookahead), the gain is within 2% of the target when the peak comes out of the delay
+#define LIMITER_RELEASE 0.9995f		// per frame, about 45ms at 44.1kHz
+
+// Quadratic knee: unity gain up to the threshold, then bending over to reach 1.0 with a slope of
+// zero at 2 - SOFTCLIP_THRESHOLD. Anything beyond that ends up at 1.0.
+template <typename T>
+static inline __attribute__((always_inline)) T SoftClip(const T &x)
+{
+    const T zero = T();
+    T magnitude = Abs(x);
+    T knee = Min(Max(magnitude - SOFTCLIP_THRESHOLD, zero), zero + 2.0f * (1.0f - SOFTCLIP_THRESHOLD));
+
+    return CopySign(Min(magnitude - knee * knee * (1.0f / (4.0f * (1.0f - SOFTCLIP_THRESHOLD))), zero + 1.0f), x);
+}
+
+// One step of the limiter for a channel (or a frame): the envelope holds the peaks with an
+// exponential release, the gain needed to keep it under the ceiling is approached with the attack
+// time constant going down and followed right away going up, and it's applied to the sample that
+// comes out of the lookahead delay. Whatever the attack didn't catch (peaks way beyond full scale)
+// is clamped to the ceiling. NaNs don't get into the envelope.
+template <typename T>
+static inline __attribute__((always_inline)) T LimitSample(const T &x, T *envelope, T *gain, T *delayed)
+{
+    const T zero = T();
+    T target, out;
+
+    *envelope = Max(*envelope * LIMITER_RELEASE, Abs(x));
+    target = (zero + LIMITER_CEILING) / Max(*envelope, zero + LIMITER_CEILING);
+    *gain = target + Max(*gain - target, zero) * (1.0f - LIMITER_ATTACK);
+
+    out = Max(Min(*delayed * *gain, zero + LIMITER_CEILING), zero - LIMITER_CEILING);
+    *delayed = x;
+    return out;
+}
+
+template <UInt32 N>
+static void SoftClipFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *)
+{
+    for (UInt32 i = 0; i < numSampleFrames * N; i++) {
+        destBuf[i] = SoftClip(mixBuf[i]);
+    }
+}
+
+template <UInt32 N>
+static void LimitFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    UInt32 position = state->limiterPosition;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        for (UInt32 channel = 0; channel < N; channel++) {
+            destBuf[channel] = LimitSample(mixBuf[channel], &state->limiterEnvelope[channel], &state->limiterGain[channel],
+                                           &state->limiterDelay[position][channel]);
+        }
+
+        position = (position + 1) % CLIP_LIMITER_LOOKAHEAD;
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    state->limiterPosition = position;
+}
+
+#ifdef ENVY24HT_SIMD
+
+// The soft clipper has no state, so it just runs over the samples
+template <typename VF, UInt32 W>
+static inline __attribute__((always_inline)) void SoftClipSamples(const float *mixBuf, float *destBuf, UInt32 numSamples)
+{
+    UInt32 i = 0;
+
+    for (; i + W <= numSamples; i += W) {
+        StoreUnaligned<VF>(&destBuf[i], SoftClip(LoadUnaligned<VF>(&mixBuf[i])));
+    }
+
+    for (; i < numSamples; i++) {
+        destBuf[i] = SoftClip(mixBuf[i]);
+    }
+}
+
+// The limiter's state runs from frame to frame, so it works on one frame per vector with a lane
+// per channel. The lanes beyond N stay zero.
+template <UInt32 N, typename VF>
+static inline __attribute__((always_inline)) void LimitFrames_SIMD(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    UInt32 position = state->limiterPosition;
+    VF envelope = {}, gain = {};
+
+    __builtin_memcpy(&envelope, state->limiterEnvelope, N * sizeof(float));
+    __builtin_memcpy(&gain, state->limiterGain, N * sizeof(float));
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        VF x = {}, delayed, out;
+
+        __builtin_memcpy(&x, mixBuf, N * sizeof(float));
+        delayed = LoadUnaligned<VF>(state->limiterDelay[position]);
+        out = LimitSample(x, &envelope, &gain, &delayed);
+        StoreUnaligned<VF>(state->limiterDelay[position], delayed);
+        __builtin_memcpy(destBuf, &out, N * sizeof(float));
+
+        position = (position + 1) % CLIP_LIMITER_LOOKAHEAD;
+        mixBuf += N;
+        destBuf += N;
+    }
+
+    __builtin_memcpy(state->limiterEnvelope, &envelope, N * sizeof(float));
+    __builtin_memcpy(state->limiterGain, &gain, N * sizeof(float));
+    state->limiterPosition = position;
+}
+
+template <UInt32 N>
+static void SoftClipFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *)
+{
+    SoftClipSamples<v4sf, 4>(mixBuf, destBuf, numSampleFrames * N);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void SoftClipFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *)
+{
+    SoftClipSamples<v8sf, 8>(mixBuf, destBuf, numSampleFrames * N);
+}
+
+template <UInt32 N>
+static void LimitFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    LimitFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void LimitFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    LimitFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+#endif /* ENVY24HT_SIMD */
+
+template <UInt32 N>
+static ClipStageFunc GetClipStageForChannels(ClipKernelType type, ClipStageMode stage)
+{
+    switch (stage)
+    {
+        case kClipStageSoft:
+            switch (type)
+            {
+#ifdef ENVY24HT_SIMD
+                case kClipKernelAVX2:
+                    return SoftClipFrames_AVX2<N>;
+                case kClipKernelSSE2:
+                    return SoftClipFrames_SSE2<N>;
+#endif
+                case kClipKernelScalar:
+                    return SoftClipFrames_Scalar<N>;
+                default:
+                    return NULL;
+            }
+        case kClipStageLimiter:
+            switch (type)
+            {
+#ifdef ENVY24HT_SIMD
+                case kClipKernelAVX2:
+                    return LimitFrames_AVX2<N>;
+                case kClipKernelSSE2:
+                    return LimitFrames_SSE2<N>;
+#endif
+                case kClipKernelScalar:
+                    return LimitFrames_Scalar<N>;
+                default:
+                    return NULL;
+            }
+        default:
+            return NULL;
+    }
+}
+
+ClipStageFunc GetClipStage(ClipKernelType type, UInt32 numChannels, ClipStageMode stage)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipStageForChannels<2>(type, stage);
+        case 6:
+            return GetClipStageForChannels<6>(type, stage);
+        case 8:
+            return GetClipStageForChannels<8>(type, stage);
+        default:
+            return NULL;
+    }
+}
+
+void ResetClipStage(ClipKernelState *state)
+{
+    for (UInt32 i = 0; i < CLIP_KERNEL_MAX_CHANNELS; i++)
+    {
+        for (UInt32 frame = 0; frame < CLIP_LIMITER_LOOKAHEAD; frame++)
+        {
+            state->limiterDelay[frame][i] = 0.0f;
+        }
+        state->limiterEnvelope[i] = 0.0f;
+        state->limiterGain[i] = 1.0f;
+    }
+    state->limiterPosition = 0;
+}
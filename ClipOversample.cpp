@@ -0,0 +1,406 @@
+#include "ClipKernelsPrivate.h"
+
+// Oversampling. The frames that go in are appended to the history, a row of lanes per frame with
+// the lanes beyond N at zero, and every phase but the first sums up its taps over the newest frames,
+// oldest tap last. The first phase only has the one tap in the middle, which is 1, so it's a copy.
+// The SIMD kernels run the lanes of a row at once in the same order, so their output is
+// bit-identical.
+template <UInt32 N>
+static inline __attribute__((always_inline)) void StartUpsample(const float *mixBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    float (*history)[CLIP_KERNEL_MAX_CHANNELS] = &state->oversampleHistory[state->oversampleTable.taps - 1];
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        __builtin_memcpy(history[frame], &mixBuf[frame * N], N * sizeof(float));
+    }
+}
+
+static inline __attribute__((always_inline)) void FinishUpsample(UInt32 numSampleFrames, ClipKernelState *state)
+{
+    __builtin_memmove(state->oversampleHistory[0], state->oversampleHistory[numSampleFrames],
+                      (state->oversampleTable.taps - 1) * sizeof(state->oversampleHistory[0]));
+}
+
+template <UInt32 N>
+static void UpsampleFrames_Scalar(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipOversampleTable *table = &state->oversampleTable;
+    UInt32 ratio = table->ratio, taps = table->taps;
+
+    StartUpsample<N>(mixBuf, numSampleFrames, state);
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        const float (*newest)[CLIP_KERNEL_MAX_CHANNELS] = &state->oversampleHistory[frame + taps - 1];
+
+        __builtin_memcpy(destBuf, newest[-(SInt32) (taps / 2)], N * sizeof(float));
+        for (UInt32 phase = 1; phase < ratio; phase++) {
+            const float *coef = table->coef[phase];
+
+            for (UInt32 channel = 0; channel < N; channel++) {
+                float sum = coef[0] * newest[0][channel];
+
+                for (UInt32 k = 1; k < taps; k++) {
+                    sum = sum + coef[k] * newest[-(SInt32) k][channel];
+                }
+                destBuf[phase * N + channel] = sum;
+            }
+        }
+
+        destBuf += ratio * N;
+    }
+    FinishUpsample(numSampleFrames, state);
+}
+
+// The line input comes back down a stereo pair at a time. The converted frames are appended to the
+// history behind the ratio * taps - 1 frames before them, and every frame that comes out is the sum
+// over ratio * taps of them, starting ratio frames after the one before. The sums run over 8 lanes,
+// 4 frames of both channels, like the SIMD kernels' vectors, and the lanes of a channel are added up
+// in the same order at the end.
+#define DECIMATE_LANES 8
+
+static void BuildDecimator(ClipDecimator *decimator);
+
+static inline __attribute__((always_inline)) float *StartDecimate(ConvertKernelFunc convert, const SInt32 *sampleBuf, UInt32 firstSampleFrame,
+                                                                  UInt32 numSampleFrames, ClipDecimator *decimator, ClipMeterState *meter)
+{
+    UInt32 kept = decimator->ratio * decimator->taps - 1, converted;
+
+    if (!decimator->built) {
+        BuildDecimator(decimator);
+    }
+    if (firstSampleFrame != decimator->nextFrame) {
+        __builtin_memset(decimator->history, 0, kept * 2 * sizeof(float));
+    }
+    // The frames up to the end of the buffer, then the rest from its start
+    converted = decimator->bufferFrames - firstSampleFrame;
+    converted = (converted < decimator->ratio * numSampleFrames) ? converted : decimator->ratio * numSampleFrames;
+    convert(&sampleBuf[firstSampleFrame * 2], &decimator->history[kept * 2], converted * 2, 2, meter);
+    if (converted < decimator->ratio * numSampleFrames) {
+        convert(sampleBuf, &decimator->history[(kept + converted) * 2], (decimator->ratio * numSampleFrames - converted) * 2, 2, meter);
+    }
+
+    return decimator->history;
+}
+
+static inline __attribute__((always_inline)) void FinishDecimate(UInt32 firstSampleFrame, UInt32 numSampleFrames, ClipDecimator *decimator)
+{
+    UInt32 converted = decimator->ratio * numSampleFrames;
+
+    __builtin_memmove(decimator->history, &decimator->history[converted * 2], (decimator->ratio * decimator->taps - 1) * 2 * sizeof(float));
+    decimator->nextFrame = (firstSampleFrame + converted) % decimator->bufferFrames;
+}
+
+static void DecimateFrames_Scalar(const SInt32 *sampleBuf, UInt32 firstSampleFrame, float *destBuf, UInt32 numSampleFrames,
+                                  ClipDecimator *decimator, ClipMeterState *meter)
+{
+    const float *history = StartDecimate(ConvertSInt32ToFloat_Scalar, sampleBuf, firstSampleFrame, numSampleFrames, decimator, meter);
+    UInt32 length = decimator->ratio * decimator->taps * 2;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        float sum[DECIMATE_LANES], half[DECIMATE_LANES / 2];
+
+        for (UInt32 lane = 0; lane < DECIMATE_LANES; lane++) {
+            sum[lane] = decimator->coef[lane] * history[lane];
+        }
+        for (UInt32 i = DECIMATE_LANES; i < length; i += DECIMATE_LANES) {
+            for (UInt32 lane = 0; lane < DECIMATE_LANES; lane++) {
+                sum[lane] = sum[lane] + decimator->coef[i + lane] * history[i + lane];
+            }
+        }
+        for (UInt32 lane = 0; lane < DECIMATE_LANES / 2; lane++) {
+            half[lane] = sum[lane] + sum[lane + DECIMATE_LANES / 2];
+        }
+        destBuf[0] = half[0] + half[2];
+        destBuf[1] = half[1] + half[3];
+
+        history += decimator->ratio * 2;
+        destBuf += 2;
+    }
+    FinishDecimate(firstSampleFrame, numSampleFrames, decimator);
+}
+
+#ifdef ENVY24HT_SIMD
+
+// A frame per vector again. Every phase keeps its sum in a register while the taps go by, so each
+// row of the history is loaded once for all of them.
+template <UInt32 N, typename VF, UInt32 Ratio>
+static inline __attribute__((always_inline)) void UpsampleBlock(float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    const ClipOversampleTable *table = &state->oversampleTable;
+    UInt32 taps = table->taps;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        const float (*newest)[CLIP_KERNEL_MAX_CHANNELS] = &state->oversampleHistory[frame + taps - 1];
+        VF x = LoadUnaligned<VF>(newest[0]), sum[Ratio - 1];
+
+        for (UInt32 phase = 1; phase < Ratio; phase++) {
+            sum[phase - 1] = ((VF) {} + table->coef[phase][0]) * x;
+        }
+        for (UInt32 k = 1; k < taps; k++) {
+            x = LoadUnaligned<VF>(newest[-(SInt32) k]);
+            for (UInt32 phase = 1; phase < Ratio; phase++) {
+                sum[phase - 1] = sum[phase - 1] + ((VF) {} + table->coef[phase][k]) * x;
+            }
+        }
+
+        __builtin_memcpy(destBuf, newest[-(SInt32) (taps / 2)], N * sizeof(float));
+        for (UInt32 phase = 1; phase < Ratio; phase++) {
+            __builtin_memcpy(&destBuf[phase * N], &sum[phase - 1], N * sizeof(float));
+        }
+        destBuf += Ratio * N;
+    }
+}
+
+template <UInt32 N, typename VF>
+static inline __attribute__((always_inline)) void UpsampleFrames_SIMD(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    StartUpsample<N>(mixBuf, numSampleFrames, state);
+    switch (state->oversampleTable.ratio)
+    {
+        case 5:
+            UpsampleBlock<N, VF, 5>(destBuf, numSampleFrames, state);
+            break;
+        case 4:
+            UpsampleBlock<N, VF, 4>(destBuf, numSampleFrames, state);
+            break;
+        case 3:
+            UpsampleBlock<N, VF, 3>(destBuf, numSampleFrames, state);
+            break;
+        default:
+            UpsampleBlock<N, VF, 2>(destBuf, numSampleFrames, state);
+            break;
+    }
+    FinishUpsample(numSampleFrames, state);
+}
+
+template <UInt32 N>
+static void UpsampleFrames_SSE2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    UpsampleFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+template <UInt32 N>
+static __attribute__((target("avx2"))) void UpsampleFrames_AVX2(const float *mixBuf, float *destBuf, UInt32 numSampleFrames, ClipKernelState *state)
+{
+    UpsampleFrames_SIMD<N, typename FrameVector<N>::type>(mixBuf, destBuf, numSampleFrames, state);
+}
+
+// Both take 4 frames of the line input per v8sf, in two halves on SSE2, the way the scalar kernel
+// sums them up
+static inline __attribute__((always_inline)) void DecimateFrames_SIMD(ConvertKernelFunc convert, const SInt32 *sampleBuf, UInt32 firstSampleFrame,
+                                                                      float *destBuf, UInt32 numSampleFrames, ClipDecimator *decimator,
+                                                                      ClipMeterState *meter)
+{
+    const float *history = StartDecimate(convert, sampleBuf, firstSampleFrame, numSampleFrames, decimator, meter);
+    UInt32 length = decimator->ratio * decimator->taps * 2;
+
+    for (UInt32 frame = 0; frame < numSampleFrames; frame++) {
+        v8sf sum = LoadUnaligned<v8sf>(decimator->coef) * LoadUnaligned<v8sf>(history);
+        v4sf half;
+
+        for (UInt32 i = DECIMATE_LANES; i < length; i += DECIMATE_LANES) {
+            sum = sum + LoadUnaligned<v8sf>(&decimator->coef[i]) * LoadUnaligned<v8sf>(&history[i]);
+        }
+        half = __builtin_shufflevector(sum, sum, 0, 1, 2, 3) + __builtin_shufflevector(sum, sum, 4, 5, 6, 7);
+        destBuf[0] = half[0] + half[2];
+        destBuf[1] = half[1] + half[3];
+
+        history += decimator->ratio * 2;
+        destBuf += 2;
+    }
+    FinishDecimate(firstSampleFrame, numSampleFrames, decimator);
+}
+
+static void DecimateFrames_SSE2(const SInt32 *sampleBuf, UInt32 firstSampleFrame, float *destBuf, UInt32 numSampleFrames,
+                                ClipDecimator *decimator, ClipMeterState *meter)
+{
+    DecimateFrames_SIMD(ConvertSInt32ToFloat_SSE2, sampleBuf, firstSampleFrame, destBuf, numSampleFrames, decimator, meter);
+}
+
+static __attribute__((target("avx2"))) void DecimateFrames_AVX2(const SInt32 *sampleBuf, UInt32 firstSampleFrame, float *destBuf,
+                                                                UInt32 numSampleFrames, ClipDecimator *decimator, ClipMeterState *meter)
+{
+    DecimateFrames_SIMD(ConvertSInt32ToFloat_AVX2, sampleBuf, firstSampleFrame, destBuf, numSampleFrames, decimator, meter);
+}
+
+#endif /* ENVY24HT_SIMD */
+
+template <UInt32 N>
+static ClipUpsampleFunc GetClipUpsampleForChannels(ClipKernelType type)
+{
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return NULL;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return UpsampleFrames_AVX2<N>;
+        case kClipKernelSSE2:
+            return UpsampleFrames_SSE2<N>;
+#endif
+        default:
+            return UpsampleFrames_Scalar<N>;
+    }
+}
+
+ClipUpsampleFunc GetClipUpsample(ClipKernelType type, UInt32 numChannels)
+{
+    switch (numChannels)
+    {
+        case 2:
+            return GetClipUpsampleForChannels<2>(type);
+        case 6:
+            return GetClipUpsampleForChannels<6>(type);
+        case 8:
+            return GetClipUpsampleForChannels<8>(type);
+        default:
+            return NULL;
+    }
+}
+
+ClipDecimateFunc GetClipDecimate(ClipKernelType type, UInt32 numChannels)
+{
+    if (numChannels != 2) {
+        return NULL;
+    }
+
+    switch (type)
+    {
+        case kClipKernelInteger:
+            return NULL;
+#ifdef ENVY24HT_SIMD
+        case kClipKernelAVX2:
+            return DecimateFrames_AVX2;
+        case kClipKernelSSE2:
+            return DecimateFrames_SSE2;
+#endif
+        default:
+            return DecimateFrames_Scalar;
+    }
+}
+
+// The ratio and the taps the kernels can take
+static void CheckOversample(ClipOversample *oversample)
+{
+    if (oversample->ratio != 2 && oversample->ratio != CLIP_OVERSAMPLE_MAX) {
+        oversample->ratio = 1;
+    }
+    oversample->taps = (oversample->taps < CLIP_OVERSAMPLE_TAPS) ? oversample->taps & ~7U : CLIP_OVERSAMPLE_TAPS;
+    if (oversample->taps < 8) {
+        oversample->taps = 8;
+    }
+}
+
+void SetClipOversample(ClipKernelState *state, const ClipOversample *oversample)
+{
+    state->oversampleRequest++;
+    CompilerBarrier();
+    state->pendingOversample = *oversample;
+    CheckOversample(&state->pendingOversample);
+    CompilerBarrier();
+    state->oversampleRequest++;
+}
+
+// The filter is a sinc with its zeros on the frames that go in (a Nyquist filter), under a Kaiser
+// window. With 64 taps per phase it's flat to 0.001dB up to 20kHz at 44.1kHz and the images are
+// 90dB down from 24.1kHz on. The windowed sinc only sums up to about 1 over every phase, so the
+// phases are scaled to exactly 1, which keeps DC from leaving a tone at the old rate. Runs in the
+// clip pass and in the input conversion, float math is fine there, but there's no libm.
+#define OVERSAMPLE_KAISER_BETA 9.0
+
+static double BesselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+
+    for (UInt32 k = 1; k < 64 && term > sum * 1.0e-17; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Of 0 .. 1, from 1 down
+static double SquareRoot(double x)
+{
+    double root = 1.0;
+
+    if (x <= 0.0) {
+        return 0.0;
+    }
+    for (UInt32 i = 0; i < 40; i++) {
+        root = 0.5 * (root + x / root);
+    }
+    return root;
+}
+
+// Tap k of the ratio * taps, before the phases are scaled. The middle one is 1, every ratio-th
+// from there is exactly 0.
+static double OversampleTap(UInt32 ratio, UInt32 taps, UInt32 k)
+{
+    SInt32 middle = (SInt32) (ratio * taps / 2), m = (SInt32) k - middle;
+    UInt32 turn = (UInt32) (m + 2 * middle) % (2 * ratio);
+    double sine, cosine, x = (double) m / middle;
+
+    if (turn % ratio == 0) {
+        return (m == 0) ? 1.0 : 0.0;
+    }
+    SinCos(CLIP_PI * (turn % ratio) / ratio, &sine, &cosine);
+    if (turn > ratio) {
+        sine = -sine;
+    }
+    return sine / (CLIP_PI * m / ratio) * BesselI0(OVERSAMPLE_KAISER_BETA * SquareRoot(1.0 - x * x)) / BesselI0(OVERSAMPLE_KAISER_BETA);
+}
+
+void BuildOversampleTable(ClipOversampleTable *table, const ClipOversample *oversample)
+{
+    table->ratio = oversample->ratio;
+    table->taps = oversample->taps;
+
+    for (UInt32 phase = 0; phase < table->ratio; phase++)
+    {
+        double sum = 0.0;
+
+        for (UInt32 k = 0; k < table->taps; k++) {
+            sum += OversampleTap(table->ratio, table->taps, k * table->ratio + phase);
+        }
+        for (UInt32 k = 0; k < table->taps; k++) {
+            table->coef[phase][k] = (float) (OversampleTap(table->ratio, table->taps, k * table->ratio + phase) / sum);
+        }
+    }
+}
+
+bool ClipOversampleSettled(const ClipKernelState *state)
+{
+    return state->oversampleTable.ratio == 1 ||
+           FilterStateSettled(state->oversampleHistory[0], (state->oversampleTable.taps - 1) * CLIP_KERNEL_MAX_CHANNELS);
+}
+
+void SetClipDecimator(ClipDecimator *decimator, const ClipOversample *oversample, UInt32 bufferFrames)
+{
+    ClipOversample checked = *oversample;
+
+    CheckOversample(&checked);
+    decimator->ratio = checked.ratio;
+    decimator->taps = checked.taps;
+    decimator->bufferFrames = bufferFrames;
+    decimator->built = 0;
+    decimator->nextFrame = bufferFrames;
+}
+
+// The same filter for the whole ratio * taps frames, scaled to 1 and turned around, so the oldest
+// frame gets the first tap
+static void BuildDecimator(ClipDecimator *decimator)
+{
+    UInt32 length = decimator->ratio * decimator->taps;
+    double sum = 0.0;
+
+    for (UInt32 k = 0; k < length; k++) {
+        sum += OversampleTap(decimator->ratio, decimator->taps, k);
+    }
+    for (UInt32 k = 0; k < length; k++) {
+        float tap = (float) (OversampleTap(decimator->ratio, decimator->taps, length - 1 - k) / sum);
+
+        decimator->coef[k * 2] = tap;
+        decimator->coef[k * 2 + 1] = tap;
+    }
+    decimator->built = 1;
+}
@@ -61,6 +61,11 @@ struct Parm
     unsigned char MuteReg;
     unsigned char MuteOnVal;
     unsigned char MuteOffVal;
+    bool Muted; // what the mute control is set to, the silence mute comes on top
+    SInt32 CurrentValue; // what the codec is set to, volume changes walk it to TargetValue
+    SInt32 TargetValue;
+    SInt32 RampStep;
+    bool SoftStep; // the codec steps to a new value by itself, it isn't walked there
     struct Parm *Next;
 };
 
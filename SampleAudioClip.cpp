@@ -1,17 +1,12 @@
 #include "AudioEngine.h"
 #include <IOKit/IOLib.h>
-
-#define INT_MIN 2147483648.0
-#define INT_MAX 2147483647.0
-#define INT_MINDIV (1.0 / INT_MIN)
-#define INT_MAXDIV (1.0 / INT_MAX)
+#include <kern/clock.h>
 
 // The function clipOutputSamples() is called to clip and convert samples from the float mix buffer into the actual
 // hardware sample buffer.  The samples to be clipped, are guaranteed not to wrap from the end of the buffer to the
 // beginning.
-// This implementation is very inefficient, but illustrates the clip and conversion process that must take place.
 // Each floating-point sample must be clipped to a range of -1.0 to 1.0 and then converted to the hardware buffer
-// format
+// format. The actual work is done by one of the kernels in ClipKernels.cpp (scalar, SSE2, AVX2 or integer only).
 
 // The parameters are as follows:
 //		mixBuf - a pointer to the beginning of the float mix buffer - its size is based on the number of sample frames
@@ -24,67 +19,212 @@
 //		audioStream - the audio stream this function is operating on
 IOReturn Envy24HTAudioEngine::clipOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream)
 {
-    UInt32 sampleIndex, maxSampleIndex, spdifIndex;
-    float *floatMixBuf;
-	float inSample;
-    SInt32 *outputSInt32Buf = (SInt32 *)sampleBuf;
-    // Start by casting the void * mix and sample buffers to the appropriate types - float * for the mix buffer
-    // and SInt32 * for the sample buffer (because our sample hardware uses signed 32-bit samples)
-    floatMixBuf = (float *)mixBuf;
-
-    // We calculate the maximum sample index we are going to clip and convert
-    // This is an index into the entire sample and mix buffers
-    maxSampleIndex = (firstSampleFrame + numSampleFrames) * streamFormat->fNumChannels;
-    //IOLog("clip: firstFrame = %lu, numSampleFrames = %lu, channels = %lu, maxSampleIndex = %lu\n", firstSampleFrame, numSampleFrames, streamFormat->fNumChannels, maxSampleIndex);
+    //IOLog("clip: firstFrame = %lu, numSampleFrames = %lu\n", firstSampleFrame, numSampleFrames);
     
-    // Loop through the mix/sample buffers one sample at a time and perform the clip and conversion operations
-    for (sampleIndex = (firstSampleFrame * streamFormat->fNumChannels); sampleIndex < maxSampleIndex; sampleIndex++) {
-        // Fetch the floating point mix sample
-        inSample = floatMixBuf[sampleIndex];
-        
-        // Clip that sample to a range of -1.0 to 1.0
-        // A softer clipping operation could be done here
-        if (inSample > 1.0)
-		{
-            inSample = 1.0;
+    applyKernelRequests();
+    
+    // With one of the non-mixable integer formats the client wrote the samples into the DMA buffer
+    // itself, there's nothing to clip. The S/PDIF output gets its pair copied over as is, the
+    // downmix needs the mix and falls back to the first pair. The routing, the software volume
+    // and the output stages are left out, and the output meters stay down.
+    if (streamFormat && !streamFormat->fIsMixable)
+    {
+        mirrorKernel((const SInt32 *)sampleBuf, outputBufferSPDIF, (spdifSource == SPDIF_SOURCE_DOWNMIX) ? 0 : spdifSource,
+                     firstSampleFrame, numSampleFrames);
+        silentFrames = 0;
+        ((Envy24HTAudioDevice *) audioDevice)->requestSilenceMute(false);
+    }
+    else
+    {
+        // Pick up a new output routing and S/PDIF feed. A permutation or a matrix runs in front of the
+        // stage, on the whole mix: routing the clients while they're mixed can't switch tables at a
+        // frame they all agree on, as they mix ahead by different amounts. The S/PDIF output gets the clip kernel's copy of the first pair, unless another feed is set.
+        UpdateClipRoute(&clipState);
+        bool routed = (clipState.route.mode != kClipRouteIdentity);
+        bool spdifFed = (clipState.spdif.mode != kClipRouteIdentity);
+        bool bassManaged = (clipState.bassTable.on != 0);
+        bool equalized = (clipState.eq.numSections != 0);
+        bool convolved = ClipConvActive(&clipState) && clipState.conv->numChannels == outputChannels;
+        bool delayed = ClipDelayActive(&clipState) && clipState.delayLines->numChannels == outputChannels;
+        UInt32 ratio = clipState.oversampleTable.ratio;
+    
+        // Clip to -1.0 .. 1.0 and convert to SInt32 (dithered to 24 bits if enabled) using the kernel picked
+        // for this CPU and channel count, unless the mix is silent.
+        // The kernel works out the offsets into the buffers itself and fills the SPDIF buffer with the
+        // first stereo pair in the same pass.
+        if (clipSilence((const float *)mixBuf, (SInt32 *)sampleBuf, firstSampleFrame, numSampleFrames, ratio))
+        {
+            // Nothing to clip, the DMA buffer is zero already
         }
-		else if (inSample < -1.0)
-		{
-            inSample = -1.0;
+        else if (!outputStage && !routed && !spdifFed && !bassManaged && !equalized && !convolved && !delayed && ratio == 1)
+        {
+            clipKernel((const float *)mixBuf, (SInt32 *)sampleBuf, outputBufferSPDIF, firstSampleFrame, numSampleFrames, &clipState);
         }
+        else
+        {
+            // With routing, bass management, the EQ, the convolution, the delays, a soft clipper or a
+            // limiter in front, they run a chunk at a time into the scratch buffers in the clip state,
+            // and the clip kernel takes it from there. The S/PDIF kernel works on the same chunk, the
+            // clip kernel's copy goes to a scratch buffer then.
+            const float *mix = (const float *)mixBuf;
+            SInt32 *samples = (SInt32 *)sampleBuf;
+            UInt32 count;
         
-        // Scale the -1.0 to 1.0 range to the appropriate scale for signed 32-bit samples and then
-        // convert to SInt32 and store in the hardware sample buffer
-		if (inSample >= 0)
-		{
-			outputSInt32Buf[sampleIndex] = (SInt32) (inSample * INT_MAX);
-		}
-		else
-		{
-			outputSInt32Buf[sampleIndex] = (SInt32) (inSample * INT_MIN);
-		}
+            for (UInt32 done = 0; done < numSampleFrames; done += count)
+            {
+                UInt32 frame = firstSampleFrame + done;
+                const float *chunk = &mix[frame * outputChannels];
+            
+                count = (numSampleFrames - done < CLIP_STAGE_FRAMES) ? numSampleFrames - done : CLIP_STAGE_FRAMES;
+            
+                if (routed)
+                {
+                    outputRoute(chunk, clipState.routeBuf, count, &clipState);
+                    chunk = clipState.routeBuf;
+                }
+                if (bassManaged)
+                {
+                    outputBass(chunk, clipState.bassBuf, count, &clipState);
+                    chunk = clipState.bassBuf;
+                }
+                if (equalized)
+                {
+                    outputEq(chunk, clipState.eqBuf, count, &clipState);
+                    chunk = clipState.eqBuf;
+                }
+                if (convolved)
+                {
+                    outputConv(chunk, clipState.convBuf, count, &clipState);
+                    chunk = clipState.convBuf;
+                }
+                if (delayed)
+                {
+                    outputDelay(chunk, clipState.delayBuf, count, &clipState);
+                    chunk = clipState.delayBuf;
+                }
+                if (outputStage)
+                {
+                    outputStage(chunk, clipState.stageBuf, count, &clipState);
+                    chunk = clipState.stageBuf;
+                }
+                if (ratio > 1)
+                {
+                    clipOversampled(chunk, samples, spdifFed, frame, count, ratio);
+                    continue;
+                }
+                if (spdifFed)
+                {
+                    spdifKernel(chunk, &outputBufferSPDIF[frame * 2], count, &clipState);
+                }
+                clipKernel(chunk, &samples[frame * outputChannels], spdifFed ? clipState.spdifBuf : &outputBufferSPDIF[frame * 2], 0, count, &clipState);
+            }
+        }
     }
-	
-	// Fill SPDIF buffer with first stereo pair mixed sound
-	UInt32 skip = (streamFormat->fNumChannels - 2) + 1;
-	spdifIndex = firstSampleFrame * 2;
-	for (sampleIndex = (firstSampleFrame * streamFormat->fNumChannels); sampleIndex < maxSampleIndex; sampleIndex+=skip)
-	{
-        outputBufferSPDIF[spdifIndex++] = outputSInt32Buf[sampleIndex++];
-		outputBufferSPDIF[spdifIndex++] = outputSInt32Buf[sampleIndex];
+    clipEnd = (firstSampleFrame + numSampleFrames) % getNumSampleFramesPerBuffer();
+    
+    // The kernels measured the levels on the way, they're handed out once per loop through the
+    // buffer, which is once per interrupt
+    if (firstSampleFrame + numSampleFrames >= getNumSampleFramesPerBuffer())
+    {
+        UInt64 now;
+        
+        clock_get_uptime(&now);
+        PublishClipMeters(&clipState.meter, outputChannels, getNumSampleFramesPerBuffer() * clipState.oversampleTable.ratio,
+                          currentSampleRate * clipState.oversampleTable.ratio, now);
     }
-	
     
     return kIOReturnSuccess;
 }
 
+// Upsamples a chunk of the mix and clips it into the oversampled DMA buffer, ratio frames for
+// every one of the stream's, a stage chunk at a time so the S/PDIF feed fits the scratch buffer.
+// The S/PDIF buffer goes around ratio times per loop through the stream, so the sub-chunks stop
+// at its end. The stream's own buffer gets the frames
+// that went in, the first phase of every frame, for the loopback stream.
+void Envy24HTAudioEngine::clipOversampled(const float *chunk, SInt32 *sampleBuf, bool spdifFed, UInt32 firstSampleFrame, UInt32 numSampleFrames,
+                                          UInt32 ratio)
+{
+    UInt32 numBufferFrames = getNumSampleFramesPerBuffer();
+    UInt32 first = firstSampleFrame * ratio;
+    UInt32 count;
+    
+    outputUpsample(chunk, clipState.oversampleBuf, numSampleFrames, &clipState);
+    for (UInt32 done = 0; done < numSampleFrames * ratio; done += count)
+    {
+        const float *upsampled = &clipState.oversampleBuf[done * outputChannels];
+        UInt32 spdifFrame = (first + done) % numBufferFrames;
+        SInt32 *spdif = &outputBufferSPDIF[spdifFrame * 2];
+        
+        count = (numSampleFrames * ratio - done < CLIP_STAGE_FRAMES) ? numSampleFrames * ratio - done : CLIP_STAGE_FRAMES;
+        count = (count < numBufferFrames - spdifFrame) ? count : numBufferFrames - spdifFrame;
+        if (spdifFed)
+        {
+            spdifKernel(upsampled, spdif, count, &clipState);
+        }
+        clipKernel(upsampled, &oversampleBuffer[(first + done) * outputChannels], spdifFed ? clipState.spdifBuf : spdif, 0, count, &clipState);
+    }
+    phaseKernel(&oversampleBuffer[first * outputChannels], &sampleBuf[firstSampleFrame * outputChannels], ratio, numSampleFrames);
+}
+
+// Digital silence comes out as zeros whatever the gain, the routing or the soft clip, so a mix
+// buffer of zeros (an idle mix, or clients playing silence) isn't clipped: the DMA buffer is just
+// cleared, without dither, and once a whole buffer of zeros has gone out since the last sound it's
+// left alone. The limiter still has older samples in its delay line, so it always runs, and so do
+// the bass management, the EQ, the convolution and the oversampling until their filters have rung
+// out, and the delays until the last sound has come out of them. The gain ramps wait for the sound
+// to come back. While oversampling, the oversampled DMA buffer and the S/PDIF buffer are cleared
+// along with the stream's.
+// Returns true if there was nothing to clip. Also asks the device to mute the codecs after
+// SILENCE_MUTE_KEY milliseconds of silence, and to unmute them with the first sound.
+bool Envy24HTAudioEngine::clipSilence(const float *mixBuf, SInt32 *sampleBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 ratio)
+{
+    Envy24HTAudioDevice *device = (Envy24HTAudioDevice *) audioDevice;
+    UInt32 muteFrames;
+    
+    if (stageMode == kClipStageLimiter || !ClipBassSettled(&clipState) || !ClipEqSettled(&clipState) ||
+        !ClipConvSettled(&clipState) || !ClipDelaySettled(&clipState) || !ClipOversampleSettled(&clipState) ||
+        !silenceKernel(&mixBuf[firstSampleFrame * outputChannels], numSampleFrames * outputChannels))
+    {
+        silentFrames = 0;
+        device->requestSilenceMute(false);
+        return false;
+    }
+    
+    if (silentFrames < getNumSampleFramesPerBuffer())
+    {
+        eraseKernel(NULL, sampleBuf, (ratio > 1) ? NULL : outputBufferSPDIF, firstSampleFrame, numSampleFrames);
+        if (ratio > 1)
+        {
+            eraseHardwareFrames(firstSampleFrame, numSampleFrames, numSampleFrames, ratio);
+        }
+        erasedFrames += numSampleFrames;
+    }
+    else
+    {
+        skippedFrames += numSampleFrames;
+    }
+    if (silentFrames < 0x80000000)
+    {
+        silentFrames += numSampleFrames;
+    }
+    
+    // Without a 64 bit division, silenceMuteMS is at most an hour
+    muteFrames = (silenceMuteMS / 1000) * currentSampleRate + (silenceMuteMS % 1000) * currentSampleRate / 1000;
+    if (silenceMuteMS && silentFrames >= muteFrames)
+    {
+        device->requestSilenceMute(true);
+    }
+    
+    return true;
+}
+
 // The function convertInputSamples() is responsible for converting from the hardware format 
 // in the input sample buffer to float samples in the destination buffer and scale the samples 
 // to a range of -1.0 to 1.0.  This function is guaranteed not to have the samples wrapped
 // from the end of the buffer to the beginning.
 // This function only needs to be implemented if the device has any input IOAudioStreams
 
-// This implementation is very inefficient, but illustrates the conversion and scaling that needs to take place.
+// The conversion itself is done by one of the kernels in ClipKernels.cpp.
 
 // The parameters are as follows:
 //		sampleBuf - a pointer to the beginning of the hardware formatted sample buffer - this is the same buffer passed
@@ -97,38 +237,73 @@ IOReturn Envy24HTAudioEngine::clipOutputSamples(const void *mixBuf, void *sample
 //		audioStream - the audio stream this function is operating on
 IOReturn Envy24HTAudioEngine::convertInputSamples(const void *sampleBuf, void *destBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream)
 {
-    UInt32 numSamplesLeft;
-    float *floatDestBuf;
-    SInt32 *inputBuf;
-	SInt32 inputSample;
-	UInt32 i;
-    
-    // Start by casting the destination buffer to a float *
-    floatDestBuf = (float *)destBuf;
     // Determine the starting point for our input conversion 
-    inputBuf = &(((SInt32 *)sampleBuf)[firstSampleFrame * streamFormat->fNumChannels]);
+    const SInt32 *inputBuf = &(((const SInt32 *)sampleBuf)[firstSampleFrame * streamFormat->fNumChannels]);
     
-    // Calculate the number of actual samples to convert
-    numSamplesLeft = numSampleFrames * streamFormat->fNumChannels;
-    
-	//IOLog("convert: %lu %lu %ld\n", numSampleFrames, numSamplesLeft, *inputBuf);
+	//IOLog("convert: %lu %lu %ld\n", numSampleFrames, numSampleFrames * streamFormat->fNumChannels, *inputBuf);
 	
-    // Loop through each sample and scale and convert them
-    for (i = 0; i < numSamplesLeft; i++) {
-        // Fetch the SInt32 input sample
-        inputSample = *inputBuf;
+    // The loopback stream reads the output DMA buffer the same way, the output meters already cover it
+    struct ClipMeterState *meter = (sampleBuf == outputBuffer) ? NULL : &inputMeter;
+    UInt32 numBufferFrames = getNumSampleFramesPerBuffer();
+    
+    // Every client that records gets here for the same frames. They're only metered with the first
+    // one, up to inputEnd. Reads are placed by the engine's loop count, so it takes a read more than
+    // a whole buffer late to be mistaken for a new one.
+    UInt32 metered = 0;
+    UInt64 start = 0;
+    
+    if (meter)
+    {
+        start = getRecordedFrame(firstSampleFrame, numSampleFrames);
+        metered = (inputEnd <= start) ? 0 : (inputEnd - start < numSampleFrames) ? (UInt32)(inputEnd - start) : numSampleFrames;
+        if (metered < numSampleFrames)
+        {
+            inputEnd = start + numSampleFrames;
+        }
+    }
     
-        // Scale that sample to a range of -1.0 to 1.0, convert to float and store in the destination buffer
-        // at the proper location
-        if (inputSample >= 0) {
-            *floatDestBuf = inputSample * INT_MAXDIV;
-        } else {
-            *floatDestBuf = inputSample * INT_MINDIV;
+    // While oversampling, the line input comes in at the hardware rate, and its buffer only holds
+    // 1/ratio of a loop through the stream. The decimator takes the frames that aren't in
+    // decimatedBuffer yet (up to decimatedEnd) down into it a stage chunk at a time, converting and
+    // metering on the way, and goes around the end of the hardware buffer itself. Its history only
+    // carries over while it runs through the stream in order, so all clients copy from there. A new
+    // ratio or format empties it.
+    UInt32 ratio = (sampleBuf == inputBuffer) ? inputDecimator.ratio : 1;
+    UInt32 numChannels = streamFormat->fNumChannels;
+    
+    // Scale the samples to a range of -1.0 to 1.0 and convert them to float using the kernel picked in init(),
+    // metering them on the way. The meters are handed out once per loop through the buffer, like the output ones.
+    if (ratio > 1)
+    {
+        UInt32 decimated = (decimatedEnd <= start) ? 0 : (decimatedEnd - start < numSampleFrames) ? (UInt32)(decimatedEnd - start) : numSampleFrames;
+        UInt32 count;
+        
+        for (UInt32 done = decimated; done < numSampleFrames; done += count)
+        {
+            UInt32 frame = firstSampleFrame + done;
+            
+            count = (numSampleFrames - done < CLIP_STAGE_FRAMES) ? numSampleFrames - done : CLIP_STAGE_FRAMES;
+            inputDecimate((const SInt32 *)sampleBuf, frame * ratio % numBufferFrames, &decimatedBuffer[frame * numChannels], count,
+                          &inputDecimator, (done >= metered) ? meter : NULL);
+        }
+        if (decimated < numSampleFrames)
+        {
+            decimatedEnd = start + numSampleFrames;
         }
+        memcpy(destBuf, &decimatedBuffer[firstSampleFrame * numChannels], numSampleFrames * numChannels * sizeof(float));
+    }
+    else
+    {
+        convertKernel(inputBuf, (float *)destBuf, metered * numChannels, numChannels, NULL);
+        convertKernel(&inputBuf[metered * numChannels], &((float *)destBuf)[metered * numChannels], (numSampleFrames - metered) * numChannels,
+                      numChannels, meter);
+    }
+    if (meter && metered < numSampleFrames && firstSampleFrame + numSampleFrames >= numBufferFrames)
+    {
+        UInt64 now;
         
-        // Move on to the next sample
-        ++inputBuf;
-        ++floatDestBuf;
+        clock_get_uptime(&now);
+        PublishClipMeters(meter, streamFormat->fNumChannels, numBufferFrames * ratio, currentSampleRate * ratio, now);
     }
 
     return kIOReturnSuccess;